@@ -0,0 +1,75 @@
+/*****************************************************************************
+* Title         : Host stand-in for the AVR32 cycle counter
+* Copyright: GPL V2
+*
+*See include/compiler.h.
+*****************************************************************************/
+
+#include <time.h>
+#include "compiler.h"
+#include "enc28j60_sim.h"
+
+static uint8_t countCpuTime = 1;
+
+uint32_t HostCycleCounter(void)
+{
+  struct timespec cpu;
+  uint64_t ns = ENC28J60Sim_GetTime();
+
+  if (countCpuTime){
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    ns += (uint64_t)cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+  }
+  return (uint32_t)(ns * (HOST_CPU_HZ / 1000) / 1000000);
+}
+
+void HostCycleCounter_CountCpuTime(uint8_t enable)
+{
+  countCpuTime = enable;
+}
+
+/************************************************************************/
+/* COMPARE                                                              */
+/************************************************************************/
+static uint32_t compare = 0;
+static uint8_t compareArmed = 0;
+static __int_handler compareHandler = 0;
+
+uint32_t HostCycleCounter_GetCompare(void)
+{
+  return compare;
+}
+
+// As on the MCU, writing COMPARE clears a pending interrupt and 0 stops it
+void HostCycleCounter_SetCompare(uint32_t value)
+{
+  compare = value;
+  compareArmed = value != 0;
+}
+
+void HostCycleCounter_SetCompareHandler(__int_handler handler)
+{
+  compareHandler = handler;
+}
+
+// Raises the COMPARE interrupt if COUNT has reached COMPARE
+void HostCycleCounter_Service(void)
+{
+  while (compareArmed && compareHandler && (int32_t)(HostCycleCounter() - compare) >= 0){
+    compareArmed = 0;
+    compareHandler();
+  }
+}
+
+// The idle sleep mode: the virtual clock runs on to the next COMPARE
+// match, or by a ms if there is none
+void HostSleep(void)
+{
+  int32_t cycles = (int32_t)(compare - HostCycleCounter());
+  uint64_t ns = 1000000;
+
+  if (compareArmed && compareHandler){
+    ns = cycles > 0 ? (uint64_t)cycles * 1000000 / (HOST_CPU_HZ / 1000) + 1 : 0;
+  }
+  ENC28J60Sim_AdvanceTime(ns);
+}
@@ -0,0 +1,875 @@
+/*****************************************************************************
+* Title         : Behavioral model of the Microchip ENC28J60 for host builds
+* Copyright: GPL V2
+*
+*Implements the SPI master service of the host build on top of a model of
+*the ENC28J60. The opcodes, register side effects and buffer layout follow
+*the datasheet (DS39662): see chapter 4 for the SPI instruction set, 6.1 for
+*the receive buffer, 7.1 for transmission and 8 for the receive filters.
+*
+*Timing is modelled coarsely: each SPI byte advances the virtual clock by
+*8 bit times of the configured baudrate and a transmitted frame occupies
+*the wire for preamble + frame + CRC + inter-frame gap at 10 Mbit/s. The
+*frame is read from buffer memory when the transmission completes, so a
+*host that overwrites the TX area while TXRTS is still set will see it.
+*****************************************************************************/
+
+#include <string.h>
+#include "enc28j60_sim.h"
+#include "intc.h"
+#include "compiler.h"
+#include "EtherShield/ENC28J60/enc28j60.h"
+#include "EtherShield/TransportLayer/net.h"
+
+#define SIM_MEMORY_SIZE       0x2000
+#define SIM_POINTER_MASK      0x1FFF
+// 10 Mbit/s: 800ns per byte on the wire
+#define SIM_WIRE_BYTE_TIME    800
+// preamble + SFD and inter-frame gap
+#define SIM_WIRE_OVERHEAD     (8 + 12)
+#define SIM_MIN_FRAMELEN      60
+#define SIM_CRC_LEN           4
+#define SIM_RSV_LEN           6
+#define SIM_TSV_LEN           7
+#define SIM_DEFAULT_BAUDRATE  3000000
+// DMA copies and checksums one byte per two cycles of the 25 MHz clock
+#define SIM_DMA_BYTE_TIME     80
+
+// Opcodes as they appear in the upper 3 bits of the first byte
+#define SIM_OP_RCR            (ENC28J60_READ_CTRL_REG & 0xE0)
+#define SIM_OP_RBM            (ENC28J60_READ_BUF_MEM & 0xE0)
+#define SIM_OP_WCR            (ENC28J60_WRITE_CTRL_REG & 0xE0)
+#define SIM_OP_WBM            (ENC28J60_WRITE_BUF_MEM & 0xE0)
+#define SIM_OP_BFS            (ENC28J60_BIT_FIELD_SET & 0xE0)
+#define SIM_OP_BFC            (ENC28J60_BIT_FIELD_CLR & 0xE0)
+#define SIM_OP_SRC            (ENC28J60_SOFT_RESET & 0xE0)
+
+volatile avr32_spi_t ENC28J60Sim_SPI;
+
+static uint8_t simMemory[SIM_MEMORY_SIZE];
+static uint8_t simRegisters[4][32];
+static uint16_t simPhyRegisters[32];
+static uint8_t simPacketCount = 0;
+
+static uint8_t simSelected = 0;
+static uint8_t simFirstByte = 0;
+static uint8_t simOpcode = 0;
+static uint8_t simArgument = 0;
+static uint8_t simReceiveData = 0;
+
+static uint8_t simRxReadLow = 0;    // ERXRDPTL, taken over with the write of ERXRDPTH
+static uint8_t simTxBusy = 0;
+static uint16_t simTxStart = 0;
+static uint16_t simTxEnd = 0;
+static uint64_t simTxDoneAt = 0;
+
+static uint8_t simDmaBusy = 0;
+static uint64_t simDmaDoneAt = 0;
+
+static uint64_t simTime = 0;
+static uint32_t simByteTime = 8000000000ULL / SIM_DEFAULT_BAUDRATE;
+
+static struct enc28j60_sim_stats simStats;
+static enc28j60_sim_tx_handler_t simTxHandler = 0;
+static void *simTxContext = 0;
+
+static __int_handler simIrqHandler = 0;
+static uint8_t simIrqLine = 0;
+static uint8_t simIrqPending = 0;
+static uint8_t simInIrq = 0;
+
+/************************************************************************/
+/* Register file                                                        */
+/************************************************************************/
+static uint8_t *SimRegister(uint8_t address)
+{
+  // EIE, EIR, ESTAT, ECON2 and ECON1 are mapped into every bank
+  if(GET_REGISTERADDRESS(address) >= EIE)
+    return &simRegisters[0][GET_REGISTERADDRESS(address)];
+  return &simRegisters[GET_BANK_CODE(address) & 0x3][GET_REGISTERADDRESS(address)];
+}
+
+static uint16_t SimGet16(uint8_t lowAddress)
+{
+  return *SimRegister(lowAddress) | (*SimRegister(lowAddress + 1) << 8);
+}
+
+static void SimSet16(uint8_t lowAddress, uint16_t value)
+{
+  *SimRegister(lowAddress) = value & 0xFF;
+  *SimRegister(lowAddress + 1) = value >> 8;
+}
+
+static uint8_t SimInterruptFlags(void)
+{
+  uint8_t flags = *SimRegister(EIR) & ~EIR_PKTIF;
+  // PKTIF mirrors EPKTCNT != 0 and cannot be cleared by the host
+  if(simPacketCount)
+    flags |= EIR_PKTIF;
+  return flags;
+}
+
+static uint8_t SimInterruptAsserted(void)
+{
+  uint8_t enable = *SimRegister(EIE);
+  return (enable & EIE_INTIE) && (SimInterruptFlags() & enable & 0x7F);
+}
+
+// Calls the registered interrupt handler on a falling edge of INT. The MCU
+// only takes the interrupt between SPI transactions and not while its
+// handler is still running.
+static void SimCheckInterrupt(void)
+{
+  uint8_t line = SimInterruptAsserted();
+
+  if(line && !simIrqLine)
+    simIrqPending = 1;
+  simIrqLine = line;
+  if(simSelected || simInIrq)
+    return;
+  while(simIrqPending && simIrqHandler)
+  {
+    simIrqPending = 0;
+    simStats.interrupts++;
+    simInIrq = 1;
+    simIrqHandler();
+    simInIrq = 0;
+  }
+}
+
+static void SimPowerOnReset(void)
+{
+  memset(simRegisters, 0, sizeof(simRegisters));
+  memset(simPhyRegisters, 0, sizeof(simPhyRegisters));
+  simPacketCount = 0;
+  simTxBusy = 0;
+  simDmaBusy = 0;
+
+  SimSet16(ERDPTL, 0x05FA);
+  SimSet16(ERXSTL, 0x05FA);
+  SimSet16(ERXNDL, 0x1FFF);
+  SimSet16(ERXRDPTL, 0x05FA);
+  simRxReadLow = 0xFA;
+  SimSet16(ERXWRPTL, 0x05FA);
+  *SimRegister(ERXFCON) = ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_BCEN;
+  *SimRegister(ECON2) = ECON2_AUTOINC;
+  *SimRegister(ESTAT) = ESTAT_CLKRDY;
+  *SimRegister(MACON2) = MACON2_MARST;
+  *SimRegister(MACLCON1) = 0x0F;
+  *SimRegister(MACLCON2) = 0x37;
+  SimSet16(MAMXFLL, 0x0600);
+  *SimRegister(ECOCON) = 0x04;
+  SimSet16(EPAUSL, 0x1000);
+  // silicon revision B7
+  *SimRegister(EREVID) = 0x06;
+
+  simPhyRegisters[PHSTAT1] = PHSTAT1_PHDPX|PHSTAT1_LLSTAT;
+  simPhyRegisters[PHHID1] = 0x0083;
+  simPhyRegisters[PHHID2] = 0x1400;
+  simPhyRegisters[PHSTAT2] = PHSTAT2_LSTAT;
+  simPhyRegisters[PHLCON] = 0x3422;
+}
+
+/************************************************************************/
+/* Buffer memory                                                        */
+/************************************************************************/
+static uint16_t SimNextRxAddress(uint16_t address)
+{
+  // reads and received data wrap inside the receive buffer (datasheet 3.2.1)
+  if(address == SimGet16(ERXNDL))
+    return SimGet16(ERXSTL);
+  return (address + 1) & SIM_POINTER_MASK;
+}
+
+static uint16_t SimRxFreeSpace(void)
+{
+  // Equation 6-1 of the datasheet
+  uint16_t start = SimGet16(ERXSTL);
+  uint16_t end = SimGet16(ERXNDL);
+  uint16_t readPtr = SimGet16(ERXRDPTL);
+  uint16_t writePtr = SimGet16(ERXWRPTL);
+
+  if(writePtr > readPtr)
+    return (end - start) - (writePtr - readPtr);
+  if(writePtr == readPtr)
+    return end - start;
+  return readPtr - writePtr - 1;
+}
+
+/************************************************************************/
+/* Transmission                                                         */
+/************************************************************************/
+static void SimTransmitStart(void)
+{
+  uint16_t len;
+
+  // ETXST and ETXND must not change while TXRTS is set, latch them
+  simTxStart = SimGet16(ETXSTL);
+  simTxEnd = SimGet16(ETXNDL);
+  len = (simTxEnd - simTxStart) & SIM_POINTER_MASK;
+  if(len < SIM_MIN_FRAMELEN)
+    len = SIM_MIN_FRAMELEN;
+  simTxBusy = 1;
+  simTxDoneAt = simTime + (uint64_t)(len + SIM_CRC_LEN + SIM_WIRE_OVERHEAD) * SIM_WIRE_BYTE_TIME;
+}
+
+static void SimTransmitComplete(void)
+{
+  uint8_t frame[SIM_MEMORY_SIZE];
+  uint16_t start = simTxStart;
+  uint16_t end = simTxEnd;
+  uint16_t address;
+  uint16_t len = 0;
+  uint8_t i;
+
+  // the first byte is the per packet control byte
+  address = (start + 1) & SIM_POINTER_MASK;
+  while(len < ((end - start) & SIM_POINTER_MASK))
+  {
+    frame[len++] = simMemory[address];
+    address = (address + 1) & SIM_POINTER_MASK;
+  }
+  if((*SimRegister(MACON3) & (MACON3_PADCFG2|MACON3_PADCFG1|MACON3_PADCFG0)) && len < SIM_MIN_FRAMELEN)
+  {
+    memset(&frame[len], 0, SIM_MIN_FRAMELEN - len);
+    len = SIM_MIN_FRAMELEN;
+  }
+
+  // transmit status vector behind the frame (datasheet table 5-1)
+  address = (end + 1) & SIM_POINTER_MASK;
+  for(i = 0; i < SIM_TSV_LEN; i++)
+  {
+    uint8_t value = 0;
+    if(i == 0)
+      value = len & 0xFF;
+    else if(i == 1)
+      value = len >> 8;
+    else if(i == 2)
+      value = 0x80; // transmit done
+    simMemory[address] = value;
+    address = (address + 1) & SIM_POINTER_MASK;
+  }
+
+  simTxBusy = 0;
+  *SimRegister(ECON1) &= ~ECON1_TXRTS;
+  *SimRegister(EIR) |= EIR_TXIF;
+  simStats.framesTransmitted++;
+  if(simTxHandler)
+    simTxHandler(frame, len, simTxContext);
+}
+
+/************************************************************************/
+/* DMA controller                                                       */
+/************************************************************************/
+static uint16_t SimDmaLength(void)
+{
+  uint16_t start = SimGet16(EDMASTL);
+  uint16_t end = SimGet16(EDMANDL);
+
+  // a range that wraps is only valid inside the receive buffer
+  if(end >= start)
+    return end - start + 1;
+  return (SimGet16(ERXNDL) - start + 1) + (end - SimGet16(ERXSTL) + 1);
+}
+
+static void SimDmaStart(void)
+{
+  simDmaBusy = 1;
+  simDmaDoneAt = simTime + (uint64_t)SimDmaLength() * SIM_DMA_BYTE_TIME;
+  simStats.dmaOperations++;
+}
+
+static void SimDmaComplete(void)
+{
+  uint16_t address = SimGet16(EDMASTL);
+  uint16_t destination = SimGet16(EDMADSTL);
+  uint16_t len = SimDmaLength();
+  uint32_t sum = 0;
+  uint16_t i;
+
+  // the memory is read at the end, so host writes racing the DMA show up
+  for(i = 0; i < len; i++)
+  {
+    if(*SimRegister(ECON1) & ECON1_CSUMEN)
+      sum += (i & 1) ? simMemory[address] : (uint32_t)simMemory[address] << 8;
+    else
+    {
+      simMemory[destination] = simMemory[address];
+      destination = SimNextRxAddress(destination);
+    }
+    address = SimNextRxAddress(address);
+  }
+  if(*SimRegister(ECON1) & ECON1_CSUMEN)
+  {
+    // IP checksum (RFC 791) of the range, an odd last byte is padded with zero
+    while(sum >> 16)
+      sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = ~sum & 0xFFFF;
+    *SimRegister(EDMACSH) = sum >> 8;
+    *SimRegister(EDMACSL) = sum & 0xFF;
+  }
+
+  simDmaBusy = 0;
+  *SimRegister(ECON1) &= ~ECON1_DMAST;
+  *SimRegister(EIR) |= EIR_DMAIF;
+}
+
+static void SimService(void)
+{
+  if(simTxBusy && simTime >= simTxDoneAt)
+    SimTransmitComplete();
+  if(simDmaBusy && simTime >= simDmaDoneAt)
+    SimDmaComplete();
+}
+
+/************************************************************************/
+/* Register side effects                                                */
+/************************************************************************/
+static uint8_t SimReadRegister(uint8_t address)
+{
+  switch(address)
+  {
+    case EPKTCNT:
+      return simPacketCount;
+    case MISTAT:
+      // MII operations complete immediately
+      return 0;
+    default:
+      break;
+  }
+  if(GET_REGISTERADDRESS(address) == EIR)
+    return SimInterruptFlags();
+  if(GET_REGISTERADDRESS(address) == ESTAT)
+    return (*SimRegister(ESTAT) & ~ESTAT_INT) | (SimInterruptAsserted() ? ESTAT_INT : 0);
+  return *SimRegister(address);
+}
+
+static void SimWriteRegister(uint8_t address, uint8_t data)
+{
+  uint8_t previous;
+  uint16_t phyAddress;
+
+  if(GET_REGISTERADDRESS(address) >= EIE)
+    address = GET_REGISTERADDRESS(address);
+
+  previous = *SimRegister(address);
+  switch(address)
+  {
+    case EPKTCNT:
+    case ERXWRPTL:
+    case ERXWRPTH:
+    case EREVID:
+      // read only
+      return;
+    case ERXRDPTL:
+      // buffered until ERXRDPTH is written, so the pointer never is half
+      // updated while a packet is received (datasheet 6.1)
+      simRxReadLow = data;
+      return;
+    case ESTAT:
+      // only the status bits the host may clear
+      *SimRegister(ESTAT) = (previous & ESTAT_CLKRDY) | (data & (ESTAT_LATECOL|ESTAT_TXABRT));
+      return;
+    default:
+      break;
+  }
+  *SimRegister(address) = data;
+
+  switch(address)
+  {
+    case ECON1:
+      if((previous ^ data) & (ECON1_BSEL1|ECON1_BSEL0))
+        simStats.bankSwitches++;
+      if(data & ECON1_TXRST)
+      {
+        simTxBusy = 0;
+        *SimRegister(ECON1) &= ~ECON1_TXRTS;
+      }
+      else if((data & ECON1_TXRTS) && !(previous & ECON1_TXRTS))
+        SimTransmitStart();
+      if((data & ECON1_DMAST) && !(previous & ECON1_DMAST))
+        SimDmaStart();
+      else if(simDmaBusy)
+        *SimRegister(ECON1) |= ECON1_DMAST; // only the DMA controller clears DMAST
+      break;
+    case ECON2:
+      if(data & ECON2_PKTDEC)
+      {
+        if(simPacketCount)
+          simPacketCount--;
+        *SimRegister(ECON2) &= ~ECON2_PKTDEC;
+      }
+      break;
+    case ERXRDPTH:
+      *SimRegister(ERXRDPTL) = simRxReadLow;
+      break;
+    case ERXSTL:
+    case ERXSTH:
+      // programming ERXST also moves the hardware write pointer
+      SimSet16(ERXWRPTL, SimGet16(ERXSTL));
+      break;
+    case MIWRH:
+      phyAddress = *SimRegister(MIREGADR) & 0x1F;
+      simPhyRegisters[phyAddress] = SimGet16(MIWRL);
+      // PRST clears itself once the PHY reset completed
+      if(phyAddress == PHCON1)
+        simPhyRegisters[PHCON1] &= ~PHCON1_PRST;
+      break;
+    case MICMD:
+      if(data & MICMD_MIIRD)
+        SimSet16(MIRDL, simPhyRegisters[*SimRegister(MIREGADR) & 0x1F]);
+      break;
+    default:
+      break;
+  }
+}
+
+static void SimCheckTransmitRequest(uint8_t address, uint8_t data)
+{
+  // the chip ignores TXRTS while the previous frame is still on the wire
+  if(GET_REGISTERADDRESS(address) == ECON1 && (data & ECON1_TXRTS) && simTxBusy)
+    simStats.txRequestsLost++;
+}
+
+/************************************************************************/
+/* SPI instruction decoder                                              */
+/************************************************************************/
+static uint8_t SimExchange(uint8_t mosi)
+{
+  uint8_t address;
+  uint8_t miso = 0;
+  uint16_t pointer;
+
+  simStats.spiBytes++;
+  simTime += simByteTime;
+  SimService();
+
+  if(!simSelected)
+    return 0xFF;
+
+  if(simFirstByte)
+  {
+    simFirstByte = 0;
+    simOpcode = mosi & 0xE0;
+    simArgument = GET_REGISTERADDRESS(mosi);
+    switch(simOpcode)
+    {
+      case SIM_OP_RCR: simStats.readCtrlOps++; break;
+      case SIM_OP_RBM: simStats.readBufferOps++; break;
+      case SIM_OP_WCR: simStats.writeCtrlOps++; break;
+      case SIM_OP_WBM: simStats.writeBufferOps++; break;
+      case SIM_OP_BFS:
+      case SIM_OP_BFC: simStats.bitFieldOps++; break;
+      case SIM_OP_SRC:
+        simStats.softResets++;
+        SimPowerOnReset();
+        break;
+      default: break;
+    }
+    return 0;
+  }
+
+  address = ADD_BANK_CODE(simArgument, (*SimRegister(ECON1) & (ECON1_BSEL1|ECON1_BSEL0)));
+  switch(simOpcode)
+  {
+    case SIM_OP_RCR:
+      miso = SimReadRegister(address);
+      break;
+    case SIM_OP_RBM:
+      pointer = SimGet16(ERDPTL);
+      miso = simMemory[pointer];
+      if(*SimRegister(ECON2) & ECON2_AUTOINC)
+        SimSet16(ERDPTL, SimNextRxAddress(pointer));
+      simStats.bufferBytesRead++;
+      break;
+    case SIM_OP_WCR:
+      SimCheckTransmitRequest(address, mosi);
+      SimWriteRegister(address, mosi);
+      break;
+    case SIM_OP_WBM:
+      pointer = SimGet16(EWRPTL);
+      simMemory[pointer] = mosi;
+      if(*SimRegister(ECON2) & ECON2_AUTOINC)
+        SimSet16(EWRPTL, (pointer + 1) & SIM_POINTER_MASK);
+      simStats.bufferBytesWritten++;
+      break;
+    case SIM_OP_BFS:
+      // bit field operations are only valid for the ETH registers
+      SimCheckTransmitRequest(address, mosi);
+      SimWriteRegister(address, *SimRegister(address) | mosi);
+      break;
+    case SIM_OP_BFC:
+      SimWriteRegister(address, *SimRegister(address) & ~mosi);
+      break;
+    default:
+      break;
+  }
+  return miso;
+}
+
+/************************************************************************/
+/* Receive filters (datasheet chapter 8)                                */
+/************************************************************************/
+static uint8_t SimHashTableMatch(const uint8_t *dst)
+{
+  // CRC-32 over the destination address, bits 28:23 select the hash bit
+  uint32_t crc = 0xFFFFFFFF;
+  uint8_t i, bit, data, index;
+
+  for(i = 0; i < 6; i++)
+  {
+    data = dst[i];
+    for(bit = 0; bit < 8; bit++)
+    {
+      uint8_t msb = ((crc >> 31) ^ data) & 0x01;
+      crc <<= 1;
+      if(msb)
+        crc ^= 0x04C11DB7;
+      data >>= 1;
+    }
+  }
+  index = (crc >> 23) & 0x3F;
+  return (*SimRegister(EHT0 + (index >> 3)) >> (index & 0x07)) & 0x01;
+}
+
+static uint8_t SimPatternMatch(const uint8_t *frame, uint16_t len)
+{
+  uint16_t offset = SimGet16(EPMOL);
+  uint32_t sum = 0;
+  uint8_t odd = 0;
+  uint8_t i;
+
+  // the window must lie completely inside the frame including the CRC
+  if(offset + 64 > len + SIM_CRC_LEN)
+    return 0;
+  for(i = 0; i < 64; i++)
+  {
+    uint8_t data;
+    if(!((*SimRegister(EPMM0 + (i >> 3)) >> (i & 0x07)) & 0x01))
+      continue;
+    data = (offset + i < len) ? frame[offset + i] : 0;
+    sum += odd ? data : (data << 8);
+    odd ^= 1;
+  }
+  while(sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return ((uint16_t)(sum ^ 0xFFFF)) == SimGet16(EPMCSL);
+}
+
+static uint8_t SimAcceptFrame(const uint8_t *frame, uint16_t len, uint8_t flags)
+{
+  uint8_t filter = *SimRegister(ERXFCON);
+  uint8_t station[6];
+  uint8_t unicast, broadcast, multicast;
+  uint8_t any = 0;
+  uint8_t all = 1;
+
+  if((filter & ERXFCON_CRCEN) && (flags & ENC28J60SIM_RX_BAD_CRC))
+    return 0;
+  filter &= ~(ERXFCON_CRCEN|ERXFCON_ANDOR);
+  if(!filter)
+    return 1;
+
+  // NOTE: MAC address in ENC28J60 is byte-backward, see ENC28J60_Init
+  station[0] = *SimRegister(MAADR5);
+  station[1] = *SimRegister(MAADR4);
+  station[2] = *SimRegister(MAADR3);
+  station[3] = *SimRegister(MAADR2);
+  station[4] = *SimRegister(MAADR1);
+  station[5] = *SimRegister(MAADR0);
+  unicast = memcmp(&frame[ETH_DST_MAC], station, 6) == 0;
+  broadcast = memcmp(&frame[ETH_DST_MAC], "\xff\xff\xff\xff\xff\xff", 6) == 0;
+  multicast = frame[ETH_DST_MAC] & 0x01;
+
+#define SIM_FILTER(bit, match) \
+  if(filter & (bit)) { if(match) any = 1; else all = 0; }
+  SIM_FILTER(ERXFCON_UCEN, unicast);
+  SIM_FILTER(ERXFCON_PMEN, SimPatternMatch(frame, len));
+  SIM_FILTER(ERXFCON_MPEN, 0);
+  SIM_FILTER(ERXFCON_HTEN, SimHashTableMatch(&frame[ETH_DST_MAC]));
+  SIM_FILTER(ERXFCON_MCEN, multicast);
+  SIM_FILTER(ERXFCON_BCEN, broadcast);
+#undef SIM_FILTER
+
+  if(*SimRegister(ERXFCON) & ERXFCON_ANDOR)
+    return all;
+  return any;
+}
+
+/************************************************************************/
+/* Public API                                                           */
+/************************************************************************/
+void ENC28J60Sim_Reset(void)
+{
+  memset(simMemory, 0, sizeof(simMemory));
+  SimPowerOnReset();
+  simSelected = 0;
+  simFirstByte = 0;
+  simTime = 0;
+  simIrqHandler = 0;
+  simIrqLine = 0;
+  simIrqPending = 0;
+  memset(&simStats, 0, sizeof(simStats));
+}
+
+void ENC28J60Sim_SetTransmitHandler(enc28j60_sim_tx_handler_t handler, void *context)
+{
+  simTxHandler = handler;
+  simTxContext = context;
+}
+
+// Puts a frame (without CRC) into the receive ring as if it arrived from
+// the wire. Returns 1 if the frame was stored, 0 if it was filtered or
+// did not fit.
+static uint8_t SimReceiveFrame(const uint8_t *frame, uint16_t len, uint8_t flags)
+{
+  uint8_t padded[SIM_MIN_FRAMELEN];
+  uint16_t start, address, next;
+  uint16_t stored, i;
+  uint16_t rsv;
+
+  SimService();
+  if(!(*SimRegister(ECON1) & ECON1_RXEN) || !(*SimRegister(MACON1) & MACON1_MARXEN))
+  {
+    simStats.framesFiltered++;
+    return 0;
+  }
+  // the sending MAC pads short frames
+  if(len < SIM_MIN_FRAMELEN)
+  {
+    memcpy(padded, frame, len);
+    memset(&padded[len], 0, SIM_MIN_FRAMELEN - len);
+    frame = padded;
+    len = SIM_MIN_FRAMELEN;
+  }
+  if(len + SIM_CRC_LEN > SimGet16(MAMXFLL) && !(*SimRegister(MACON3) & MACON3_HFRMLEN))
+  {
+    simStats.framesFiltered++;
+    return 0;
+  }
+  if(!SimAcceptFrame(frame, len, flags))
+  {
+    simStats.framesFiltered++;
+    return 0;
+  }
+  stored = SIM_RSV_LEN + len + SIM_CRC_LEN;
+  if(simPacketCount == 0xFF || stored > SimRxFreeSpace())
+  {
+    *SimRegister(EIR) |= EIR_RXERIF;
+    simStats.framesOverflowed++;
+    return 0;
+  }
+
+  // frame and CRC behind the receive status vector
+  start = SimGet16(ERXWRPTL);
+  address = start;
+  for(i = 0; i < SIM_RSV_LEN; i++)
+    address = SimNextRxAddress(address);
+  for(i = 0; i < len + SIM_CRC_LEN; i++)
+  {
+    simMemory[address] = (i < len) ? frame[i] : ((flags & ENC28J60SIM_RX_BAD_CRC) ? 0x00 : 0xC5);
+    address = SimNextRxAddress(address);
+  }
+  // packets always start on an even address
+  next = address;
+  if(next & 0x01)
+    next = SimNextRxAddress(next);
+
+  rsv = 0;
+  if(flags & ENC28J60SIM_RX_BAD_CRC)
+    rsv |= 0x0010;
+  else
+    rsv |= 0x0080;
+  if(frame[ETH_DST_MAC] & 0x01)
+  {
+    if(memcmp(&frame[ETH_DST_MAC], "\xff\xff\xff\xff\xff\xff", 6) == 0)
+      rsv |= 0x0200;
+    else
+      rsv |= 0x0100;
+  }
+  address = start;
+  simMemory[address] = next & 0xFF;             address = SimNextRxAddress(address);
+  simMemory[address] = next >> 8;               address = SimNextRxAddress(address);
+  simMemory[address] = (len + SIM_CRC_LEN) & 0xFF; address = SimNextRxAddress(address);
+  simMemory[address] = (len + SIM_CRC_LEN) >> 8;   address = SimNextRxAddress(address);
+  simMemory[address] = rsv & 0xFF;              address = SimNextRxAddress(address);
+  simMemory[address] = rsv >> 8;
+
+  SimSet16(ERXWRPTL, next);
+  simPacketCount++;
+  simStats.framesReceived++;
+  return 1;
+}
+
+uint8_t ENC28J60Sim_ReceiveFrame(const uint8_t *frame, uint16_t len, uint8_t flags)
+{
+  uint8_t stored = SimReceiveFrame(frame, len, flags);
+  SimCheckInterrupt();
+  return stored;
+}
+
+uint8_t ENC28J60Sim_IsInterruptAsserted(void)
+{
+  SimService();
+  return SimInterruptAsserted();
+}
+
+uint64_t ENC28J60Sim_GetTime(void)
+{
+  return simTime;
+}
+
+void ENC28J60Sim_AdvanceTime(uint64_t ns)
+{
+  simTime += ns;
+  SimService();
+  SimCheckInterrupt();
+  HostCycleCounter_Service();
+}
+
+void ENC28J60Sim_GetStatistics(struct enc28j60_sim_stats *stats)
+{
+  *stats = simStats;
+}
+
+void ENC28J60Sim_ResetStatistics(void)
+{
+  memset(&simStats, 0, sizeof(simStats));
+}
+
+uint8_t ENC28J60Sim_PeekRegister(uint8_t address)
+{
+  return SimReadRegister(address);
+}
+
+uint16_t ENC28J60Sim_PeekPhyRegister(uint8_t address)
+{
+  return simPhyRegisters[address & 0x1F];
+}
+
+uint8_t ENC28J60Sim_PeekMemory(uint16_t address)
+{
+  return simMemory[address & SIM_POINTER_MASK];
+}
+
+/************************************************************************/
+/* Interrupt controller of the host build                               */
+/************************************************************************/
+void INTC_register_interrupt(__int_handler handler, uint32_t irq, uint32_t int_level)
+{
+  (void)int_level;
+  if(irq == AVR32_CORE_COMPARE_IRQ)
+  {
+    HostCycleCounter_SetCompareHandler(handler);
+    return;
+  }
+  simIrqHandler = handler;
+  SimCheckInterrupt();
+}
+
+/************************************************************************/
+/* SPI master service of the host build                                 */
+/************************************************************************/
+void spi_master_init(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+}
+
+void spi_master_setup_device(volatile avr32_spi_t *spi,
+		struct spi_device *device, spi_flags_t flags, uint32_t baud_rate,
+		board_spi_select_id_t sel_id)
+{
+  (void)spi; (void)device; (void)flags; (void)sel_id;
+  if(baud_rate)
+    simByteTime = 8000000000ULL / baud_rate;
+}
+
+void spi_enable(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+}
+
+void spi_disable(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+}
+
+bool spi_is_enabled(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+  return true;
+}
+
+void spi_select_device(volatile avr32_spi_t *spi, struct spi_device *device)
+{
+  (void)spi; (void)device;
+  simStats.csToggles++;
+  simStats.transactions++;
+  simSelected = 1;
+  simFirstByte = 1;
+}
+
+void spi_deselect_device(volatile avr32_spi_t *spi, struct spi_device *device)
+{
+  (void)spi; (void)device;
+  simStats.csToggles++;
+  simSelected = 0;
+  SimCheckInterrupt();
+}
+
+void spi_write_single(volatile avr32_spi_t *spi, uint8_t data)
+{
+  (void)spi;
+  simReceiveData = SimExchange(data);
+}
+
+status_code_t spi_write_packet(volatile avr32_spi_t *spi,
+		const uint8_t *data, size_t len)
+{
+  (void)spi;
+  while(len--)
+    simReceiveData = SimExchange(*data++);
+  return STATUS_OK;
+}
+
+void spi_read_single(volatile avr32_spi_t *spi, uint8_t *data)
+{
+  (void)spi;
+  *data = simReceiveData;
+}
+
+status_code_t spi_read_packet(volatile avr32_spi_t *spi,
+		uint8_t *data, size_t len)
+{
+  (void)spi;
+  while(len--)
+  {
+    simReceiveData = SimExchange(CONFIG_SPI_MASTER_DUMMY);
+    *data++ = simReceiveData;
+  }
+  return STATUS_OK;
+}
+
+bool spi_is_tx_empty(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+  return true;
+}
+
+bool spi_is_tx_ready(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+  return true;
+}
+
+bool spi_is_rx_full(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+  return true;
+}
+
+bool spi_is_rx_ready(volatile avr32_spi_t *spi)
+{
+  (void)spi;
+  return true;
+}
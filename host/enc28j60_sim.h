@@ -0,0 +1,77 @@
+/*****************************************************************************
+* Title         : Behavioral model of the Microchip ENC28J60 for host builds
+* Copyright: GPL V2
+*
+*The model sits below the SPI master service (see include/spi_master.h), so
+*the unmodified driver in src/EtherShield/ENC28J60/enc28j60.c talks to it
+*exactly as it talks to the chip. It covers the 8 KB buffer memory, the four
+*register banks, ERDPT/EWRPT auto-increment with RX wrap, the RX ring with
+*EPKTCNT, ECON1/ECON2 side effects, the receive filters, the MII/PHY
+*registers, frame transmission and the DMA controller with its checksum
+*engine.
+*
+*The INT pin is wired to the host stand-in of INTC_register_interrupt: a
+*registered handler is called on every falling edge of INT, between SPI
+*transactions, like an interrupt of the MCU.
+*
+*Every byte clocked on the bus and every chip-select edge is counted, and
+*a virtual clock advances by one SPI byte time per byte, so bus cost and
+*wire time of the driver calls can be measured exactly.
+*****************************************************************************/
+
+#ifndef ENC28J60_SIM_H
+#define ENC28J60_SIM_H
+
+#include <stdint.h>
+#include <avr32/io.h>
+
+// SPI instance to hand to EtherShield_Init/ENC28J60_Init on the host
+extern volatile avr32_spi_t ENC28J60Sim_SPI;
+
+// Flags for ENC28J60Sim_ReceiveFrame
+#define ENC28J60SIM_RX_BAD_CRC    0x01
+
+// Bus and MAC counters. All counters only ever increase until
+// ENC28J60Sim_ResetStatistics is called.
+struct enc28j60_sim_stats
+{
+  uint32_t spiBytes;          // bytes clocked on the bus (both directions at once)
+  uint32_t csToggles;         // chip-select edges, two per transaction
+  uint32_t transactions;      // chip-selected transactions
+  uint32_t readCtrlOps;       // RCR
+  uint32_t writeCtrlOps;      // WCR
+  uint32_t bitFieldOps;       // BFS + BFC
+  uint32_t readBufferOps;     // RBM
+  uint32_t writeBufferOps;    // WBM
+  uint32_t softResets;        // SRC
+  uint32_t bufferBytesRead;   // payload bytes of RBM transactions
+  uint32_t bufferBytesWritten;// payload bytes of WBM transactions
+  uint32_t bankSwitches;      // changes of ECON1.BSEL
+  uint32_t framesReceived;    // frames stored in the RX ring
+  uint32_t framesFiltered;    // frames rejected by ERXFCON
+  uint32_t framesOverflowed;  // frames dropped because the RX ring was full
+  uint32_t framesTransmitted; // frames put on the wire
+  uint32_t txRequestsLost;    // TXRTS set while a transmission was in flight
+  uint32_t interrupts;        // INT edges delivered to the registered handler
+  uint32_t dmaOperations;     // DMA copies and checksum calculations started
+};
+
+// Called for every frame the model puts on the wire (without CRC)
+typedef void (*enc28j60_sim_tx_handler_t)(const uint8_t *frame, uint16_t len, void *context);
+
+void ENC28J60Sim_Reset(void);
+void ENC28J60Sim_SetTransmitHandler(enc28j60_sim_tx_handler_t handler, void *context);
+uint8_t ENC28J60Sim_ReceiveFrame(const uint8_t *frame, uint16_t len, uint8_t flags);
+uint8_t ENC28J60Sim_IsInterruptAsserted(void);
+
+uint64_t ENC28J60Sim_GetTime(void);
+void ENC28J60Sim_AdvanceTime(uint64_t ns);
+
+void ENC28J60Sim_GetStatistics(struct enc28j60_sim_stats *stats);
+void ENC28J60Sim_ResetStatistics(void);
+
+uint8_t ENC28J60Sim_PeekRegister(uint8_t address);
+uint16_t ENC28J60Sim_PeekPhyRegister(uint8_t address);
+uint8_t ENC28J60Sim_PeekMemory(uint16_t address);
+
+#endif
@@ -0,0 +1,39 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the AVR32 part header
+* Copyright: GPL V2
+*
+* Only the types which the EtherShield sources use are provided. The SPI
+* instance is opaque; all bus traffic is routed into the ENC28J60 model.
+*****************************************************************************/
+
+#ifndef HOST_AVR32_IO_H
+#define HOST_AVR32_IO_H
+
+#include <stdint.h>
+
+typedef struct avr32_spi_t
+{
+  uint32_t id;
+} avr32_spi_t;
+
+// Interrupt lines of the GPIO controller, one per 8 pins
+#define AVR32_GPIO_IRQ_GROUP  2
+#define AVR32_GPIO_IRQ_0      64
+
+// Pins the example application uses: INT of the ENC28J60 and the LED
+#define AVR32_PIN_PA12        12
+#define AVR32_PIN_PA13        13
+
+// System registers of the cycle counter, see compiler.h
+#define AVR32_COUNT           0x00000108
+#define AVR32_COMPARE         0x0000010C
+
+// COMPARE interrupt of the CPU core
+#define AVR32_CORE_IRQ_GROUP  0
+#define AVR32_CORE_COMPARE_IRQ 0
+
+// Sleep modes, see compiler.h
+#define AVR32_PM_SMODE_IDLE   0x00000000
+#define AVR32_PM_SMODE_GMCLEAR_MASK 0x00000080
+
+#endif
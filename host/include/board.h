@@ -0,0 +1,21 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the ASF board definitions
+* Copyright: GPL V2
+*
+* The SPI the example application hands to EtherShield_Init is the
+* instance of the ENC28J60 model, see host/enc28j60_sim.h.
+*****************************************************************************/
+
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <avr32/io.h>
+
+extern volatile avr32_spi_t ENC28J60Sim_SPI;
+
+#define AT45DBX_SPI         (&ENC28J60Sim_SPI)
+#define AT45DBX_SPI_NPCS    0
+
+#define board_init()
+
+#endif
@@ -0,0 +1,47 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the ASF compiler utilities
+* Copyright: GPL V2
+*
+* Only the system register access for the cycle counter is provided. COUNT
+* runs at HOST_CPU_HZ: it advances with the virtual clock of the ENC28J60
+* model, so the time spent on the bus is counted exactly as on the MCU,
+* plus the CPU time the host spends in the calling thread. The latter is
+* the speed of the host, not of an AVR32. HostCycleCounter_CountCpuTime(0)
+* leaves the latter out, then the counter follows the virtual clock only
+* and runs the same on every host.
+*
+* COMPARE raises the handler registered for AVR32_CORE_COMPARE_IRQ when
+* COUNT reaches it, checked whenever the virtual clock is advanced. SLEEP
+* advances the virtual clock to the next COMPARE match.
+*****************************************************************************/
+
+#ifndef HOST_COMPILER_H
+#define HOST_COMPILER_H
+
+#include <stdint.h>
+#include <avr32/io.h>
+#include <interrupt.h>
+
+// CPU clock of the part the counter stands in for, OSC0 of the EVK1101
+#ifndef HOST_CPU_HZ
+#define HOST_CPU_HZ   12000000UL
+#endif
+
+uint32_t HostCycleCounter(void);
+void HostCycleCounter_CountCpuTime(uint8_t enable);
+uint32_t HostCycleCounter_GetCompare(void);
+void HostCycleCounter_SetCompare(uint32_t compare);
+void HostCycleCounter_SetCompareHandler(__int_handler handler);
+void HostCycleCounter_Service(void);
+void HostSleep(void);
+
+#define Get_system_register(reg) \
+  ((reg) == AVR32_COUNT ? HostCycleCounter() : \
+   (reg) == AVR32_COMPARE ? HostCycleCounter_GetCompare() : 0)
+
+#define Set_system_register(reg, value) \
+  ((reg) == AVR32_COMPARE ? HostCycleCounter_SetCompare(value) : (void)0)
+
+#define SLEEP(mode)   HostSleep()
+
+#endif
@@ -0,0 +1,43 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the AVR32 flash controller driver
+* Copyright: GPL V2
+*
+* The "flash" of the host build is RAM. As with the real driver, a write
+* without erase can only clear bits.
+*****************************************************************************/
+
+#ifndef HOST_FLASHC_H
+#define HOST_FLASHC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AVR32_FLASHC_PAGE_SIZE    512
+
+static inline volatile void *flashc_memcpy(volatile void *dst, const void *src, size_t nbytes, bool erase)
+{
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+
+  while (nbytes--){
+    *d = erase ? *s : (*d & *s);
+    d++;
+    s++;
+  }
+  return dst;
+}
+
+static inline volatile void *flashc_memset8(volatile void *dst, uint8_t src, size_t nbytes, bool erase)
+{
+  uint8_t *d = (uint8_t *)dst;
+
+  while (nbytes--){
+    *d = erase ? src : (*d & src);
+    d++;
+  }
+  return dst;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the AVR32 GPIO driver
+* Copyright: GPL V2
+*****************************************************************************/
+
+#ifndef HOST_GPIO_H
+#define HOST_GPIO_H
+
+#include <stdint.h>
+
+#define GPIO_DIR_OUTPUT   0x0001
+#define GPIO_INIT_LOW     0x0000
+#define GPIO_FALLING_EDGE 2
+
+#define gpio_configure_pin(pin, flags)
+#define gpio_set_gpio_pin(pin)
+#define gpio_clr_gpio_pin(pin)
+#define gpio_enable_pin_interrupt(pin, mode)
+#define gpio_clear_pin_interrupt_flag(pin)
+
+#endif
@@ -0,0 +1,25 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the AVR32 INTC driver
+* Copyright: GPL V2
+*
+*The interrupt sources on the host are the ENC28J60 model and the COMPARE
+*register of the cycle counter. A handler registered for
+*AVR32_CORE_COMPARE_IRQ is called on a COMPARE match (see compiler.h), one
+*registered for any other line when the model pulls its INT pin low.
+*****************************************************************************/
+
+#ifndef HOST_INTC_H
+#define HOST_INTC_H
+
+#include <stdint.h>
+
+#define AVR32_INTC_INT0   0
+#define AVR32_INTC_INT1   1
+#define AVR32_INTC_INT2   2
+#define AVR32_INTC_INT3   3
+
+typedef void (*__int_handler)(void);
+
+void INTC_register_interrupt(__int_handler handler, uint32_t irq, uint32_t int_level);
+
+#endif
@@ -0,0 +1,26 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the ASF interrupt utilities
+* Copyright: GPL V2
+*****************************************************************************/
+
+#ifndef HOST_INTERRUPT_H
+#define HOST_INTERRUPT_H
+
+#include <intc.h>
+
+#define ISR(func, int_grp, int_lvl)    static void func (void)
+
+#define irq_register_handler(func, int_num, int_lvl) \
+  INTC_register_interrupt(func, int_num, int_lvl)
+
+// the handlers of the model need no vector table and are always enabled,
+// they only run between SPI transactions
+typedef uint32_t irqflags_t;
+
+#define irq_initialize_vectors()
+#define cpu_irq_enable()
+#define cpu_irq_disable()
+#define cpu_irq_save()                 ((irqflags_t)0)
+#define cpu_irq_restore(flags)         ((void)(flags))
+
+#endif
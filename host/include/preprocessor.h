@@ -0,0 +1,11 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the ASF preprocessor utilities
+* Copyright: GPL V2
+*
+* None of them are used by the sources built on the host.
+*****************************************************************************/
+
+#ifndef HOST_PREPROCESSOR_H
+#define HOST_PREPROCESSOR_H
+
+#endif
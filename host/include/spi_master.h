@@ -0,0 +1,55 @@
+/*****************************************************************************
+* Title         : Host build replacement for the ASF UC3 SPI master service
+* Copyright: GPL V2
+*
+* Same interface as src/ASF/common/services/spi/uc3_spi/spi_master.h. The
+* implementation lives in host/enc28j60_sim.c, where every byte clocked on
+* the bus is fed into the ENC28J60 model.
+*****************************************************************************/
+
+#ifndef HOST_SPI_MASTER_H
+#define HOST_SPI_MASTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr32/io.h>
+#include "status_codes.h"
+
+#define SPI_MODE_0        0
+#define SPI_MODE_1        1
+#define SPI_MODE_2        2
+#define SPI_MODE_3        3
+
+#ifndef CONFIG_SPI_MASTER_DUMMY
+#define CONFIG_SPI_MASTER_DUMMY   0xFF
+#endif
+
+typedef uint8_t spi_flags_t;
+typedef uint8_t board_spi_select_id_t;
+
+struct spi_device {
+	board_spi_select_id_t	id;
+};
+
+void spi_master_init(volatile avr32_spi_t *spi);
+void spi_master_setup_device(volatile avr32_spi_t *spi,
+		struct spi_device *device, spi_flags_t flags, uint32_t baud_rate,
+		board_spi_select_id_t sel_id);
+void spi_enable(volatile avr32_spi_t *spi);
+void spi_disable(volatile avr32_spi_t *spi);
+bool spi_is_enabled(volatile avr32_spi_t *spi);
+void spi_select_device(volatile avr32_spi_t *spi, struct spi_device *device);
+void spi_deselect_device(volatile avr32_spi_t *spi, struct spi_device *device);
+void spi_write_single(volatile avr32_spi_t *spi, uint8_t data);
+status_code_t spi_write_packet(volatile avr32_spi_t *spi,
+		const uint8_t *data, size_t len);
+void spi_read_single(volatile avr32_spi_t *spi, uint8_t *data);
+status_code_t spi_read_packet(volatile avr32_spi_t *spi,
+		uint8_t *data, size_t len);
+bool spi_is_tx_empty(volatile avr32_spi_t *spi);
+bool spi_is_tx_ready(volatile avr32_spi_t *spi);
+bool spi_is_rx_full(volatile avr32_spi_t *spi);
+bool spi_is_rx_ready(volatile avr32_spi_t *spi);
+
+#endif
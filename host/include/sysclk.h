@@ -0,0 +1,18 @@
+/*****************************************************************************
+* Title         : Host build stand-in for the ASF system clock service
+* Copyright: GPL V2
+*
+* The clock is not configured; the CPU runs at HOST_CPU_HZ like the cycle
+* counter of include/compiler.h.
+*****************************************************************************/
+
+#ifndef HOST_SYSCLK_H
+#define HOST_SYSCLK_H
+
+#include <stdint.h>
+#include "compiler.h"
+
+#define sysclk_init()
+#define sysclk_get_cpu_hz()   ((uint32_t)HOST_CPU_HZ)
+
+#endif
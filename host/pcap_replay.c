@@ -0,0 +1,264 @@
+/*****************************************************************************
+* Title         : Replay of a packet capture through the example application
+* Copyright: GPL V2
+*
+*Runs src/WebServerExample.c, the transport layer and the driver unchanged
+*on the ENC28J60 model. The frames of an Ethernet pcap file are received by
+*the model at the time they were captured (relative to the first one), the
+*main loop of the example runs until each one is handled and every frame
+*the model transmits is written to the output pcap file. The main loop also
+*runs every POLL_INTERVAL of virtual time between the frames and for a while
+*after the last one, so the timers of TCP and ARP go off as on the board.
+*
+*The cycle counter follows the virtual clock only, the replies and their
+*timestamps are the same on every host. Reported are the frames per second
+*of host CPU time in the passes of the main loop which handle them, the
+*CPU time and the SPI bytes per received frame.
+*
+*   make pcap-replay PCAP=in.pcap [OUT=out.pcap]
+*   build/pcap_replay [-f] [-d drain_ms] in.pcap out.pcap
+*
+*-f receives the frames back to back instead of at their capture times.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "compiler.h"
+#include "enc28j60_sim.h"
+#include "EtherShield/ENC28J60/enc28j60.h"
+
+#define PCAP_MAGIC_US        0xa1b2c3d4
+#define PCAP_MAGIC_NS        0xa1b23c4d
+#define PCAP_LINKTYPE_ETH    1
+#define PCAP_SNAPLEN         65535
+
+#define MAX_FRAME            1518
+#define POLL_INTERVAL        1000000ULL   // ns of virtual time between loop passes
+#define DRAIN_TIME           2000         // ms the loop runs after the last frame
+#define MAX_PASSES           64           // loop passes per received frame
+
+typedef struct
+{
+  uint8_t swapped;
+  uint8_t nanoseconds;
+} pcap_format_t;
+
+// the example application, main is renamed by the makefile
+void setup(void);
+void loop(void);
+
+static FILE *out;
+static uint64_t firstTime;
+static uint32_t framesOut;
+static double frameTime, pollTime;
+
+static uint32_t Swap32(uint32_t v)
+{
+  return v >> 24 | (v >> 8 & 0xff00) | (v << 8 & 0xff0000) | v << 24;
+}
+
+static uint32_t Get32(const pcap_format_t *format, const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return format->swapped ? Swap32(v) : v;
+}
+
+static void Put32(uint8_t *p, uint32_t v)
+{
+  memcpy(p, &v, 4);
+}
+
+static double CpuTime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/************************************************************************/
+/* Reads the file header. Returns 0 if it is no Ethernet capture.       */
+/************************************************************************/
+static int ReadHeader(FILE *f, pcap_format_t *format)
+{
+  uint8_t header[24];
+  uint32_t magic;
+
+  if (fread(header, sizeof(header), 1, f) != 1){
+    return 0;
+  }
+  memcpy(&magic, header, 4);
+  format->swapped = magic == Swap32(PCAP_MAGIC_US) || magic == Swap32(PCAP_MAGIC_NS);
+  magic = Get32(format, header);
+  if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS){
+    return 0;
+  }
+  format->nanoseconds = magic == PCAP_MAGIC_NS;
+  return Get32(format, &header[20]) == PCAP_LINKTYPE_ETH;
+}
+
+/************************************************************************/
+/* Reads the next record into frame. Returns its captured length, -1 at */
+/* the end of the file. time is set to the capture time in ns.          */
+/************************************************************************/
+static long ReadFrame(FILE *f, const pcap_format_t *format, uint8_t *frame, uint64_t *time)
+{
+  uint8_t header[16];
+  uint32_t captured;
+
+  if (fread(header, sizeof(header), 1, f) != 1){
+    return -1;
+  }
+  *time = (uint64_t)Get32(format, header) * 1000000000ULL +
+          (uint64_t)Get32(format, &header[4]) * (format->nanoseconds ? 1 : 1000);
+  captured = Get32(format, &header[8]);
+  if (captured > MAX_FRAME){
+    // longer than the chip receives, skipped
+    return fseek(f, captured, SEEK_CUR) ? -1 : 0;
+  }
+  if (captured && fread(frame, captured, 1, f) != 1){
+    return -1;
+  }
+  return captured;
+}
+
+static void WriteHeader(FILE *f)
+{
+  uint8_t header[24] = {0};
+
+  Put32(header, PCAP_MAGIC_NS);
+  header[4] = 2;               // version 2.4
+  header[6] = 4;
+  Put32(&header[16], PCAP_SNAPLEN);
+  Put32(&header[20], PCAP_LINKTYPE_ETH);
+  fwrite(header, sizeof(header), 1, f);
+}
+
+static void Transmitted(const uint8_t *frame, uint16_t len, void *context)
+{
+  uint64_t time = firstTime + ENC28J60Sim_GetTime();
+  uint8_t header[16];
+
+  (void)context;
+  Put32(header, (uint32_t)(time / 1000000000ULL));
+  Put32(&header[4], (uint32_t)(time % 1000000000ULL));
+  Put32(&header[8], len);
+  Put32(&header[12], len);
+  fwrite(header, sizeof(header), 1, out);
+  fwrite(frame, len, 1, out);
+  framesOut++;
+}
+
+// One pass of the main loop, its CPU time is added to total
+static void Loop(double *total)
+{
+  double start = CpuTime();
+
+  loop();
+  *total += CpuTime() - start;
+}
+
+// Runs the main loop every POLL_INTERVAL until the virtual clock is at time
+static void RunUntil(uint64_t time)
+{
+  uint64_t now = ENC28J60Sim_GetTime();
+
+  while (now < time){
+    ENC28J60Sim_AdvanceTime(time - now < POLL_INTERVAL ? time - now : POLL_INTERVAL);
+    Loop(&pollTime);
+    now = ENC28J60Sim_GetTime();
+  }
+}
+
+static void Usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-f] [-d drain_ms] in.pcap out.pcap\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t frame[MAX_FRAME];
+  struct enc28j60_sim_stats stats;
+  pcap_format_t format;
+  uint32_t framesIn = 0, framesSkipped = 0;
+  unsigned long drain = DRAIN_TIME;
+  int backToBack = 0;
+  uint64_t time;
+  long len;
+  FILE *in;
+  int opt, passes;
+
+  while ((opt = getopt(argc, argv, "fd:")) != -1){
+    switch (opt){
+      case 'f':
+        backToBack = 1;
+        break;
+      case 'd':
+        drain = strtoul(optarg, 0, 0);
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2){
+    Usage(argv[0]);
+  }
+  in = fopen(argv[optind], "rb");
+  if (!in || !ReadHeader(in, &format)){
+    fprintf(stderr, "%s: no Ethernet pcap file\n", argv[optind]);
+    return 1;
+  }
+  out = fopen(argv[optind + 1], "wb");
+  if (!out){
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  WriteHeader(out);
+
+  HostCycleCounter_CountCpuTime(0);
+  ENC28J60Sim_Reset();
+  ENC28J60Sim_SetTransmitHandler(Transmitted, 0);
+  setup();
+  ENC28J60Sim_ResetStatistics();
+
+  while ((len = ReadFrame(in, &format, frame, &time)) >= 0){
+    if (framesIn + framesSkipped == 0){
+      // the first frame arrives right after the initialization
+      firstTime = time - ENC28J60Sim_GetTime();
+    }
+    if (len == 0){
+      framesSkipped++;
+      continue;
+    }
+    if (!backToBack && time > firstTime){
+      RunUntil(time - firstTime);
+    }
+    framesIn++;
+    ENC28J60Sim_ReceiveFrame(frame, (uint16_t)len, 0);
+    for (passes = 0; passes < MAX_PASSES && ENC28J60Sim_PeekRegister(EPKTCNT); passes++){
+      Loop(&frameTime);
+    }
+  }
+  fclose(in);
+  RunUntil(ENC28J60Sim_GetTime() + drain * 1000000ULL);
+  fclose(out);
+
+  ENC28J60Sim_GetStatistics(&stats);
+  printf("frames in %lu, out %lu, filtered %lu, overflowed %lu, skipped %lu\n",
+         (unsigned long)framesIn, (unsigned long)framesOut, (unsigned long)stats.framesFiltered,
+         (unsigned long)stats.framesOverflowed, (unsigned long)framesSkipped);
+  if (framesIn){
+    printf("%.0f frames/s, %.2f us CPU and %.1f SPI bytes per frame\n",
+           frameTime > 0 ? framesIn / frameTime : 0, frameTime * 1e6 / framesIn,
+           (double)stats.spiBytes / framesIn);
+    printf("%.2f ms CPU in the loop between the frames, %.3f ms virtual time\n",
+           pollTime * 1e3, ENC28J60Sim_GetTime() * 1e-6);
+  }
+  return 0;
+}
@@ -0,0 +1,1047 @@
+/*****************************************************************************
+* Title         : Benchmark of the stack with the example application
+* Copyright: GPL V2
+*
+*Runs src/WebServerExample.c, the transport layer and the driver on the
+*ENC28J60 model through fixed workloads and prints the results as JSON:
+*
+*   arp_storm   ARP requests for our address from many hosts, in bursts
+*   ping_flood  echo requests, back to back
+*   http_get    page requests of clients which open, read and close their
+*               connections, BENCH_HTTP_CLIENTS at a time
+*   mixed       broadcast noise (ARP for other hosts, DHCP, NetBIOS,
+*               IPv6 multicast) with an echo request every fourth frame
+*   http_bulk   BENCH_BULK_CLIENTS clients which each fetch BENCH_BULK_SIZE
+*               bytes at once, over a link which delays every frame by
+*               -d ms and drops -l percent of them in both directions; the
+*               clients announce a window of -w bytes and do not reassemble,
+*               they acknowledge what they have for every segment out of
+*               order. The connections are served by a handler of the
+*               benchmark instead of the example.
+*
+*Every reply is checked (addresses, checksums, sequence numbers); the
+*program exits with 1 if one is missing or wrong, or if the receive buffer
+*of the chip is not completely free again after a workload.
+*
+*The workloads are generated from fixed data and the cycle counter follows
+*the virtual clock only, so the frame and SPI numbers are the same on every
+*host and run and can be compared between builds as they are. Each
+*workload runs in a process of its own, BENCH_RUNS times; the CPU time is
+*the smallest of the runs and depends on the host. With make PROFILE=1 the
+*average cycles of the profiled stages are included, they count bus time
+*only.
+*
+*The drops are drawn from a fixed seed, so http_bulk repeats exactly as
+*well. Its transfers are checked byte by byte.
+*
+*   make bench [BENCH_OUT=results.json] [BENCH_FLAGS="-l 3 -d 20 -w 4096"]
+*   build/stack_bench [-r runs] [-o results.json] [-l loss%] [-d delay_ms] [-w window]
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "compiler.h"
+#include "enc28j60_sim.h"
+#include "EtherShield/ENC28J60/enc28j60.h"
+#include "EtherShield/etherShield.h"
+#include "EtherShield/Profile/profile.h"
+#include "EtherShield/Stats/net_stats.h"
+
+#define BENCH_RUNS           5
+#define BENCH_ARP_REQUESTS   1024
+#define BENCH_ARP_BURST      8
+#define BENCH_PINGS          1024
+#define BENCH_PING_DATA      56
+#define BENCH_HTTP_REQUESTS  64
+#define BENCH_HTTP_CLIENTS   4
+#define BENCH_MIXED_FRAMES   2048
+#define BENCH_BULK_CLIENTS   4
+#define BENCH_BULK_SIZE      20000
+#define BENCH_LINK_LOSS      3            // % of the frames dropped by the link of http_bulk
+#define BENCH_LINK_DELAY     20           // ms every frame spends on that link
+#define BENCH_BULK_WINDOW    4096         // window of its clients
+
+#define POLL_INTERVAL        1000000ULL   // ns of virtual time between loop passes
+#define MAX_PASSES           64           // loop passes per received frames
+#define HTTP_TIMEOUT         60000        // ms of virtual time for all requests
+#define BULK_TIMEOUT         600000       // ms of virtual time for all transfers of http_bulk
+#define BULK_RETRY           1000         // ms before a client sends its SYN or request again
+#define LINK_SIZE            512          // frames on the link at once
+
+#define MAX_FRAME            1518
+#define QUEUE_SIZE           64
+
+typedef struct
+{
+  uint32_t framesIn;
+  uint32_t framesOut;
+  uint32_t repliesExpected;
+  uint32_t repliesOk;
+  uint32_t framesFiltered;
+  uint32_t framesOverflowed;
+  uint32_t rxBytesHeld;
+  uint32_t spiBytes;
+  uint32_t transactions;
+  uint64_t virtualTime;
+  double cpuTime;
+  uint32_t profile[PROFILE_STAGES];
+} bench_result_t;
+
+typedef struct
+{
+  const char *name;
+  void (*run)(bench_result_t *r);
+} bench_workload_t;
+
+typedef struct
+{
+  uint8_t ip[4];
+  uint16_t port;
+  uint32_t snd;
+  uint32_t rcv;
+  uint32_t received;
+  uint8_t state;
+  uint8_t bad;               // http_bulk: data differed from the response
+  uint64_t lastSent;         // http_bulk: ns of the last SYN or request
+} bench_client_t;
+
+typedef struct
+{
+  uint8_t frame[MAX_FRAME];
+  uint16_t len;
+  uint8_t toServer;
+  uint64_t due;              // ns it comes out at the other end
+} link_frame_t;
+
+#define CLIENT_IDLE          0
+#define CLIENT_SYN_SENT      1
+#define CLIENT_OPEN          2
+#define CLIENT_FIN_SENT      3
+#define CLIENT_FAILED        4
+#define CLIENT_DONE          5
+#define CLIENT_REQUESTED     6            // http_bulk: the request is acknowledged
+
+// the example application, main is renamed by the makefile
+void setup(void);
+void loop(void);
+
+static const uint8_t serverMac[6] = {0x54,0x55,0x58,0x10,0x00,0x24};
+static const uint8_t serverIp[4] = {198,162,1,15};
+static const char request[] = "GET / HTTP/1.0\r\n\r\n";
+static const char *stageNames[PROFILE_STAGES] = {"rx", "classify", "checksum", "build", "tx"};
+
+static bench_result_t *result;
+static void (*check)(const uint8_t *frame, uint16_t len);
+static uint8_t queue[QUEUE_SIZE][MAX_FRAME];
+static uint16_t queueLen[QUEUE_SIZE];
+static uint8_t queued;
+// link of http_bulk, set by the options
+static unsigned linkLoss = BENCH_LINK_LOSS;
+static unsigned linkDelay = BENCH_LINK_DELAY;
+static uint16_t clientWindow = 2048;
+static unsigned long bulkWindow = BENCH_BULK_WINDOW;
+
+static double CpuTime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/************************************************************************/
+/* Frames                                                               */
+/************************************************************************/
+static void Put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void Put32(uint8_t *p, uint32_t v)
+{
+  Put16(p, v >> 16);
+  Put16(&p[2], v);
+}
+
+static uint16_t Get16(const uint8_t *p)
+{
+  return p[0] << 8 | p[1];
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+  return (uint32_t)Get16(p) << 16 | Get16(&p[2]);
+}
+
+// one's complement sum of the pseudo header sum and len bytes at p
+static uint16_t Checksum(uint32_t sum, const uint8_t *p, uint16_t len)
+{
+  for (; len > 1; p += 2, len -= 2){
+    sum += Get16(p);
+  }
+  if (len){
+    sum += p[0] << 8;
+  }
+  while (sum >> 16){
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+static uint32_t PseudoHeaderSum(const uint8_t *ip, uint8_t proto, uint16_t len)
+{
+  return Get16(&ip[12]) + Get16(&ip[14]) + Get16(&ip[16]) + Get16(&ip[18]) + proto + len;
+}
+
+static void HostMac(uint8_t *mac, const uint8_t *ip)
+{
+  mac[0] = 0x02;
+  mac[1] = 0x00;
+  memcpy(&mac[2], ip, 4);
+}
+
+// Ethernet header from the host with address ip, returns the next byte
+static uint8_t *Ethernet(uint8_t *f, const uint8_t *dst, const uint8_t *ip, uint16_t type)
+{
+  memcpy(f, dst, 6);
+  HostMac(&f[6], ip);
+  Put16(&f[12], type);
+  return &f[14];
+}
+
+// IPv4 header for len bytes of data, returns the data
+static uint8_t *IPv4(uint8_t *p, const uint8_t *src, const uint8_t *dst, uint8_t proto, uint16_t len)
+{
+  memset(p, 0, 20);
+  p[0] = 0x45;
+  Put16(&p[2], 20 + len);
+  p[8] = 64;
+  p[9] = proto;
+  memcpy(&p[12], src, 4);
+  memcpy(&p[16], dst, 4);
+  Put16(&p[10], Checksum(0, p, 20));
+  return &p[20];
+}
+
+static uint16_t ArpRequest(uint8_t *f, const uint8_t *ip, const uint8_t *target)
+{
+  static const uint8_t broadcast[6] = {0xff,0xff,0xff,0xff,0xff,0xff};
+  uint8_t *p = Ethernet(f, broadcast, ip, 0x0806);
+
+  Put16(p, 1);
+  Put16(&p[2], 0x0800);
+  p[4] = 6;
+  p[5] = 4;
+  Put16(&p[6], 1);
+  HostMac(&p[8], ip);
+  memcpy(&p[14], ip, 4);
+  memset(&p[18], 0, 6);
+  memcpy(&p[24], target, 4);
+  return 42;
+}
+
+static uint16_t EchoRequest(uint8_t *f, const uint8_t *ip, uint16_t seq)
+{
+  uint8_t *p = IPv4(Ethernet(f, serverMac, ip, 0x0800), ip, serverIp, 1, 8 + BENCH_PING_DATA);
+  uint16_t i;
+
+  p[0] = 8;
+  p[1] = 0;
+  Put16(&p[2], 0);
+  Put16(&p[4], 0x4242);
+  Put16(&p[6], seq);
+  for (i=0; i<BENCH_PING_DATA; i++){
+    p[8 + i] = (uint8_t)(seq + i);
+  }
+  Put16(&p[2], Checksum(0, p, 8 + BENCH_PING_DATA));
+  return 14 + 20 + 8 + BENCH_PING_DATA;
+}
+
+static uint16_t UdpBroadcast(uint8_t *f, const uint8_t *ip, uint16_t srcPort, uint16_t dstPort, uint16_t len)
+{
+  static const uint8_t broadcast[6] = {0xff,0xff,0xff,0xff,0xff,0xff};
+  static const uint8_t broadcastIp[4] = {255,255,255,255};
+  uint8_t *ipHeader = Ethernet(f, broadcast, ip, 0x0800);
+  uint8_t *p = IPv4(ipHeader, ip, broadcastIp, 17, 8 + len);
+  uint16_t i;
+
+  Put16(p, srcPort);
+  Put16(&p[2], dstPort);
+  Put16(&p[4], 8 + len);
+  Put16(&p[6], 0);
+  for (i=0; i<len; i++){
+    p[8 + i] = (uint8_t)i;
+  }
+  Put16(&p[6], Checksum(PseudoHeaderSum(ipHeader, 17, 8 + len), p, 8 + len));
+  return 14 + 20 + 8 + len;
+}
+
+static uint16_t Ipv6Multicast(uint8_t *f, const uint8_t *ip)
+{
+  static const uint8_t allNodes[6] = {0x33,0x33,0x00,0x00,0x00,0x01};
+  uint8_t *p = Ethernet(f, allNodes, ip, 0x86dd);
+
+  // router advertisement sized, the content is never looked at
+  memset(p, 0, 64);
+  p[0] = 0x60;
+  Put16(&p[4], 24);
+  p[6] = 58;
+  p[7] = 255;
+  return 14 + 64;
+}
+
+static uint16_t TcpSegment(uint8_t *f, const bench_client_t *c, uint8_t flags, const char *data, uint16_t len)
+{
+  uint8_t *ipHeader = Ethernet(f, serverMac, c->ip, 0x0800);
+  uint8_t options = (flags & 0x02) ? 4 : 0;
+  uint8_t *p = IPv4(ipHeader, c->ip, serverIp, 6, 20 + options + len);
+
+  Put16(p, c->port);
+  Put16(&p[2], 80);
+  Put32(&p[4], c->snd);
+  Put32(&p[8], c->rcv);
+  p[12] = (5 + options / 4) << 4;
+  p[13] = flags;
+  Put16(&p[14], clientWindow);
+  Put16(&p[16], 0);
+  Put16(&p[18], 0);
+  if (options){
+    // mss
+    p[20] = 2;
+    p[21] = 4;
+    Put16(&p[22], 1460);
+  }
+  memcpy(&p[20 + options], data, len);
+  Put16(&p[16], Checksum(PseudoHeaderSum(ipHeader, 6, 20 + options + len), p, 20 + options + len));
+  return 14 + 20 + 20 + options + len;
+}
+
+/************************************************************************/
+/* Returns 1 if frame is an IPv4 packet from us to ip with correct      */
+/* checksums and protocol proto. *data and *len are set to the data of  */
+/* the IP packet.                                                       */
+/************************************************************************/
+static int CheckIPv4(const uint8_t *frame, uint16_t frameLen, const uint8_t *ip, uint8_t proto,
+                     const uint8_t **data, uint16_t *len)
+{
+  uint8_t mac[6];
+  const uint8_t *p = &frame[14];
+
+  HostMac(mac, ip);
+  if (frameLen < 34 || memcmp(frame, mac, 6) || memcmp(&frame[6], serverMac, 6) ||
+      Get16(&frame[12]) != 0x0800 || p[0] != 0x45 || Checksum(0, p, 20) ||
+      p[9] != proto || memcmp(&p[12], serverIp, 4) || memcmp(&p[16], ip, 4) ||
+      Get16(&p[2]) < 20 || 14 + Get16(&p[2]) > frameLen){
+    return 0;
+  }
+  *data = &p[20];
+  *len = Get16(&p[2]) - 20;
+  return proto == 1 ? Checksum(0, *data, *len) == 0 :
+         Checksum(PseudoHeaderSum(p, proto, *len), *data, *len) == 0;
+}
+
+/************************************************************************/
+/* Driving the application                                              */
+/************************************************************************/
+static void Transmitted(const uint8_t *frame, uint16_t len, void *context)
+{
+  (void)context;
+  result->framesOut++;
+  check(frame, len);
+}
+
+// Runs the main loop until the received frames are handled
+static void Process(void)
+{
+  double start = CpuTime();
+  uint8_t passes;
+
+  for (passes = 0; passes < MAX_PASSES && ENC28J60Sim_PeekRegister(EPKTCNT); passes++){
+    loop();
+  }
+  result->cpuTime += CpuTime() - start;
+}
+
+static void Receive(const uint8_t *frame, uint16_t len)
+{
+  result->framesIn++;
+  ENC28J60Sim_ReceiveFrame(frame, len, 0);
+}
+
+// Runs the main loop every POLL_INTERVAL for ns of virtual time
+static void Idle(uint64_t ns)
+{
+  double start = CpuTime();
+  uint64_t end = ENC28J60Sim_GetTime() + ns;
+  uint64_t now;
+
+  while ((now = ENC28J60Sim_GetTime()) < end){
+    ENC28J60Sim_AdvanceTime(end - now < POLL_INTERVAL ? end - now : POLL_INTERVAL);
+    loop();
+  }
+  result->cpuTime += CpuTime() - start;
+}
+
+/************************************************************************/
+/* Workloads                                                            */
+/************************************************************************/
+static void HostIp(uint8_t *ip, uint16_t n)
+{
+  ip[0] = 198;
+  ip[1] = 162;
+  ip[2] = 2 + n / 250;
+  ip[3] = 1 + n % 250;
+}
+
+static void CheckArpReply(const uint8_t *frame, uint16_t len)
+{
+  const uint8_t *p = &frame[14];
+  uint8_t mac[6];
+
+  HostMac(mac, &p[24]);
+  if (len >= 42 && Get16(&frame[12]) == 0x0806 && Get16(&p[6]) == 2 &&
+      !memcmp(frame, mac, 6) && !memcmp(&p[8], serverMac, 6) &&
+      !memcmp(&p[14], serverIp, 4) && !memcmp(&p[18], mac, 6) && p[24] == 198){
+    result->repliesOk++;
+  }
+}
+
+static void ArpStorm(bench_result_t *r)
+{
+  uint8_t frame[64], ip[4];
+  uint16_t i;
+
+  check = CheckArpReply;
+  for (i=0; i<BENCH_ARP_REQUESTS; i++){
+    HostIp(ip, i);
+    Receive(frame, ArpRequest(frame, ip, serverIp));
+    if ((i + 1) % BENCH_ARP_BURST == 0){
+      Process();
+    }
+  }
+  Process();
+  Idle(POLL_INTERVAL);
+  r->repliesExpected = BENCH_ARP_REQUESTS;
+}
+
+static void CheckEchoReply(const uint8_t *frame, uint16_t len)
+{
+  static uint8_t expected[MAX_FRAME];
+  const uint8_t *data;
+  uint16_t dataLen;
+  uint8_t ip[4];
+
+  if (len < 42){
+    return;
+  }
+  memcpy(ip, &frame[30], 4);
+  if (!CheckIPv4(frame, len, ip, 1, &data, &dataLen) || data[0] != 0 ||
+      dataLen != 8 + BENCH_PING_DATA){
+    return;
+  }
+  // same data as the request
+  EchoRequest(expected, ip, Get16(&data[6]));
+  if (!memcmp(&data[4], &expected[14 + 20 + 4], 4 + BENCH_PING_DATA)){
+    result->repliesOk++;
+  }
+}
+
+static void PingFlood(bench_result_t *r)
+{
+  uint8_t frame[128], ip[4];
+  uint16_t i;
+
+  check = CheckEchoReply;
+  HostIp(ip, 0);
+  for (i=0; i<BENCH_PINGS; i++){
+    Receive(frame, EchoRequest(frame, ip, i));
+    Process();
+  }
+  Idle(POLL_INTERVAL);
+  r->repliesExpected = BENCH_PINGS;
+}
+
+static bench_client_t clients[BENCH_HTTP_CLIENTS];
+
+static void Enqueue(const uint8_t *frame, uint16_t len)
+{
+  if (queued < QUEUE_SIZE){
+    memcpy(queue[queued], frame, len);
+    queueLen[queued++] = len;
+  }
+}
+
+static void ClientSend(bench_client_t *c, uint8_t flags, const char *data, uint16_t len)
+{
+  uint8_t frame[128];
+
+  Enqueue(frame, TcpSegment(frame, c, flags, data, len));
+  c->snd += len + ((flags & 0x03) ? 1 : 0);
+}
+
+static void ClientOpen(bench_client_t *c, uint16_t n)
+{
+  HostIp(c->ip, n % BENCH_HTTP_CLIENTS);
+  c->port = 40000 + n;
+  c->snd = 1000000 * (n + 1);
+  c->rcv = 0;
+  c->received = 0;
+  c->state = CLIENT_SYN_SENT;
+  ClientSend(c, 0x02, 0, 0);
+}
+
+// The clients answer the segments of the server
+static void CheckSegment(const uint8_t *frame, uint16_t len)
+{
+  const uint8_t *p;
+  uint16_t segLen, dataLen, i;
+  bench_client_t *c = 0;
+  uint8_t flags;
+
+  for (i=0; i<BENCH_HTTP_CLIENTS; i++){
+    if (clients[i].state != CLIENT_IDLE && !memcmp(&frame[30], clients[i].ip, 4) &&
+        len >= 54 && Get16(&frame[36]) == clients[i].port){
+      c = &clients[i];
+    }
+  }
+  if (!c){
+    return;
+  }
+  if (!CheckIPv4(frame, len, c->ip, 6, &p, &segLen) || Get16(p) != 80){
+    c->state = CLIENT_FAILED;
+    return;
+  }
+  flags = p[13];
+  dataLen = segLen - (p[12] >> 4) * 4;
+  if (flags & 0x04){
+    c->state = CLIENT_FAILED;
+  }else if (c->state == CLIENT_SYN_SENT && (flags & 0x12) == 0x12){
+    c->rcv = Get32(&p[4]) + 1;
+    c->state = CLIENT_OPEN;
+    ClientSend(c, 0x10, 0, 0);
+    ClientSend(c, 0x18, request, sizeof(request) - 1);
+  }else if (c->state == CLIENT_OPEN && Get32(&p[4]) == c->rcv){
+    c->rcv += dataLen;
+    c->received += dataLen;
+    if (flags & 0x01){
+      c->rcv++;
+      c->state = CLIENT_FIN_SENT;
+      ClientSend(c, 0x11, 0, 0);
+    }else if (dataLen){
+      ClientSend(c, 0x10, 0, 0);
+    }
+  }else if (c->state == CLIENT_FIN_SENT && (flags & 0x10) && Get32(&p[8]) == c->snd){
+    if (c->received){
+      result->repliesOk++;
+    }
+    c->state = CLIENT_IDLE;
+  }else if (dataLen || (flags & 0x03)){
+    // retransmission, acknowledged again
+    ClientSend(c, 0x10, 0, 0);
+  }
+}
+
+static void HttpGet(bench_result_t *r)
+{
+  uint16_t opened = 0, busy, i;
+  uint64_t end = ENC28J60Sim_GetTime() + HTTP_TIMEOUT * 1000000ULL;
+
+  check = CheckSegment;
+  memset(clients, 0, sizeof(clients));
+  while (ENC28J60Sim_GetTime() < end){
+    busy = 0;
+    for (i=0; i<BENCH_HTTP_CLIENTS; i++){
+      if (clients[i].state == CLIENT_FAILED){
+        clients[i].state = CLIENT_IDLE;
+      }
+      if (clients[i].state == CLIENT_IDLE && opened < BENCH_HTTP_REQUESTS){
+        ClientOpen(&clients[i], opened++);
+      }
+      busy += clients[i].state != CLIENT_IDLE;
+    }
+    if (!busy && !queued){
+      break;
+    }
+    if (queued){
+      uint8_t n = queued;
+      static uint8_t frames[QUEUE_SIZE][MAX_FRAME];
+      static uint16_t lens[QUEUE_SIZE];
+
+      memcpy(frames, queue, sizeof(frames));
+      memcpy(lens, queueLen, sizeof(lens));
+      queued = 0;
+      for (i=0; i<n; i++){
+        Receive(frames[i], lens[i]);
+        Process();
+      }
+    }else{
+      Idle(POLL_INTERVAL);
+    }
+  }
+  r->repliesExpected = BENCH_HTTP_REQUESTS;
+}
+
+static void MixedNoise(bench_result_t *r)
+{
+  static const uint8_t otherHost[4] = {198,162,1,200};
+  uint8_t frame[400], ip[4];
+  uint16_t i;
+
+  check = CheckEchoReply;
+  for (i=0; i<BENCH_MIXED_FRAMES; i++){
+    HostIp(ip, i % 64);
+    switch (i % 8){
+      case 0:
+      case 4:
+        Receive(frame, EchoRequest(frame, ip, i));
+        r->repliesExpected++;
+        break;
+      case 1:
+      case 5:
+        Receive(frame, ArpRequest(frame, ip, otherHost));
+        break;
+      case 2:
+        Receive(frame, UdpBroadcast(frame, ip, 68, 67, 300));
+        break;
+      case 3:
+        Receive(frame, UdpBroadcast(frame, ip, 137, 137, 50));
+        break;
+      case 6:
+        Receive(frame, UdpBroadcast(frame, ip, 138, 138, 200));
+        break;
+      default:
+        Receive(frame, Ipv6Multicast(frame, ip));
+        break;
+    }
+    Process();
+  }
+  Idle(POLL_INTERVAL);
+}
+
+static link_frame_t wire[LINK_SIZE];
+static uint16_t linkHead, linkCount;
+static uint32_t linkRandom;
+static uint8_t bulkResponse[BENCH_BULK_SIZE];
+
+// Puts a frame on the link of http_bulk, unless it is dropped
+static void LinkSend(const uint8_t *frame, uint16_t len, uint8_t toServer)
+{
+  link_frame_t *l;
+
+  // fixed seed, so every run drops the same frames
+  linkRandom = linkRandom * 1103515245 + 12345;
+  if ((linkRandom >> 16) % 100 < linkLoss || linkCount == LINK_SIZE){
+    return;
+  }
+  l = &wire[(linkHead + linkCount++) % LINK_SIZE];
+  memcpy(l->frame, frame, len);
+  l->len = len;
+  l->toServer = toServer;
+  l->due = ENC28J60Sim_GetTime() + linkDelay * 1000000ULL;
+}
+
+static void BulkSegment(const uint8_t *frame, uint16_t len);
+
+// Hands the frames which went through the link to the server or the clients
+static void LinkDeliver(void)
+{
+  link_frame_t *l;
+
+  while (linkCount && (l = &wire[linkHead])->due <= ENC28J60Sim_GetTime()){
+    linkHead = (linkHead + 1) % LINK_SIZE;
+    linkCount--;
+    if (l->toServer){
+      Receive(l->frame, l->len);
+      Process();
+    }else{
+      BulkSegment(l->frame, l->len);
+    }
+  }
+}
+
+static void FromServer(const uint8_t *frame, uint16_t len)
+{
+  LinkSend(frame, len, 0);
+}
+
+// A segment of a client, through the link; the sequence number is not advanced
+static void BulkSend(bench_client_t *c, uint8_t flags, uint32_t seq, const char *data, uint16_t len)
+{
+  uint8_t frame[128];
+  uint32_t snd = c->snd;
+
+  c->snd = seq;
+  LinkSend(frame, TcpSegment(frame, c, flags, data, len), 1);
+  c->snd = snd;
+}
+
+static void BulkSegment(const uint8_t *frame, uint16_t len)
+{
+  const uint8_t *p;
+  uint16_t segLen, dataLen, i;
+  bench_client_t *c = 0;
+  uint32_t seq;
+  uint8_t flags;
+
+  for (i=0; i<BENCH_BULK_CLIENTS; i++){
+    if (clients[i].state != CLIENT_IDLE && !memcmp(&frame[30], clients[i].ip, 4) &&
+        len >= 54 && Get16(&frame[36]) == clients[i].port){
+      c = &clients[i];
+    }
+  }
+  if (!c || c->state == CLIENT_FAILED){
+    return;
+  }
+  if (!CheckIPv4(frame, len, c->ip, 6, &p, &segLen) || Get16(p) != 80){
+    c->state = CLIENT_FAILED;
+    return;
+  }
+  flags = p[13];
+  seq = Get32(&p[4]);
+  dataLen = segLen - (p[12] >> 4) * 4;
+  if (c->state == CLIENT_DONE){
+    // our FIN got lost, the server sends its own again
+    if (flags & 0x01){
+      BulkSend(c, 0x11, c->snd - 1, 0, 0);
+    }
+    return;
+  }
+  if (flags & 0x04){
+    c->state = CLIENT_FAILED;
+    return;
+  }
+  if ((flags & 0x12) == 0x12){
+    if (c->state == CLIENT_SYN_SENT){
+      c->rcv = seq + 1;
+      c->state = CLIENT_OPEN;
+    }
+    BulkSend(c, 0x10, c->snd, 0, 0);
+    BulkSend(c, 0x18, c->snd, request, sizeof(request) - 1);
+    c->lastSent = ENC28J60Sim_GetTime();
+    return;
+  }
+  if (c->state != CLIENT_OPEN && c->state != CLIENT_REQUESTED){
+    return;
+  }
+  if (c->state == CLIENT_OPEN && (flags & 0x10) && Get32(&p[8]) == c->snd + sizeof(request) - 1){
+    c->snd += sizeof(request) - 1;
+    c->state = CLIENT_REQUESTED;
+  }
+  if (seq != c->rcv){
+    // out of order or sent again, no reassembly
+    BulkSend(c, 0x10, c->snd, 0, 0);
+    return;
+  }
+  if (dataLen){
+    if (c->received + dataLen > BENCH_BULK_SIZE ||
+        memcmp(&p[(p[12] >> 4) * 4], &bulkResponse[c->received], dataLen)){
+      c->bad = 1;
+    }
+    c->received += dataLen;
+    c->rcv += dataLen;
+  }
+  if ((flags & 0x01) && c->state == CLIENT_REQUESTED){
+    c->rcv++;
+    c->snd++;
+    if (c->received == BENCH_BULK_SIZE && !c->bad){
+      result->repliesOk++;
+    }
+    c->state = CLIENT_DONE;
+    BulkSend(c, 0x11, c->snd - 1, 0, 0);
+  }else if (dataLen){
+    BulkSend(c, 0x10, c->snd, 0, 0);
+  }
+}
+
+static void BulkHandler(uint8_t id, uint8_t event, uint8_t *data, uint16_t len)
+{
+  switch (event){
+    case TCP_EVENT_DATA:
+      if (len >= 4 && !memcmp(data, "GET ", 4) && !TCPConnection_Queued(id)){
+        EtherShield_SendTCP(id, bulkResponse, BENCH_BULK_SIZE);
+        EtherShield_CloseTCP(id);
+      }
+      break;
+    case TCP_EVENT_PEER_CLOSED:
+      EtherShield_CloseTCP(id);
+      break;
+    default:
+      break;
+  }
+}
+
+static void HttpBulk(bench_result_t *r)
+{
+  uint64_t end = ENC28J60Sim_GetTime() + BULK_TIMEOUT * 1000000ULL;
+  uint16_t busy, i;
+
+  for (i=0; i<BENCH_BULK_SIZE; i++){
+    bulkResponse[i] = 'A' + (i * 7 + i / 26) % 26;
+  }
+  check = FromServer;
+  clientWindow = bulkWindow;
+  linkRandom = 1;
+  EtherShield_ListenTCP(PBUF_SIZE - 1, 80, BulkHandler);
+  memset(clients, 0, sizeof(clients));
+  for (i=0; i<BENCH_BULK_CLIENTS; i++){
+    HostIp(clients[i].ip, i);
+    clients[i].port = 41000 + i;
+    clients[i].snd = 1000000 * (i + 1);
+    clients[i].state = CLIENT_SYN_SENT;
+    clients[i].lastSent = ENC28J60Sim_GetTime() - BULK_RETRY * 1000000ULL;
+  }
+  while (ENC28J60Sim_GetTime() < end){
+    busy = 0;
+    for (i=0; i<BENCH_BULK_CLIENTS; i++){
+      bench_client_t *c = &clients[i];
+
+      if (ENC28J60Sim_GetTime() - c->lastSent >= BULK_RETRY * 1000000ULL){
+        if (c->state == CLIENT_SYN_SENT){
+          BulkSend(c, 0x02, c->snd - 1, 0, 0);
+          c->lastSent = ENC28J60Sim_GetTime();
+        }else if (c->state == CLIENT_OPEN){
+          BulkSend(c, 0x18, c->snd, request, sizeof(request) - 1);
+          c->lastSent = ENC28J60Sim_GetTime();
+        }
+      }
+      busy += c->state != CLIENT_DONE && c->state != CLIENT_FAILED;
+    }
+    for (i=0; i<TCP_MAX_CONNECTIONS; i++){
+      busy += TCPConnection_Get(i)->state != TCP_STATE_FREE;
+    }
+    if (!busy && !linkCount){
+      break;
+    }
+    LinkDeliver();
+    Idle(POLL_INTERVAL);
+  }
+  r->repliesExpected = BENCH_BULK_CLIENTS;
+}
+
+static const bench_workload_t workloads[] = {
+  {"arp_storm", ArpStorm},
+  {"ping_flood", PingFlood},
+  {"http_get", HttpGet},
+  {"mixed", MixedNoise},
+  {"http_bulk", HttpBulk},
+};
+
+// Bytes of the receive buffer between ERXRDPT and the write pointer of the
+// chip, which are not free for new frames
+static uint32_t RxBytesHeld(void)
+{
+  uint16_t start = ENC28J60Sim_PeekRegister(ERXSTL) | ENC28J60Sim_PeekRegister(ERXSTH) << 8;
+  uint16_t end = ENC28J60Sim_PeekRegister(ERXNDL) | ENC28J60Sim_PeekRegister(ERXNDH) << 8;
+  uint16_t readPtr = ENC28J60Sim_PeekRegister(ERXRDPTL) | ENC28J60Sim_PeekRegister(ERXRDPTH) << 8;
+  uint16_t writePtr = ENC28J60Sim_PeekRegister(ERXWRPTL) | ENC28J60Sim_PeekRegister(ERXWRPTH) << 8;
+
+  if (writePtr >= readPtr){
+    return writePtr - readPtr;
+  }
+  return (end - start + 1) - (readPtr - writePtr);
+}
+
+/************************************************************************/
+/* Runs a workload on a freshly initialized stack.                      */
+/************************************************************************/
+static void Run(const bench_workload_t *w, bench_result_t *r)
+{
+  struct enc28j60_sim_stats stats;
+  uint64_t start;
+  uint8_t i;
+
+  memset(r, 0, sizeof(*r));
+  result = r;
+  check = 0;
+  HostCycleCounter_CountCpuTime(0);
+  ENC28J60Sim_Reset();
+  ENC28J60Sim_SetTransmitHandler(Transmitted, 0);
+  setup();
+  Idle(POLL_INTERVAL);
+  memset(r, 0, sizeof(*r));
+  ENC28J60Sim_ResetStatistics();
+  Profile_Reset();
+  start = ENC28J60Sim_GetTime();
+
+  w->run(r);
+
+  ENC28J60Sim_GetStatistics(&stats);
+  r->framesFiltered = stats.framesFiltered;
+  r->framesOverflowed = stats.framesOverflowed;
+  // every frame is handled, the read pointer has to be at the write pointer
+  r->rxBytesHeld = RxBytesHeld();
+  r->spiBytes = stats.spiBytes;
+  r->transactions = stats.transactions;
+  r->virtualTime = ENC28J60Sim_GetTime() - start;
+#ifdef ETHERSHIELD_PROFILE
+  for (i=0; i<PROFILE_STAGES; i++){
+    const profile_stage_t *s = Profile_Get(i);
+    r->profile[i] = s->count ? (uint32_t)(s->total / s->count) : 0;
+  }
+#else
+  (void)i;
+#endif
+}
+
+// Runs a workload in a child process, so every run starts from reset
+static int RunIsolated(const bench_workload_t *w, bench_result_t *r)
+{
+  int fds[2], status;
+  pid_t pid;
+
+  if (pipe(fds)){
+    return 0;
+  }
+  fflush(0);
+  pid = fork();
+  if (pid == 0){
+    close(fds[0]);
+    Run(w, r);
+    _exit(write(fds[1], r, sizeof(*r)) == sizeof(*r) ? 0 : 1);
+  }
+  close(fds[1]);
+  status = pid > 0 && read(fds[0], r, sizeof(*r)) == sizeof(*r);
+  close(fds[0]);
+  if (pid > 0){
+    waitpid(pid, 0, 0);
+  }
+  return status;
+}
+
+static double PerFrame(double value, const bench_result_t *r)
+{
+  return r->framesIn ? value / r->framesIn : 0;
+}
+
+static void Print(FILE *f, const bench_workload_t *w, const bench_result_t *r, int deterministic, int last)
+{
+  uint8_t i;
+
+  fprintf(f, "    {\n");
+  fprintf(f, "      \"name\": \"%s\",\n", w->name);
+  fprintf(f, "      \"frames_in\": %lu,\n", (unsigned long)r->framesIn);
+  fprintf(f, "      \"frames_out\": %lu,\n", (unsigned long)r->framesOut);
+  fprintf(f, "      \"frames_filtered\": %lu,\n", (unsigned long)r->framesFiltered);
+  fprintf(f, "      \"frames_overflowed\": %lu,\n", (unsigned long)r->framesOverflowed);
+  fprintf(f, "      \"replies_expected\": %lu,\n", (unsigned long)r->repliesExpected);
+  fprintf(f, "      \"replies_ok\": %lu,\n", (unsigned long)r->repliesOk);
+  fprintf(f, "      \"rx_bytes_held\": %lu,\n", (unsigned long)r->rxBytesHeld);
+  fprintf(f, "      \"spi_bytes_per_frame\": %.2f,\n", PerFrame(r->spiBytes, r));
+  fprintf(f, "      \"spi_transactions_per_frame\": %.2f,\n", PerFrame(r->transactions, r));
+  fprintf(f, "      \"virtual_time_us\": %.3f,\n", r->virtualTime * 1e-3);
+  fprintf(f, "      \"deterministic\": %s,\n", deterministic ? "true" : "false");
+  fprintf(f, "      \"cpu_ns_per_frame\": %.1f,\n", PerFrame(r->cpuTime * 1e9, r));
+  fprintf(f, "      \"frames_per_second\": %.0f", r->cpuTime > 0 ? r->framesIn / r->cpuTime : 0);
+#ifdef ETHERSHIELD_PROFILE
+  fprintf(f, ",\n      \"profile_avg_cycles\": {");
+  for (i=0; i<PROFILE_STAGES; i++){
+    fprintf(f, "%s\"%s\": %lu", i ? ", " : "", stageNames[i], (unsigned long)r->profile[i]);
+  }
+  fprintf(f, "}");
+#else
+  (void)i;
+  (void)stageNames;
+#endif
+  fprintf(f, "\n    }%s\n", last ? "" : ",");
+}
+
+static void Usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-r runs] [-o results.json] [-l loss%%] [-d delay_ms] [-w window]\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const uint8_t count = sizeof(workloads) / sizeof(workloads[0]);
+  bench_result_t best, r;
+  unsigned long runs = BENCH_RUNS;
+  FILE *out = stdout;
+  int failed = 0, deterministic, opt;
+  unsigned long run;
+  double cpuTime;
+  uint8_t i;
+
+  while ((opt = getopt(argc, argv, "r:o:l:d:w:")) != -1){
+    switch (opt){
+      case 'r':
+        runs = strtoul(optarg, 0, 0);
+        break;
+      case 'l':
+        linkLoss = strtoul(optarg, 0, 0);
+        break;
+      case 'd':
+        linkDelay = strtoul(optarg, 0, 0);
+        break;
+      case 'w':
+        bulkWindow = strtoul(optarg, 0, 0);
+        break;
+      case 'o':
+        out = fopen(optarg, "w");
+        if (!out){
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  if (optind != argc || runs == 0 || linkLoss > 99 || bulkWindow == 0 || bulkWindow > 0xffff){
+    Usage(argv[0]);
+  }
+
+  fprintf(out, "{\n");
+#ifdef ETHERSHIELD_PROFILE
+  fprintf(out, "  \"profile\": true,\n");
+#else
+  fprintf(out, "  \"profile\": false,\n");
+#endif
+  fprintf(out, "  \"net_stats\": %d,\n", NET_STATS);
+  fprintf(out, "  \"cpu_hz\": %lu,\n", (unsigned long)HOST_CPU_HZ);
+  fprintf(out, "  \"runs\": %lu,\n", runs);
+  fprintf(out, "  \"link_loss_percent\": %u,\n", linkLoss);
+  fprintf(out, "  \"link_delay_ms\": %u,\n", linkDelay);
+  fprintf(out, "  \"bulk_window\": %lu,\n", bulkWindow);
+  fprintf(out, "  \"workloads\": [\n");
+  for (i=0; i<count; i++){
+    deterministic = 1;
+    for (run=0; run<runs; run++){
+      if (!RunIsolated(&workloads[i], &r)){
+        fprintf(stderr, "%s: run failed\n", workloads[i].name);
+        return 1;
+      }
+      if (run == 0){
+        best = r;
+        continue;
+      }
+      // everything but the CPU time must repeat exactly
+      cpuTime = best.cpuTime < r.cpuTime ? best.cpuTime : r.cpuTime;
+      best.cpuTime = r.cpuTime;
+      deterministic &= !memcmp(&best, &r, sizeof(r));
+      best.cpuTime = cpuTime;
+    }
+    if (best.repliesOk != best.repliesExpected || !deterministic){
+      fprintf(stderr, "%s: %lu of %lu replies ok%s\n", workloads[i].name,
+              (unsigned long)best.repliesOk, (unsigned long)best.repliesExpected,
+              deterministic ? "" : ", results differ between runs");
+      failed = 1;
+    }
+    if (best.rxBytesHeld){
+      fprintf(stderr, "%s: %lu bytes of the receive buffer not freed\n", workloads[i].name,
+              (unsigned long)best.rxBytesHeld);
+      failed = 1;
+    }
+    Print(out, &workloads[i], &best, deterministic, i == count - 1);
+  }
+  fprintf(out, "  ]\n}\n");
+  if (out != stdout){
+    fclose(out);
+  }
+  return failed;
+}
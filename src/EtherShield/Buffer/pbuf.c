@@ -0,0 +1,146 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Packet buffer pool, see pbuf.h
+ *
+ * The free buffers form a singly linked list through their next field.
+ * Alloc and Free only touch its head, with the interrupts masked around
+ * it since an interrupt routine may use the pool as well.
+ *********************************************/
+
+#include <avr32/io.h>
+#include <string.h>
+#include "compiler.h"
+#include "interrupt.h"
+#include "EtherShield/Buffer/pbuf.h"
+
+#if PBUF_COUNT > 255
+# error "PBUF_COUNT must be below 256"
+#endif
+
+static pbuf_t pool[PBUF_COUNT];
+static pbuf_t *freeList = 0;
+static pbuf_stats_t stats;
+
+/************************************************************************/
+/* Puts all buffers into the pool. Buffers still in use are lost to     */
+/* their holders.                                                       */
+/************************************************************************/
+void Pbuf_Init(void)
+{
+  uint8_t i;
+
+  freeList = 0;
+  for (i=PBUF_COUNT; i>0; i--){
+    pool[i-1].ref = 0;
+    pool[i-1].next = freeList;
+    freeList = &pool[i-1];
+  }
+  memset(&stats, 0, sizeof(stats));
+  stats.free = PBUF_COUNT;
+  stats.lowWater = PBUF_COUNT;
+}
+
+/************************************************************************/
+/* Takes a buffer from the pool, with headroom bytes in front of its    */
+/* empty payload, no tail and one reference. Returns 0 if the pool is   */
+/* empty.                                                               */
+/************************************************************************/
+pbuf_t *Pbuf_Alloc(uint16_t headroom)
+{
+  irqflags_t flags;
+  pbuf_t *p;
+
+  if (headroom > PBUF_SIZE){
+    return 0;
+  }
+  flags = cpu_irq_save();
+  p = freeList;
+  if (p){
+    freeList = p->next;
+    if (--stats.free < stats.lowWater){
+      stats.lowWater = stats.free;
+    }
+  }else{
+    stats.allocFailures++;
+  }
+  cpu_irq_restore(flags);
+  if (p){
+    p->next = 0;
+    p->offset = headroom;
+    p->len = 0;
+    p->tail = 0;
+    p->tailLen = 0;
+    p->tailSummed = 0;
+    p->ref = 1;
+  }
+  return p;
+}
+
+/************************************************************************/
+/* Takes another reference to p and returns it.                         */
+/************************************************************************/
+pbuf_t *Pbuf_Ref(pbuf_t *p)
+{
+  irqflags_t flags = cpu_irq_save();
+
+  p->ref++;
+  cpu_irq_restore(flags);
+  return p;
+}
+
+/************************************************************************/
+/* Gives a reference to p back, the last one returns it to the pool.    */
+/* p may be 0.                                                          */
+/************************************************************************/
+void Pbuf_Free(pbuf_t *p)
+{
+  irqflags_t flags;
+
+  if (!p){
+    return;
+  }
+  flags = cpu_irq_save();
+  if (p->ref && --p->ref == 0){
+    p->next = freeList;
+    freeList = p;
+    stats.free++;
+  }
+  cpu_irq_restore(flags);
+}
+
+/************************************************************************/
+/* Moves the start of the payload delta bytes to the front, into the    */
+/* headroom, or -delta bytes back to strip a header. Returns the new    */
+/* start or 0, without a change, if there is not enough headroom or     */
+/* payload.                                                             */
+/************************************************************************/
+uint8_t *Pbuf_Header(pbuf_t *p, int16_t delta)
+{
+  if ((delta > 0 && delta > p->offset) || (delta < 0 && -delta > p->len)){
+    return 0;
+  }
+  p->offset -= delta;
+  p->len += delta;
+  return Pbuf_Payload(p);
+}
+
+/************************************************************************/
+/* Returns the use of the pool.                                         */
+/************************************************************************/
+void Pbuf_GetStatistics(pbuf_stats_t *s)
+{
+  *s = stats;
+}
+
+/************************************************************************/
+/* Starts the low water mark and the failure count again.               */
+/************************************************************************/
+void Pbuf_ResetStatistics(void)
+{
+  irqflags_t flags = cpu_irq_save();
+
+  stats.lowWater = stats.free;
+  stats.allocFailures = 0;
+  cpu_irq_restore(flags);
+}
@@ -0,0 +1,78 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Packet buffer pool
+ *
+ * PBUF_COUNT frame buffers of PBUF_SIZE bytes each, allocated once at
+ * startup. Taking a buffer from the pool and giving it back are O(1) and
+ * also allowed in an interrupt routine; nothing is ever taken from the
+ * heap, so the pool can not fragment.
+ *
+ * A buffer is reference counted: whoever keeps it beyond the call which
+ * handed it over takes a reference with Pbuf_Ref and every holder gives
+ * its reference back with Pbuf_Free. The buffer returns to the pool with
+ * the last one. Functions which take a pbuf_t to send it take over the
+ * reference of the caller.
+ *
+ * The payload of a buffer starts offset bytes into data. Pbuf_Alloc leaves
+ * headroom in front of it, so a layer can write its data first and the
+ * layers below prepend their headers with Pbuf_Header without moving it:
+ * a TCP segment allocates TCP_DATA_P bytes of headroom, fills in the data
+ * and then moves the payload back to the ethernet header, from where the
+ * offsets of net.h apply.
+ *
+ * Data which is already somewhere else, in RAM of the application or in
+ * flash, is not copied into the buffer: tail and tailLen make it follow
+ * the payload when the buffer is sent, the driver writes both straight
+ * into the chip. The tail has to stay valid until the buffer is freed.
+ * If its IP_ChecksumAdd sum is known in advance, e.g. for a constant
+ * resource in flash, tailSum saves summing it for the checksum.
+ *********************************************/
+//@{
+#ifndef PBUF_H
+#define PBUF_H
+#include <stdint.h>
+
+// bytes of a buffer, headroom included
+#ifndef PBUF_SIZE
+# define PBUF_SIZE                512
+#endif
+// buffers in the pool
+#ifndef PBUF_COUNT
+# define PBUF_COUNT               6
+#endif
+
+typedef struct pbuf pbuf_t;
+
+struct pbuf
+{
+  pbuf_t *next;              // in the pool
+  uint16_t offset;           // of the payload in data
+  uint16_t len;              // of the payload
+  const uint8_t *tail;       // sent behind the payload, not copied
+  uint16_t tailLen;
+  uint16_t tailSum;          // sum of the tail if tailSummed is set
+  uint8_t tailSummed;
+  uint8_t ref;               // 0 while it is in the pool
+  uint8_t data[PBUF_SIZE];
+};
+
+typedef struct
+{
+  uint8_t free;              // buffers in the pool now
+  uint8_t lowWater;          // fewest buffers in the pool since the reset
+  uint16_t allocFailures;    // Pbuf_Alloc calls with the pool empty
+} pbuf_stats_t;
+
+#define Pbuf_Payload(p)           ((p)->data + (p)->offset)
+
+extern void Pbuf_Init(void);
+extern pbuf_t *Pbuf_Alloc(uint16_t headroom);
+extern pbuf_t *Pbuf_Ref(pbuf_t *p);
+extern void Pbuf_Free(pbuf_t *p);
+extern uint8_t *Pbuf_Header(pbuf_t *p, int16_t delta);
+extern void Pbuf_GetStatistics(pbuf_stats_t *stats);
+extern void Pbuf_ResetStatistics(void);
+
+#endif /* PBUF_H */
+//@}
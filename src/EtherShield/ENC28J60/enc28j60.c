@@ -12,12 +12,84 @@
 
 #include <avr32/io.h>
 #include "EtherShield/ENC28J60/enc28j60.h"
+#include "EtherShield/Profile/profile.h"
+#include "EtherShield/Stats/net_stats.h"
 #include "gpio.h"
+#include "interrupt.h"
+#if ENC28J60_USE_PDCA
+# include "sysclk.h"
+#endif
 
 static uint8_t encBankNumber = 0;
 static uint16_t nextPacketPtr = 0;
+static uint16_t packetStart = 0;
+static uint16_t packetLength = 0;
+static uint8_t packetOpen = 0;
+
+// Transmit queue, see ENC28J60_TX_SLOTS
+#define TSV_LATE_COLLISION_BYTE 3
+#define TSV_LATE_COLLISION      0x20
+#define TX_NO_SLOT              0xFFFF
+static uint16_t txSlotStart[ENC28J60_TX_SLOTS];
+static uint16_t txSlotEnd[ENC28J60_TX_SLOTS];
+static uint8_t txTail = 0;    // oldest queued packet
+static uint8_t txCount = 0;   // queued packets
+static uint8_t txActive = 0;  // the oldest queued packet is on the wire
+static uint8_t txRetries = 0;
+static enc28j60_tx_request_t txQueue[ENC28J60_TX_QUEUE];
+static uint8_t txQueueTail = 0;   // oldest buffer waiting for room
+static uint8_t txQueueCount = 0;
+static uint8_t checksumOffload = ENC28J60_CHECKSUM_OFFLOAD;
+
+// Buffer layout, see ENC28J60_SetTransmitBufferSize
+static uint16_t rxBufferEnd = RXSTOPBUFFER;
+static uint16_t txBufferStart = TXSTART_INIT;
+static uint16_t rxReadPtr = RXSTARTBUFFER;   // last value written to ERXRDPT
+static enc28j60_buffer_stats_t bufferStats;
 static volatile avr32_spi_t *avr32SPI = 0;
 static struct spi_device spiDevice;
+static volatile uint8_t bufferTransferBusy = 0;
+static enc28j60_transfer_callback_t bufferTransferCallback = 0;
+
+// Interrupt driven receive, see ENC28J60_RX_DESCRIPTORS
+static enc28j60_rx_descriptor_t rxRing[ENC28J60_RX_DESCRIPTORS];
+static volatile uint8_t rxRingHead = 0;     // written by the interrupt side only
+static volatile uint8_t rxRingTail = 0;     // written by the packet functions only
+static volatile uint8_t rxIrqLock = 0;      // nesting depth of driver calls which use the bus
+static volatile uint8_t rxIrqPending = 0;   // INT fired while the bus was in use
+static uint8_t rxIrqEnabled = 0;
+static uint32_t rxIrqPin;
+static uint16_t rxHeaderPtr = 0;            // receive status vector of the next packet to queue
+static enc28j60_receive_callback_t rxCallback = 0;
+
+// Registers which only change when we write them, one bit per register address and bank.
+// Bank 0: ERDPT..ERXND, EDMAST..EDMADST, EIE  Bank 1: EHT, EPMM, EPMCS, EPMO, ERXFCON
+// Bank 2: MACON1/3/4, MABBIPG, MAIPG, MACLCON, MAMXFL, MIREGADR  Bank 3: MAADR, EREVID, ECOCON, EFLOCON, EPAUS
+// ERXRDPT is not cached: the chip only takes a new value when ERXRDPTH is written after ERXRDPTL,
+// so both writes have to go out even if a byte did not change.
+static const uint32_t encCacheable[4] = { 0x083F0FFF, 0x0133FFFF, 0x00100FDD, 0x03A4003F };
+static uint32_t encCacheValid[4];
+static uint8_t encCache[4][32];
+
+// Reset values of the cached registers (datasheet table 3-2)
+static const enc28j60_register_write_t encResetValues[] = {
+  ENC28J60_POINTER(ERDPTL, 0x05FA),
+  ENC28J60_POINTER(EWRPTL, 0x0000),
+  ENC28J60_POINTER(ETXSTL, 0x0000),
+  ENC28J60_POINTER(ETXNDL, 0x0000),
+  ENC28J60_POINTER(ERXSTL, 0x05FA),
+  ENC28J60_POINTER(ERXNDL, 0x1FFF),
+  {ERXFCON, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_BCEN},
+  {EIE, 0x00},
+  {MACON1, 0x00},
+  {MACON3, 0x00},
+  {MACON4, 0x00},
+  {MABBIPG, 0x00},
+  {MAIPGL, 0x00},
+  {MAIPGH, 0x00},
+  ENC28J60_POINTER(MAMXFLL, 0x0600),
+  {ECOCON, 0x04}
+};
 
 uint8_t ENC28J60_ReadOp(uint8_t op, uint8_t address);
 void ENC28J60_WriteOp(uint8_t op, uint8_t address, uint8_t data);
@@ -28,12 +100,158 @@ uint8_t ENC28J60_Read(uint8_t address);
 void ENC28J60_Write(uint8_t address, uint8_t data);
 uint8_t ENC28J60_GetRevision(void);
 void ENC28J60_PhyRegisterWrite(uint8_t address, uint16_t data);
+static void ENC28J60_FinishBufferTransfer(void);
+static void ENC28J60_Unlock(void);
+static void ENC28J60_CacheAdvancePointer(uint8_t addressL, uint16_t len);
+
+/************************************************************************/
+/* Register cache                                                       */
+/************************************************************************/
+static uint8_t ENC28J60_IsCached(uint8_t address)
+{
+  return (encCacheValid[GET_BANK_CODE(address)] >> GET_REGISTERADDRESS(address)) & 0x01;
+}
+
+static void ENC28J60_CacheStore(uint8_t address, uint8_t data)
+{
+  if((encCacheable[GET_BANK_CODE(address)] >> GET_REGISTERADDRESS(address)) & 0x01)
+  {
+    encCache[GET_BANK_CODE(address)][GET_REGISTERADDRESS(address)] = data;
+    encCacheValid[GET_BANK_CODE(address)] |= 1UL << GET_REGISTERADDRESS(address);
+  }
+}
+
+static void ENC28J60_CacheDrop(uint8_t address)
+{
+  encCacheValid[GET_BANK_CODE(address)] &= ~(1UL << GET_REGISTERADDRESS(address));
+}
+
+static uint16_t ENC28J60_CachedPointer(uint8_t addressL)
+{
+  return encCache[GET_BANK_CODE(addressL)][GET_REGISTERADDRESS(addressL)] |
+         (encCache[GET_BANK_CODE(addressL)][GET_REGISTERADDRESS(addressL) + 1] << 8);
+}
+
+// Moves a cached ERDPT or EWRPT the way the chip does after len buffer memory bytes
+static void ENC28J60_CacheAdvancePointer(uint8_t addressL, uint16_t len)
+{
+  uint16_t ptr, rxEnd;
+
+  if(!ENC28J60_IsCached(addressL) || !ENC28J60_IsCached(addressL + 1))
+  {
+    ENC28J60_CacheDrop(addressL);
+    ENC28J60_CacheDrop(addressL + 1);
+    return;
+  }
+  ptr = ENC28J60_CachedPointer(addressL);
+  if(addressL == ERDPTL)
+  {
+    // reads wrap from ERXND to ERXST
+    if(!ENC28J60_IsCached(ERXNDL) || !ENC28J60_IsCached(ERXNDH) || !ENC28J60_IsCached(ERXSTL) || !ENC28J60_IsCached(ERXSTH))
+    {
+      ENC28J60_CacheDrop(ERDPTL);
+      ENC28J60_CacheDrop(ERDPTH);
+      return;
+    }
+    rxEnd = ENC28J60_CachedPointer(ERXNDL);
+    if(ptr <= rxEnd && ptr + len > rxEnd)
+      ptr = ENC28J60_CachedPointer(ERXSTL) + (ptr + len - rxEnd - 1);
+    else
+      ptr = (ptr + len) & ENC28J80_TOTAL_BUFFER_SIZE;
+  }
+  else
+  {
+    ptr = (ptr + len) & ENC28J80_TOTAL_BUFFER_SIZE;
+  }
+  ENC28J60_CacheStore(addressL, ptr & 0xFF);
+  ENC28J60_CacheStore(addressL + 1, ptr >> 8);
+}
+
+// Follows a register operation in the shadow copy
+static void ENC28J60_CacheUpdate(uint8_t op, uint8_t address, uint8_t data)
+{
+  uint8_t i;
+
+  switch(op)
+  {
+    case ENC28J60_WRITE_CTRL_REG:
+      ENC28J60_CacheStore(address, data);
+      break;
+    case ENC28J60_BIT_FIELD_SET:
+      if(ENC28J60_IsCached(address))
+        ENC28J60_CacheStore(address, encCache[GET_BANK_CODE(address)][GET_REGISTERADDRESS(address)] | data);
+      break;
+    case ENC28J60_BIT_FIELD_CLR:
+      if(ENC28J60_IsCached(address))
+        ENC28J60_CacheStore(address, encCache[GET_BANK_CODE(address)][GET_REGISTERADDRESS(address)] & ~data);
+      break;
+    case ENC28J60_WRITE_BUF_MEM:
+      ENC28J60_CacheAdvancePointer(EWRPTL, 1);
+      break;
+    case ENC28J60_SOFT_RESET:
+      // the reset also selects bank 0
+      ENC28J60_InvalidateRegisterCache();
+      encBankNumber = 0;
+      for(i = 0; i < sizeof(encResetValues) / sizeof(encResetValues[0]); i++)
+        ENC28J60_CacheStore(encResetValues[i].address, encResetValues[i].data);
+      break;
+    default:
+      break;
+  }
+}
+
+void ENC28J60_InvalidateRegisterCache(void)
+{
+  uint8_t bank;
+  for(bank = 0; bank < 4; bank++)
+    encCacheValid[bank] = 0;
+}
+
+/************************************************************************/
+/* Interrupt driven receive                                             */
+/************************************************************************/
+static void ENC28J60_DrainReceive(void);
+
+// Keeps the INT interrupt routine off the bus. Calls may nest.
+static void ENC28J60_Lock(void)
+{
+  ENC28J60_WaitBufferTransfer();
+  rxIrqLock++;
+}
+
+// Runs the work of an INT interrupt which came in while the bus was in use
+static void ENC28J60_Unlock(void)
+{
+  if(--rxIrqLock)
+    return;
+  while(rxIrqPending)
+  {
+    rxIrqLock = 1;
+    rxIrqPending = 0;
+    ENC28J60_DrainReceive();
+    rxIrqLock = 0;
+  }
+}
+
+ISR(ENC28J60_GpioInterrupt, AVR32_GPIO_IRQ_GROUP, ENC28J60_INT_IRQ_LEVEL)
+{
+  gpio_clear_pin_interrupt_flag(rxIrqPin);
+  if(rxIrqLock)
+  {
+    rxIrqPending = 1;
+    return;
+  }
+  rxIrqLock = 1;
+  ENC28J60_DrainReceive();
+  rxIrqLock = 0;
+}
 
 uint8_t ENC28J60_ReadOp(uint8_t op, uint8_t address)
 {
     uint8_t cmd;
     uint8_t data = 0;
     
+    ENC28J60_WaitBufferTransfer();
     spi_select_device(avr32SPI, &spiDevice);
     cmd = op | GET_REGISTERADDRESS(address);
     spi_write_packet(avr32SPI, &cmd, 1);
@@ -42,8 +260,10 @@ uint8_t ENC28J60_ReadOp(uint8_t op, uint8_t address)
       if(spi_is_tx_ready(avr32SPI))
       break;
     }
-    spi_read_packet(avr32SPI, &data, 1);
+    spi_read_packet(avr32SPI, &data, 1);
     spi_deselect_device(avr32SPI, &spiDevice);
+    if(op == ENC28J60_READ_BUF_MEM)
+      ENC28J60_CacheAdvancePointer(ERDPTL, 1);
     return data;
 }
 
@@ -51,8 +271,9 @@ void ENC28J60_WriteOp(uint8_t op, uint8_t address, uint8_t data)
 {
     uint8_t cmd;
     
-    spi_select_device(avr32SPI, &spiDevice);
-    cmd = op | GET_REGISTERADDRESS(address);
+    ENC28J60_WaitBufferTransfer();
+    spi_select_device(avr32SPI, &spiDevice);
+    cmd = op | GET_REGISTERADDRESS(address);
     spi_write_single(avr32SPI, cmd);
     for(;;)
     {
@@ -66,68 +287,249 @@ void ENC28J60_WriteOp(uint8_t op, uint8_t address, uint8_t data)
         break;
     }
     
-    spi_deselect_device(avr32SPI, &spiDevice);
+    spi_deselect_device(avr32SPI, &spiDevice);
+    ENC28J60_CacheUpdate(op, address, data);
 }
 
-void ENC28J60_ReadBuffer(uint16_t len, uint8_t* data)
-{
-  status_code_t ret = STATUS_OK;
-  spi_select_device(avr32SPI, &spiDevice);
-  spi_write_single(avr32SPI, ENC28J60_READ_BUF_MEM);
-  for(;;)
+#if ENC28J60_USE_PDCA
+#define PDCA_RX (&AVR32_PDCA.channel[ENC28J60_PDCA_RX_CHANNEL])
+#define PDCA_TX (&AVR32_PDCA.channel[ENC28J60_PDCA_TX_CHANNEL])
+
+// Releases the chip select once the last byte of a PDCA transfer is on the bus
+static void ENC28J60_PdcaComplete(void)
+{
+  PDCA_RX->idr = AVR32_PDCA_TRC_MASK;
+  PDCA_TX->idr = AVR32_PDCA_TRC_MASK;
+  PDCA_RX->cr = AVR32_PDCA_TDIS_MASK;
+  PDCA_TX->cr = AVR32_PDCA_TDIS_MASK;
+  // the TX channel completes when the last byte entered the shift register
+  while(!(avr32SPI->sr & AVR32_SPI_SR_TXEMPTY_MASK));
+  // drop the bytes received during a write (and clear the overrun flag)
+  (void)avr32SPI->rdr;
+  (void)avr32SPI->sr;
+  ENC28J60_FinishBufferTransfer();
+}
+
+ISR(ENC28J60_PdcaInterrupt, AVR32_PDCA_IRQ_GROUP, ENC28J60_PDCA_IRQ_LEVEL)
+{
+  ENC28J60_PdcaComplete();
+}
+
+// With the interrupts masked the transfer is completed by polling: the
+// channel which completes it is the one with the TRC interrupt enabled
+static void ENC28J60_PdcaPoll(void)
+{
+  if(cpu_irq_is_enabled())
+    return;
+  if((PDCA_RX->imr & PDCA_RX->isr & AVR32_PDCA_TRC_MASK) ||
+     (PDCA_TX->imr & PDCA_TX->isr & AVR32_PDCA_TRC_MASK))
+    ENC28J60_PdcaComplete();
+}
+
+static void ENC28J60_PdcaInit(void)
+{
+  sysclk_enable_peripheral_clock(&AVR32_PDCA);
+  PDCA_RX->cr = AVR32_PDCA_TDIS_MASK;
+  PDCA_TX->cr = AVR32_PDCA_TDIS_MASK;
+  PDCA_RX->psr = ENC28J60_PDCA_PID_RX;
+  PDCA_TX->psr = ENC28J60_PDCA_PID_TX;
+  PDCA_RX->mr = AVR32_PDCA_BYTE;
+  PDCA_TX->mr = AVR32_PDCA_BYTE;
+  irq_register_handler(ENC28J60_PdcaInterrupt, AVR32_PDCA_IRQ_0 + ENC28J60_PDCA_RX_CHANNEL, ENC28J60_PDCA_IRQ_LEVEL);
+  irq_register_handler(ENC28J60_PdcaInterrupt, AVR32_PDCA_IRQ_0 + ENC28J60_PDCA_TX_CHANNEL, ENC28J60_PDCA_IRQ_LEVEL);
+}
+
+static void ENC28J60_PdcaStart(uint8_t op, uint16_t len, uint8_t* data)
+{
+  // wait until the opcode is shifted out and drop its answer
+  while(!(avr32SPI->sr & AVR32_SPI_SR_TXEMPTY_MASK));
+  (void)avr32SPI->rdr;
+  PDCA_TX->mar = (uint32_t)data;
+  PDCA_TX->tcr = len;
+  PDCA_TX->cr = AVR32_PDCA_ECLR_MASK;
+  if(op == ENC28J60_READ_BUF_MEM)
   {
-    if(spi_is_tx_ready(avr32SPI))
-    break;
+    // the last received byte completes a read
+    PDCA_RX->mar = (uint32_t)data;
+    PDCA_RX->tcr = len;
+    PDCA_RX->cr = AVR32_PDCA_ECLR_MASK;
+    PDCA_RX->ier = AVR32_PDCA_TRC_MASK;
+    PDCA_RX->cr = AVR32_PDCA_TEN_MASK;
   }
-  ret = spi_read_packet(avr32SPI, data, len);
+  else
+  {
+    PDCA_TX->ier = AVR32_PDCA_TRC_MASK;
+  }
+  PDCA_TX->cr = AVR32_PDCA_TEN_MASK;
+}
+#endif
+
+static void ENC28J60_FinishBufferTransfer(void)
+{
+  enc28j60_transfer_callback_t callback = bufferTransferCallback;
+
   spi_deselect_device(avr32SPI, &spiDevice);
-  data[len] = '\0';
-}
-
-void ENC28J60_WriteBuffer(uint16_t len, uint8_t* data)
-{
-  status_code_t ret = STATUS_OK;
+  bufferTransferCallback = 0;
+  bufferTransferBusy = 0;
+  if(callback)
+    callback();
+  ENC28J60_Unlock();
+}
+
+// Selects the chip and sends the RBM/WBM opcode. The transfer stays open
+// until ENC28J60_ContinueBufferTransfer moves its last data block.
+static void ENC28J60_OpenBufferTransfer(uint8_t op, enc28j60_transfer_callback_t callback)
+{
+  ENC28J60_WaitBufferTransfer();
+  rxIrqLock++;
+  bufferTransferBusy = 1;
+  bufferTransferCallback = callback;
   spi_select_device(avr32SPI, &spiDevice);
-  spi_write_single(avr32SPI, ENC28J60_WRITE_BUF_MEM);
+  spi_write_single(avr32SPI, op);
   for(;;)
   {
     if(spi_is_tx_ready(avr32SPI))
     break;
   }
-  ret = spi_write_packet(avr32SPI, data, len);
-  spi_deselect_device(avr32SPI, &spiDevice);
-}
-
+}
+
+// Moves the last data block of an open transfer and closes it
+static void ENC28J60_ContinueBufferTransfer(uint8_t op, uint16_t len, uint8_t* data)
+{
+  ENC28J60_CacheAdvancePointer(op == ENC28J60_READ_BUF_MEM ? ERDPTL : EWRPTL, len);
+#if ENC28J60_USE_PDCA
+  if(len >= ENC28J60_PDCA_MIN_LEN)
+  {
+    ENC28J60_PdcaStart(op, len, data);
+    return;
+  }
+#endif
+  if(op == ENC28J60_READ_BUF_MEM)
+    spi_read_packet(avr32SPI, data, len);
+  else
+    spi_write_packet(avr32SPI, data, len);
+  ENC28J60_FinishBufferTransfer();
+}
+
+static void ENC28J60_StartBufferTransfer(uint8_t op, uint16_t len, uint8_t* data, enc28j60_transfer_callback_t callback)
+{
+  ENC28J60_OpenBufferTransfer(op, callback);
+  ENC28J60_ContinueBufferTransfer(op, len, data);
+}
+
+// Starts reading len bytes at ERDPT. The callback is called when the data is in place.
+void ENC28J60_ReadBufferAsync(uint16_t len, uint8_t* data, enc28j60_transfer_callback_t callback)
+{
+  ENC28J60_StartBufferTransfer(ENC28J60_READ_BUF_MEM, len, data, callback);
+}
+
+// Starts writing len bytes at EWRPT. data must stay valid until the callback is called.
+void ENC28J60_WriteBufferAsync(uint16_t len, const uint8_t* data, enc28j60_transfer_callback_t callback)
+{
+  ENC28J60_StartBufferTransfer(ENC28J60_WRITE_BUF_MEM, len, (uint8_t*)data, callback);
+}
+
+uint8_t ENC28J60_IsBufferTransferBusy(void)
+{
+  return bufferTransferBusy;
+}
+
+void ENC28J60_WaitBufferTransfer(void)
+{
+  while(bufferTransferBusy)
+  {
+#if ENC28J60_USE_PDCA
+    ENC28J60_PdcaPoll();
+#endif
+  }
+}
+
+void ENC28J60_ReadBuffer(uint16_t len, uint8_t* data)
+{
+  ENC28J60_ReadBufferAsync(len, data, 0);
+  ENC28J60_WaitBufferTransfer();
+  data[len] = '\0';
+}
+
+void ENC28J60_WriteBuffer(uint16_t len, uint8_t* data)
+{
+  ENC28J60_WriteBufferAsync(len, data, 0);
+  ENC28J60_WaitBufferTransfer();
+}
+
 void ENC28J60_SetBank(uint8_t address)
 {
+  uint8_t bank = GET_BANK_CODE(address);
+
+  // EIE, EIR, ESTAT, ECON2 and ECON1 are mapped into every bank
+  if(GET_REGISTERADDRESS(address) >= EIE)
+    return;
   // set the bank (if needed)
-  if(GET_BANK_CODE(address) != encBankNumber)
+  if(bank != encBankNumber)
   {
-    // set the bank
-    ENC28J60_WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, (ECON1_BSEL1|ECON1_BSEL0));
-    ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, GET_BANK_CODE(address));
-    encBankNumber = GET_BANK_CODE(address);
+    // set the bank, only the BSEL bits which change
+    if(encBankNumber & ~bank)
+      ENC28J60_WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, encBankNumber & ~bank);
+    if(bank & ~encBankNumber)
+      ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, bank & ~encBankNumber);
+    encBankNumber = bank;
   }
 }
 
 uint8_t ENC28J60_Read(uint8_t address)
 {
+        uint8_t data;
+        // use the shadow copy if we have one
+        if(ENC28J60_IsCached(address))
+          return encCache[GET_BANK_CODE(address)][GET_REGISTERADDRESS(address)];
         // set the bank
         ENC28J60_SetBank(address);
         // do the read
-        return ENC28J60_ReadOp(ENC28J60_READ_CTRL_REG, address);
+        data = ENC28J60_ReadOp(ENC28J60_READ_CTRL_REG, address);
+        ENC28J60_CacheStore(address, data);
+        return data;
 }
 
 void ENC28J60_Write(uint8_t address, uint8_t data)
 {
+        // nothing to do if the register already holds the value
+        if(ENC28J60_IsCached(address) && encCache[GET_BANK_CODE(address)][GET_REGISTERADDRESS(address)] == data)
+          return;
         // set the bank
         ENC28J60_SetBank(address);
         // do the write
         ENC28J60_WriteOp(ENC28J60_WRITE_CTRL_REG, address, data);
 }
 
+// Writes a list of registers with as few bank switches as possible
+void ENC28J60_WriteRegisters(const enc28j60_register_write_t *writes, uint8_t count)
+{
+  uint8_t first = encBankNumber;
+  uint8_t pass, bank, entryBank, i;
+
+  ENC28J60_Lock();
+  // the selected bank (and the registers mapped into all banks) first, then the others
+  for(pass = 0; pass <= 4; pass++)
+  {
+    if(pass == 0)
+      bank = first;
+    else if((bank = pass - 1) == first)
+      continue;
+    for(i = 0; i < count; i++)
+    {
+      entryBank = GET_BANK_CODE(writes[i].address);
+      if(GET_REGISTERADDRESS(writes[i].address) >= EIE)
+        entryBank = first;
+      if(entryBank == bank)
+        ENC28J60_Write(writes[i].address, writes[i].data);
+    }
+  }
+  ENC28J60_Unlock();
+}
+
 void ENC28J60_PhyRegisterWrite(uint8_t address, uint16_t data)
 {
+        ENC28J60_Lock();
         // set the PHY register address
         ENC28J60_Write(MIREGADR, address);
         // write the PHY data
@@ -135,21 +537,40 @@ void ENC28J60_PhyRegisterWrite(uint8_t address, uint16_t data)
         ENC28J60_Write(MIWRH, data>>8);
         // wait until the PHY write completes
         while(ENC28J60_Read(MISTAT) & MISTAT_BUSY);
+        ENC28J60_Unlock();
 }
 
 void ENC28J60_Clkout(uint8_t clk)
 {
         //setup clkout: 2 is 12.5MHz:
+	ENC28J60_Lock();
 	ENC28J60_Write(ECOCON, clk & 0x7);
+	ENC28J60_Unlock();
 }
 
 void ENC28J60_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_t spiFlags, uint32_t spiBaudrate, uint8_t* macaddr)
 {
+  const enc28j60_register_write_t bufferLayout[] = {
+    // Rx start
+    ENC28J60_POINTER(ERXSTL, RXSTARTBUFFER),
+    // set receive pointer address
+    ENC28J60_POINTER(ERXRDPTL, RXSTARTBUFFER),
+    // RX end
+    ENC28J60_POINTER(ERXNDL, rxBufferEnd),
+    // TX start
+    ENC28J60_POINTER(ETXSTL, txBufferStart),
+    // TX end
+    ENC28J60_POINTER(ETXNDL, TXSTOP_INIT)
+  };
+
   spiDevice.id = spiDeviceId;
   avr32SPI = spi;
   spi_master_init(avr32SPI);
   spi_master_setup_device(avr32SPI, &spiDevice, spiFlags,	spiBaudrate, spiDevice.id);
   spi_enable(avr32SPI);
+#if ENC28J60_USE_PDCA
+  ENC28J60_PdcaInit();
+#endif
 
 	ENC28J60_WriteOp(ENC28J60_SOFT_RESET, 0, ENC28J60_SOFT_RESET);
   while(!(ENC28J60_Read(ESTAT) & ESTAT_CLKRDY));
@@ -159,21 +580,21 @@ void ENC28J60_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_t s
 	// 16-bit transfers, must write low byte first
 	// set receive buffer start address
 	nextPacketPtr = RXSTARTBUFFER;
-        // Rx start
-	ENC28J60_Write(ERXSTL, RXSTARTBUFFER&0xFF);
-	ENC28J60_Write(ERXSTH, RXSTARTBUFFER>>8);
-	// set receive pointer address
-	ENC28J60_Write(ERXRDPTL, RXSTARTBUFFER&0xFF);
-	ENC28J60_Write(ERXRDPTH, RXSTARTBUFFER>>8);
-	// RX end
-	ENC28J60_Write(ERXNDL, RXSTOPBUFFER&0xFF);
-	ENC28J60_Write(ERXNDH, RXSTOPBUFFER>>8);
-	// TX start
-	ENC28J60_Write(ETXSTL, TXSTART_INIT&0xFF);
-	ENC28J60_Write(ETXSTH, TXSTART_INIT>>8);
-	// TX end
-	ENC28J60_Write(ETXNDL, TXSTOP_INIT&0xFF);
-	ENC28J60_Write(ETXNDH, TXSTOP_INIT>>8);
+	rxReadPtr = RXSTARTBUFFER;
+	packetOpen = 0;
+	// the soft reset dropped all queued packets
+	txTail = 0;
+	txCount = 0;
+	txActive = 0;
+	while(txQueueCount)
+	{
+		Pbuf_Free(txQueue[txQueueTail].p);
+		txQueueTail = (txQueueTail + 1) % ENC28J60_TX_QUEUE;
+		txQueueCount--;
+	}
+	rxRingTail = rxRingHead;
+	rxHeaderPtr = RXSTARTBUFFER;
+	ENC28J60_WriteRegisters(bufferLayout, sizeof(bufferLayout) / sizeof(bufferLayout[0]));
 	// do bank 1 stuff, packet filter:
         // For broadcast packets we allow only ARP packtets
         // All other packets should be unicast only for our mac (MAADR)
@@ -184,6 +605,7 @@ void ENC28J60_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_t s
         // 06 08 -- ff ff ff ff ff ff -> ip checksum for theses bytes=f7f9
         // in binary these poitions are:11 0000 0011 1111
         // This is hex 303F->EPMM0=0x3f,EPMM1=0x30
+        // See ENC28J60_SetBroadcastFilter and ENC28J60_SetHashFilter to change it.
 	ENC28J60_Write(ERXFCON, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN);
 	ENC28J60_Write(EPMM0, 0x3f);
 	ENC28J60_Write(EPMM1, 0x30);
@@ -197,6 +619,7 @@ void ENC28J60_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_t s
 	// bring MAC out of reset
 	ENC28J60_Write(MACON2, 0x00);
 	// enable automatic padding to 60bytes and CRC operations
+	ENC28J60_SetBank(MACON3);
 	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, MACON3, MACON3_PADCFG0|MACON3_TXCRCEN|MACON3_FRMLNEN);
 	// set inter-frame gap (non-back-to-back)
 	ENC28J60_Write(MAIPGL, 0x12);
@@ -255,24 +678,830 @@ uint8_t ENC28J60_GetRevision(void)
 	return(ENC28J60_Read(EREVID));
 }
 
-void ENC28J60_PacketSend(uint16_t len, uint8_t* packet)
+// Sets or clears filter bits of ERXFCON, through the register cache
+static void ENC28J60_SetReceiveFilter(uint8_t bits, uint8_t enable)
+{
+  uint8_t filter = ENC28J60_Read(ERXFCON);
+
+  ENC28J60_Write(ERXFCON, enable ? (filter | bits) : (filter & ~bits));
+}
+
+// Returns the bit of the hash table filter for a destination MAC address:
+// bits 28:23 of the CRC-32 over the address (datasheet 8.3)
+static uint8_t ENC28J60_HashIndex(const uint8_t *address)
 {
-	// Set the write pointer to start of transmit buffer area
-	ENC28J60_Write(EWRPTL, TXSTART_INIT&0xFF);
-	ENC28J60_Write(EWRPTH, TXSTART_INIT>>8);
-	// Set the TXND pointer to correspond to the packet size given
-	ENC28J60_Write(ETXNDL, (TXSTART_INIT+len)&0xFF);
-	ENC28J60_Write(ETXNDH, (TXSTART_INIT+len)>>8);
-	// write per-packet control byte (0x00 means use macon3 settings)
-	ENC28J60_WriteOp(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
-	// copy the packet into the transmit buffer
-	ENC28J60_WriteBuffer(len, packet);
-	// send the contents of the transmit buffer onto the network
+  uint32_t crc = 0xFFFFFFFF;
+  uint8_t i, bit, data;
+
+  for(i = 0; i < 6; i++)
+  {
+    data = address[i];
+    for(bit = 0; bit < 8; bit++)
+    {
+      uint8_t msb = ((crc >> 31) ^ data) & 0x01;
+      crc <<= 1;
+      if(msb)
+        crc ^= 0x04C11DB7;
+      data >>= 1;
+    }
+  }
+  return (crc >> 23) & 0x3F;
+}
+
+// Accepts frames for count destination MAC addresses, usually multicast
+// groups, with the hash table filter. count 0 turns the filter off.
+void ENC28J60_SetHashFilter(const uint8_t (*addresses)[6], uint8_t count)
+{
+  enc28j60_register_write_t writes[8];
+  uint8_t i, index;
+
+  for(i = 0; i < 8; i++)
+  {
+    writes[i].address = EHT0 + i;
+    writes[i].data = 0;
+  }
+  for(i = 0; i < count; i++)
+  {
+    index = ENC28J60_HashIndex(addresses[i]);
+    writes[index >> 3].data |= 1 << (index & 0x07);
+  }
+  ENC28J60_Lock();
+  ENC28J60_WriteRegisters(writes, 8);
+  ENC28J60_SetReceiveFilter(ERXFCON_HTEN, count != 0);
+  ENC28J60_Unlock();
+}
+
+// Accepts frames whose bytes at offset selected by mask equal those of
+// pattern with the pattern match filter. The window is 64 bytes long,
+// bit n of mask[n / 8] selects byte n of it, pattern holds the window
+// (unselected bytes are not read). mask 0 turns the filter off.
+void ENC28J60_SetPatternFilter(uint16_t offset, const uint8_t *mask, const uint8_t *pattern)
+{
+  enc28j60_register_write_t writes[12];
+  uint32_t sum = 0;
+  uint8_t i, odd = 0, used = 0;
+
+  // the chip sums the selected bytes like an IP checksum (datasheet 8.2)
+  for(i = 0; i < 64; i++)
+  {
+    if(!(mask[i >> 3] & (1 << (i & 0x07))))
+      continue;
+    sum += odd ? pattern[i] : (pattern[i] << 8);
+    odd ^= 1;
+    used = 1;
+  }
+  while(sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  sum ^= 0xFFFF;
+  for(i = 0; i < 8; i++)
+  {
+    writes[i].address = EPMM0 + i;
+    writes[i].data = mask[i];
+  }
+  writes[8].address = EPMCSL;
+  writes[8].data = sum & 0xFF;
+  writes[9].address = EPMCSH;
+  writes[9].data = sum >> 8;
+  writes[10].address = EPMOL;
+  writes[10].data = offset & 0xFF;
+  writes[11].address = EPMOH;
+  writes[11].data = offset >> 8;
+  ENC28J60_Lock();
+  // off while the window changes, a half written one would match garbage
+  ENC28J60_SetReceiveFilter(ERXFCON_PMEN, 0);
+  ENC28J60_WriteRegisters(writes, 12);
+  ENC28J60_SetReceiveFilter(ERXFCON_PMEN, used);
+  ENC28J60_Unlock();
+}
+
+// Accepts broadcast frames of count ethertypes, ENC28J60_Init accepts ARP
+// only. One type is matched by the pattern filter (the filter is taken);
+// for more the chip has to accept all broadcasts and the types must be
+// checked in software. count 0 drops all broadcasts.
+void ENC28J60_SetBroadcastFilter(const uint16_t *types, uint8_t count)
+{
+  uint8_t mask[8] = {0x3f, 0x30, 0, 0, 0, 0, 0, 0};
+  uint8_t pattern[14] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+  ENC28J60_Lock();
+  if(count == 1)
+  {
+    // ETH.DST and ETH.TYPE, as in ENC28J60_Init
+    pattern[12] = types[0] >> 8;
+    pattern[13] = types[0] & 0xFF;
+    ENC28J60_SetPatternFilter(0, mask, pattern);
+  }
+  else
+  {
+    mask[0] = mask[1] = 0;
+    ENC28J60_SetPatternFilter(0, mask, pattern);
+  }
+  ENC28J60_SetReceiveFilter(ERXFCON_BCEN, count > 1);
+  ENC28J60_Unlock();
+}
+
+// Loads ETXST/ETXND with the oldest queued packet and starts its transmission
+static void ENC28J60_StartTransmit(void)
+{
+	const enc28j60_register_write_t pointers[] = {
+		ENC28J60_POINTER(ETXSTL, txSlotStart[txTail]),
+		ENC28J60_POINTER(ETXNDL, txSlotEnd[txTail])
+	};
+	ENC28J60_WriteRegisters(pointers, sizeof(pointers) / sizeof(pointers[0]));
 	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
-        // Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
-	if( (ENC28J60_Read(EIR) & EIR_TXERIF) ){
-                ENC28J60_WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRTS);
+	txActive = 1;
+}
+
+// Handles a transmit error of the packet on the wire.
+// Returns nonzero if the packet should be sent again.
+static uint8_t ENC28J60_TransmitFailed(void)
+{
+	uint8_t tsv[ENC28J60_TSV_LEN];
+	uint16_t address = txSlotEnd[txTail] + 1;
+
+	// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
+	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
+	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST|ECON1_TXRTS);
+	// the transmit status vector follows the packet
+	ENC28J60_Write(ERDPTL, address&0xFF);
+	ENC28J60_Write(ERDPTH, address>>8);
+	ENC28J60_ReadBufferAsync(sizeof(tsv), tsv, 0);
+	ENC28J60_WaitBufferTransfer();
+	if((tsv[TSV_LATE_COLLISION_BYTE] & TSV_LATE_COLLISION) && txRetries < ENC28J60_TX_RETRIES)
+	{
+		txRetries++;
+		return 1;
+	}
+	return 0;
+}
+
+// Returns nonzero if size bytes at start overlap a queued packet or its status vector
+static uint8_t ENC28J60_TransmitOverlaps(uint16_t start, uint16_t size)
+{
+	uint8_t i, slot;
+
+	for(i = 0; i < txCount; i++)
+	{
+		slot = (txTail + i) % ENC28J60_TX_SLOTS;
+		if(start < txSlotEnd[slot] + 1 + ENC28J60_TSV_LEN && txSlotStart[slot] < start + size)
+			return 1;
+	}
+	return 0;
+}
+
+static void ENC28J60_TransmitNext(void)
+{
+	uint8_t eir;
+
+	if(txActive)
+	{
+		eir = ENC28J60_Read(EIR);
+		if(!(eir & (EIR_TXIF|EIR_TXERIF)))
+			return;
+		ENC28J60_WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXIF|EIR_TXERIF);
+		txActive = 0;
+		if(eir & EIR_TXERIF)
+		{
+			NET_STATS_INC(txErrors);
+			if(ENC28J60_TransmitFailed())
+			{
+				ENC28J60_StartTransmit();
+				return;
+			}
+		}
+		else
+		{
+			NET_STATS_INC(txFrames);
+			NET_STATS_ADD(txOctets, txSlotEnd[txTail] - txSlotStart[txTail]);
+		}
+		txRetries = 0;
+		txTail = (txTail + 1) % ENC28J60_TX_SLOTS;
+		txCount--;
+	}
+	if(txCount)
+		ENC28J60_StartTransmit();
+}
+
+// Returns the start of a free part of the transmit buffer for size bytes
+// behind the packet queued last, or TX_NO_SLOT while there is none.
+static uint16_t ENC28J60_FindSlot(uint16_t size)
+{
+	uint16_t start;
+
+	if(txCount == ENC28J60_TX_SLOTS)
+		return TX_NO_SLOT;
+	// behind the packet queued last, or at the start of the transmit buffer
+	start = txBufferStart;
+	if(txCount)
+	{
+		start = txSlotEnd[(txTail + txCount - 1) % ENC28J60_TX_SLOTS] + 1 + ENC28J60_TSV_LEN;
+		if(start + size - 1 > TXSTOP_INIT)
+			start = txBufferStart;
+	}
+	if(ENC28J60_TransmitOverlaps(start, size))
+		return TX_NO_SLOT;
+	return start;
+}
+
+// Writes the per-packet control byte and the fragments of a packet behind it
+// in one buffer memory write. All but the last fragment are moved by the CPU,
+// the last one by the PDCA if it is long enough.
+static void ENC28J60_WriteFragments(const enc28j60_iovec_t *iov, uint8_t count)
+{
+	// 0x00 means use macon3 settings
+	static const uint8_t control = 0x00;
+	const uint8_t *last = &control;
+	uint16_t lastLen = 1;
+	uint8_t i;
+
+	ENC28J60_OpenBufferTransfer(ENC28J60_WRITE_BUF_MEM, 0);
+	for(i = 0; i < count; i++)
+	{
+		if(!iov[i].len)
+			continue;
+		ENC28J60_CacheAdvancePointer(EWRPTL, lastLen);
+		spi_write_packet(avr32SPI, last, lastLen);
+		last = iov[i].data;
+		lastLen = iov[i].len;
+	}
+	ENC28J60_ContinueBufferTransfer(ENC28J60_WRITE_BUF_MEM, lastLen, (uint8_t*)last);
+	ENC28J60_WaitBufferTransfer();
+}
+
+// Copies the fragments of a packet, len bytes in all, into the transmit buffer
+// at start, see ENC28J60_FindSlot
+static void ENC28J60_WritePacket(uint16_t start, const enc28j60_iovec_t *iov, uint8_t count, uint16_t len)
+{
+	uint8_t head = (txTail + txCount) % ENC28J60_TX_SLOTS;
+
+	txSlotStart[head] = start;
+	txSlotEnd[head] = start + len;
+	{
+		const enc28j60_register_write_t pointers[] = {
+			// Set the write pointer to the start of the slot
+			ENC28J60_POINTER(EWRPTL, start)
+		};
+		ENC28J60_WriteRegisters(pointers, sizeof(pointers) / sizeof(pointers[0]));
+	}
+	ENC28J60_WriteFragments(iov, count);
+}
+
+// Has the DMA controller compute the checksum of the packet written at start,
+// see ENC28J60_PacketSendWithChecksum, writes it into the buffer and returns it
+static uint16_t ENC28J60_InsertChecksum(uint16_t start, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum)
+{
+	uint32_t sum;
+	uint8_t checksum[2];
+
+	{
+		// the packet follows the per-packet control byte
+		const enc28j60_register_write_t range[] = {
+			ENC28J60_POINTER(EDMASTL, start + 1 + sumStart),
+			ENC28J60_POINTER(EDMANDL, start + sumStart + sumLen)
+		};
+		ENC28J60_WriteRegisters(range, sizeof(range) / sizeof(range[0]));
+	}
+	Profile_Begin(PROFILE_CHECKSUM);
+	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_CSUMEN|ECON1_DMAST);
+	while(ENC28J60_Read(ECON1) & ECON1_DMAST);
+	// the engine returns the complemented sum of the range, add the pseudo header
+	sum = (uint16_t)~((ENC28J60_Read(EDMACSH) << 8) | ENC28J60_Read(EDMACSL));
+	sum += initialSum;
+	while(sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = ~sum & 0xFFFF;
+	checksum[0] = sum >> 8;
+	checksum[1] = sum & 0xFF;
+	Profile_End(PROFILE_CHECKSUM);
+	{
+		const enc28j60_register_write_t pointers[] = {
+			ENC28J60_POINTER(EWRPTL, start + 1 + checksumPos)
+		};
+		ENC28J60_WriteRegisters(pointers, sizeof(pointers) / sizeof(pointers[0]));
+	}
+	ENC28J60_WriteBuffer(2, checksum);
+	return sum;
+}
+
+// Moves the buffers of the software queue into the transmit buffer as far as
+// there is room, in order, and returns them to the pool.
+static void ENC28J60_LoadQueued(void)
+{
+	enc28j60_tx_request_t *request;
+	enc28j60_iovec_t iov[2];
+	uint16_t start, len;
+
+	while(txQueueCount)
+	{
+		request = &txQueue[txQueueTail];
+		len = request->p->len + request->p->tailLen;
+		start = ENC28J60_FindSlot(1 + len + ENC28J60_TSV_LEN);
+		if(start == TX_NO_SLOT)
+			break;
+		Profile_Begin(PROFILE_TX);
+		iov[0].data = Pbuf_Payload(request->p);
+		iov[0].len = request->p->len;
+		iov[1].data = request->p->tail;
+		iov[1].len = request->p->tailLen;
+		ENC28J60_WritePacket(start, iov, 2, len);
+		if(request->sumLen)
+			ENC28J60_InsertChecksum(start, request->sumStart, request->sumLen,
+					request->checksumPos, request->initialSum);
+		txCount++;
+		Profile_End(PROFILE_TX);
+		Pbuf_Free(request->p);
+		txQueueTail = (txQueueTail + 1) % ENC28J60_TX_QUEUE;
+		txQueueCount--;
+	}
+	// send now unless the previous packet is still on the wire
+	if(txCount && !txActive)
+		ENC28J60_StartTransmit();
+}
+
+// Completes the packet on the wire when the chip is done with it, starts the
+// next queued packet and loads queued buffers into the room that became free.
+// Returns the number of packets still queued, in the chip or in the software queue.
+uint8_t ENC28J60_ServiceTransmit(void)
+{
+	ENC28J60_Lock();
+	ENC28J60_TransmitNext();
+	ENC28J60_LoadQueued();
+	ENC28J60_Unlock();
+	return txCount + txQueueCount;
+}
+
+// Returns nonzero if a packet of len bytes fits into the transmit buffer
+static uint8_t ENC28J60_PacketFits(uint16_t len)
+{
+	// per-packet control byte, packet and transmit status vector
+	if(1 + len + ENC28J60_TSV_LEN > TXSTOP_INIT - txBufferStart + 1)
+	{
+		bufferStats.txDropped++;
+		return 0;
+	}
+	return 1;
+}
+
+// Copies the fragments of a packet, len bytes in all, into the next free part
+// of the transmit buffer and returns the start of its slot. The packet goes out
+// after ENC28J60_CommitPacket. Waits for the buffers of the software queue
+// first, they go out before it.
+static uint16_t ENC28J60_LoadPacket(const enc28j60_iovec_t *iov, uint8_t count, uint16_t len)
+{
+	uint16_t start;
+
+	ENC28J60_ServiceTransmit();
+	while(txQueueCount)
+		ENC28J60_ServiceTransmit();
+	while((start = ENC28J60_FindSlot(1 + len + ENC28J60_TSV_LEN)) == TX_NO_SLOT)
+		ENC28J60_ServiceTransmit();
+	ENC28J60_WritePacket(start, iov, count, len);
+	return start;
+}
+
+// Queues the packet loaded last
+static void ENC28J60_CommitPacket(void)
+{
+	txCount++;
+	// send it now unless the previous packet is still on the wire
+	ENC28J60_ServiceTransmit();
+}
+
+// Queues a packet for transmission. The packet is copied into the transmit
+// buffer while the previous packet may still be on the wire.
+//      len     Length of the packet in bytes.
+//      packet  Pointer to the packet, headed by an ethernet header.
+void ENC28J60_PacketSend(uint16_t len, uint8_t* packet)
+{
+	const enc28j60_iovec_t iov[] = {{packet, len}};
+
+	ENC28J60_PacketSendV(iov, 1);
+}
+
+// Returns the length of a packet in fragments
+static uint16_t ENC28J60_FragmentsLength(const enc28j60_iovec_t *iov, uint8_t count)
+{
+	uint16_t len = 0;
+
+	while(count--)
+		len += iov[count].len;
+	return len;
+}
+
+// Queues a packet like ENC28J60_PacketSend which is taken from count fragments,
+// e.g. the headers in RAM and the body in flash. They are written into the
+// transmit buffer one after the other, nothing is copied in RAM.
+void ENC28J60_PacketSendV(const enc28j60_iovec_t *iov, uint8_t count)
+{
+	uint16_t len = ENC28J60_FragmentsLength(iov, count);
+
+	if(!ENC28J60_PacketFits(len))
+		return;
+	Profile_Begin(PROFILE_TX);
+	ENC28J60_Lock();
+	ENC28J60_LoadPacket(iov, count, len);
+	ENC28J60_CommitPacket();
+	ENC28J60_Unlock();
+	Profile_End(PROFILE_TX);
+}
+
+// Adds a buffer to the software queue, waits only while it is full
+static void ENC28J60_QueuePbuf(pbuf_t *p, uint16_t sumStart, uint16_t sumLen,
+		uint16_t checksumPos, uint16_t initialSum)
+{
+	enc28j60_tx_request_t *request;
+
+	if(!ENC28J60_PacketFits(p->len + p->tailLen))
+	{
+		Pbuf_Free(p);
+		return;
+	}
+	ENC28J60_Lock();
+	while(txQueueCount == ENC28J60_TX_QUEUE)
+		ENC28J60_ServiceTransmit();
+	request = &txQueue[(txQueueTail + txQueueCount) % ENC28J60_TX_QUEUE];
+	request->p = p;
+	request->sumStart = sumStart;
+	request->sumLen = sumLen;
+	request->checksumPos = checksumPos;
+	request->initialSum = initialSum;
+	txQueueCount++;
+	ENC28J60_LoadQueued();
+	ENC28J60_Unlock();
+}
+
+// Queues the packet in the payload of p, p->len bytes headed by an ethernet
+// header and followed by the tail of p, and takes over the reference of the
+// caller. The packet is copied
+// into the transmit buffer right away if there is room, otherwise p waits in
+// the software queue and the call returns without waiting for the wire.
+void ENC28J60_PacketSendPbuf(pbuf_t *p)
+{
+	ENC28J60_QueuePbuf(p, 0, 0, 0, 0);
+}
+
+// Enables or disables ENC28J60_PacketSendWithChecksum at run time
+void ENC28J60_SetChecksumOffload(uint8_t enable)
+{
+	checksumOffload = ENC28J60_CHECKSUM_OFFLOAD && enable;
+}
+
+// Copies the fragments of a packet into the transmit buffer, has the checksum
+// computed there and queues the packet. Returns the checksum.
+static uint16_t ENC28J60_SendChecksummed(const enc28j60_iovec_t *iov, uint8_t count, uint16_t len,
+		uint16_t sumStart, uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum)
+{
+	uint16_t start, sum;
+
+	Profile_Begin(PROFILE_TX);
+	ENC28J60_Lock();
+	start = ENC28J60_LoadPacket(iov, count, len);
+	sum = ENC28J60_InsertChecksum(start, sumStart, sumLen, checksumPos, initialSum);
+	ENC28J60_CommitPacket();
+	ENC28J60_Unlock();
+	Profile_End(PROFILE_TX);
+	return sum;
+}
+
+// Queues a packet like ENC28J60_PacketSend and lets the DMA checksum engine
+// of the chip fill in its TCP or UDP checksum once it sits in the transmit
+// buffer. The checksum field must be zero. Returns 0 without sending if the
+// offload is disabled; the caller then checksums in software.
+//      sumStart     Offset of the checksummed range in the packet.
+//      sumLen       Length of the checksummed range.
+//      checksumPos  Offset of the checksum field in the packet.
+//      initialSum   Sum of the pseudo header fields outside the range.
+uint8_t ENC28J60_PacketSendWithChecksum(uint16_t len, uint8_t* packet, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum)
+{
+	const enc28j60_iovec_t iov[] = {{packet, len}};
+	uint16_t sum;
+
+	if(!checksumOffload)
+		return 0;
+	if(!ENC28J60_PacketFits(len))
+		return 1;
+	sum = ENC28J60_SendChecksummed(iov, 1, len, sumStart, sumLen, checksumPos, initialSum);
+	packet[checksumPos] = sum >> 8;
+	packet[checksumPos + 1] = sum & 0xFF;
+	return 1;
+}
+
+// Queues a packet of count fragments like ENC28J60_PacketSendV and has its
+// checksum computed like ENC28J60_PacketSendWithChecksum. The checksum is only
+// written into the transmit buffer, the fragments may be constant. Returns 0
+// without sending if the offload is disabled.
+uint8_t ENC28J60_PacketSendVWithChecksum(const enc28j60_iovec_t *iov, uint8_t count, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum)
+{
+	uint16_t len = ENC28J60_FragmentsLength(iov, count);
+
+	if(!checksumOffload)
+		return 0;
+	if(ENC28J60_PacketFits(len))
+		ENC28J60_SendChecksummed(iov, count, len, sumStart, sumLen, checksumPos, initialSum);
+	return 1;
+}
+
+// Queues the packet in the payload of p like ENC28J60_PacketSendPbuf, the
+// checksum is filled in as by ENC28J60_PacketSendWithChecksum once the packet
+// is in the transmit buffer. Returns 0 if the offload is disabled, the caller
+// then keeps p.
+uint8_t ENC28J60_PacketSendPbufWithChecksum(pbuf_t *p, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum)
+{
+	if(!checksumOffload)
+		return 0;
+	ENC28J60_QueuePbuf(p, sumStart, sumLen, checksumPos, initialSum);
+	return 1;
+}
+
+/************************************************************************/
+/* Buffer layout and statistics                                         */
+/************************************************************************/
+// Selects the size of the transmit buffer, the receive ring gets the rest.
+// Takes effect with the next ENC28J60_Init.
+void ENC28J60_SetTransmitBufferSize(uint16_t size)
+{
+	if(size < ENC28J60_MIN_TX_SIZE)
+		size = ENC28J60_MIN_TX_SIZE;
+	if(size > ENC28J80_TOTAL_BUFFER_SIZE - ENC28J60_MIN_RX_SIZE)
+		size = ENC28J80_TOTAL_BUFFER_SIZE - ENC28J60_MIN_RX_SIZE;
+	size &= ~1;
+	txBufferStart = ENC28J80_TOTAL_BUFFER_SIZE - size;
+	rxBufferEnd = txBufferStart - 1;
+}
+
+void ENC28J60_GetBufferStatistics(enc28j60_buffer_stats_t *stats)
+{
+	*stats = bufferStats;
+	stats->rxSize = rxBufferEnd - RXSTARTBUFFER + 1;
+	stats->txSize = TXSTOP_INIT - txBufferStart + 1;
+}
+
+void ENC28J60_ResetBufferStatistics(void)
+{
+	bufferStats.rxHighWater = 0;
+	bufferStats.packetCountPeak = 0;
+	bufferStats.rxOverflows = 0;
+	bufferStats.txDropped = 0;
+}
+
+#if ENC28J60_BUFFER_STATS
+// Records the receive ring in use from ERXRDPT up to end
+static void ENC28J60_NoteReceiveUse(uint16_t end)
+{
+	uint16_t used;
+
+	if(end >= rxReadPtr)
+		used = end - rxReadPtr;
+	else
+		used = (rxBufferEnd - RXSTARTBUFFER + 1) - (rxReadPtr - end);
+	if(used > bufferStats.rxHighWater)
+		bufferStats.rxHighWater = used;
+}
+
+// Records a value read from EPKTCNT and packets lost since the last call
+static void ENC28J60_NotePacketCount(uint8_t count, uint8_t readWritePointer)
+{
+	uint16_t writePtr;
+
+	if(count > bufferStats.packetCountPeak)
+		bufferStats.packetCountPeak = count;
+	if(ENC28J60_Read(EIR) & EIR_RXERIF)
+	{
+		bufferStats.rxOverflows++;
+		ENC28J60_WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_RXERIF);
+	}
+	// with a backlog only the chip knows where the last packet ends
+	if(readWritePointer && count >= 2)
+	{
+		writePtr = ENC28J60_Read(ERXWRPTL);
+		writePtr |= ENC28J60_Read(ERXWRPTH) << 8;
+		ENC28J60_NoteReceiveUse(writePtr);
+	}
+}
+#else
+# define ENC28J60_NoteReceiveUse(end)
+# define ENC28J60_NotePacketCount(count, readWritePointer)
+#endif
+
+// Queues a descriptor for every packet the chip has received since the last call.
+// Runs with the lock held.
+static void ENC28J60_DrainReceive(void)
+{
+	enc28j60_rx_descriptor_t *descriptor;
+	uint8_t header[6];
+	uint8_t count, known;
+
+	// INT stays released while packets are queued, see ENC28J60_RX_DESCRIPTORS
+	ENC28J60_Write(EIE, ENC28J60_Read(EIE) & ~EIE_INTIE);
+	count = ENC28J60_Read(EPKTCNT);
+	ENC28J60_NotePacketCount(count, 0);
+	known = (uint8_t)(rxRingHead - rxRingTail) + packetOpen;
+	while(count > known && (uint8_t)(rxRingHead - rxRingTail) < ENC28J60_RX_DESCRIPTORS)
+	{
+		// read the next packet pointer, the packet length and the receive status
+		ENC28J60_Write(ERDPTL, rxHeaderPtr&0xFF);
+		ENC28J60_Write(ERDPTH, rxHeaderPtr>>8);
+		ENC28J60_ReadBufferAsync(sizeof(header), header, 0);
+		ENC28J60_WaitBufferTransfer();
+		descriptor = &rxRing[rxRingHead & (ENC28J60_RX_DESCRIPTORS - 1)];
+		descriptor->start = rxHeaderPtr;
+		descriptor->next = header[0] | (header[1]<<8);
+		descriptor->length = (header[2] | (header[3]<<8)) - 4; //remove the CRC count
+		descriptor->status = header[4] | (header[5]<<8);
+		rxHeaderPtr = descriptor->next;
+		rxRingHead++;
+		known++;
+	}
+	ENC28J60_NoteReceiveUse(rxHeaderPtr);
+	if(known == 0)
+		ENC28J60_Write(EIE, ENC28J60_Read(EIE) | EIE_INTIE);
+	if(rxCallback && rxRingHead != rxRingTail)
+		rxCallback();
+}
+
+// Services the INT pin of the chip with a GPIO interrupt. Received packets
+// are queued by the interrupt routine, ENC28J60_PacketPeek no longer polls
+// the chip for them.
+//      pin     GPIO pin the INT output of the chip is connected to.
+void ENC28J60_EnableInterrupt(uint32_t pin)
+{
+	ENC28J60_Lock();
+	rxIrqPin = pin;
+	rxRingTail = rxRingHead;
+	rxHeaderPtr = nextPacketPtr;
+	rxIrqEnabled = 1;
+	irq_register_handler(ENC28J60_GpioInterrupt, AVR32_GPIO_IRQ_0 + (pin / 8), ENC28J60_INT_IRQ_LEVEL);
+	gpio_enable_pin_interrupt(pin, GPIO_FALLING_EDGE);
+	// queue the packets received so far and arm INT
+	rxIrqPending = 1;
+	ENC28J60_Unlock();
+}
+
+// Sets the function the interrupt routine calls when it has queued packets,
+// 0 for none. It runs in the interrupt and must not call the driver.
+void ENC28J60_SetReceiveCallback(enc28j60_receive_callback_t callback)
+{
+	rxCallback = callback;
+}
+
+// Returns the number of received packets queued by the interrupt routine
+uint8_t ENC28J60_PacketsQueued(void)
+{
+	return (uint8_t)(rxRingHead - rxRingTail);
+}
+
+// Frees the receive buffer space of the packet opened by ENC28J60_PacketPeek.
+void ENC28J60_PacketDiscard(void)
+{
+	if(!packetOpen){
+		return;
+	}
+	ENC28J60_Lock();
+	packetOpen = 0;
+	// Move the RX read pointer to the start of the next received packet
+	// This frees the memory of the packet
+	ENC28J60_Write(ERXRDPTL, (nextPacketPtr)&0xFF);
+	ENC28J60_Write(ERXRDPTH, (nextPacketPtr)>>8);
+	rxReadPtr = nextPacketPtr;
+	// decrement the packet counter indicate we are done with this packet
+	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+	// queue packets which did not fit into the ring, or arm INT again
+	if(rxIrqEnabled && rxRingHead == rxRingTail){
+		ENC28J60_DrainReceive();
+	}
+	ENC28J60_Unlock();
+}
+
+static uint16_t ENC28J60_OpenPacket(uint16_t headerLen, uint8_t* packet)
+{
+	enc28j60_rx_descriptor_t *descriptor;
+	uint8_t header[6];
+	uint8_t count;
+	uint16_t rxstat;
+	uint16_t len;
+
+	if(rxIrqEnabled){
+		// the interrupt routine has already read the receive status vector
+		if(rxRingHead == rxRingTail){
+			return(0);
+		}
+		descriptor = &rxRing[rxRingTail & (ENC28J60_RX_DESCRIPTORS - 1)];
+		packetStart = descriptor->start;
+		nextPacketPtr = descriptor->next;
+		len = descriptor->length;
+		rxstat = descriptor->status;
+		rxRingTail++;
+	}else{
+		// check if a packet has been received and buffered
+		//if( !(enc28j60Read(EIR) & EIR_PKTIF) ){
+	        // The above does not work. See Rev. B4 Silicon Errata point 6.
+		count = ENC28J60_Read(EPKTCNT);
+		if( count ==0 ){
+			return(0);
+	        }
+		ENC28J60_NotePacketCount(count, 1);
+
+		// Set the read pointer to the start of the received packet
+		packetStart = nextPacketPtr;
+		ENC28J60_Write(ERDPTL, (nextPacketPtr)&0xFF);
+		ENC28J60_Write(ERDPTH, (nextPacketPtr)>>8);
+		// Read the next packet pointer, the packet length and the receive status
+		// (see datasheet page 43) and the first bytes of the packet in one RBM transaction.
+		ENC28J60_OpenBufferTransfer(ENC28J60_READ_BUF_MEM, 0);
+		spi_read_packet(avr32SPI, header, sizeof(header));
+		ENC28J60_CacheAdvancePointer(ERDPTL, sizeof(header));
+		nextPacketPtr = header[0] | (header[1]<<8);
+		ENC28J60_NoteReceiveUse(nextPacketPtr);
+		len = header[2] | (header[3]<<8);
+	        len-=4; //remove the CRC count
+		rxstat = header[4] | (header[5]<<8);
+	}
+	packetOpen = 1;
+        // check CRC and symbol errors (see datasheet page 44, table 7-3):
+        // The ERXFCON.CRCEN is set by default. Normally we should not
+        // need to check this.
+        if ((rxstat & 0x80)==0){
+                // invalid
+                NET_STATS_INC(rxCrcErrors);
+                if(!rxIrqEnabled){
+                        ENC28J60_FinishBufferTransfer();
+                }
+                ENC28J60_PacketDiscard();
+                return(0);
         }
+	packetLength = len;
+	NET_STATS_INC(rxFrames);
+	NET_STATS_ADD(rxOctets, len);
+	if (headerLen>len){
+		headerLen=len;
+	}
+	if(rxIrqEnabled){
+		ENC28J60_PacketRead(0, headerLen, packet);
+	}else{
+		ENC28J60_ContinueBufferTransfer(ENC28J60_READ_BUF_MEM, headerLen, packet);
+		ENC28J60_WaitBufferTransfer();
+	}
+	return(len);
+}
+
+// Opens the next packet in the network receive buffer, if one is available,
+// and reads its first bytes. The packet will by headed by an ethernet header.
+// The packet stays in the receive buffer until ENC28J60_PacketDiscard is
+// called (or the next packet is opened), so the rest of it can be read with
+// ENC28J60_PacketRead or dropped without copying it.
+//      headerLen  Number of bytes to read right away.
+//      packet     Pointer where these bytes should be stored.
+// Returns: Length of the whole packet in bytes if a packet was opened, zero otherwise.
+uint16_t ENC28J60_PacketPeek(uint16_t headerLen, uint8_t* packet)
+{
+	uint16_t len;
+
+	Profile_Begin(PROFILE_RX);
+	ENC28J60_Lock();
+	ENC28J60_PacketDiscard();
+	Profile_Begin(PROFILE_TX);
+	ENC28J60_ServiceTransmit();
+	Profile_End(PROFILE_TX);
+	len = ENC28J60_OpenPacket(headerLen, packet);
+	ENC28J60_Unlock();
+	Profile_End(PROFILE_RX);
+	return(len);
+}
+
+// Reads bytes of the packet opened by ENC28J60_PacketPeek.
+// Consecutive reads do not need to move the read pointer.
+//      offset  Position in the packet, 0 is the start of the ethernet header.
+//      len     Number of bytes to read.
+//      data    Pointer where the bytes should be stored.
+// Returns: Number of bytes read, less than len at the end of the packet.
+uint16_t ENC28J60_PacketRead(uint16_t offset, uint16_t len, uint8_t* data)
+{
+	uint16_t address;
+
+	if(!packetOpen || offset>=packetLength){
+		return(0);
+	}
+	if (len>packetLength-offset){
+		len=packetLength-offset;
+	}
+	// skip the receive status vector, the packet may wrap at the end of the receive buffer
+	address = packetStart + 6 + offset;
+	if (address>rxBufferEnd){
+		address = address - (rxBufferEnd + 1) + RXSTARTBUFFER;
+	}
+	Profile_Begin(PROFILE_RX);
+	ENC28J60_Lock();
+	ENC28J60_Write(ERDPTL, address&0xFF);
+	ENC28J60_Write(ERDPTH, address>>8);
+	ENC28J60_ReadBufferAsync(len, data, 0);
+	ENC28J60_WaitBufferTransfer();
+	ENC28J60_Unlock();
+	Profile_End(PROFILE_RX);
+	return(len);
 }
 
 // Gets a packet from the network receive buffer, if one is available.
@@ -282,48 +1511,18 @@ void ENC28J60_PacketSend(uint16_t len, uint8_t* packet)
 // Returns: Packet length in bytes if a packet was retrieved, zero otherwise.
 uint16_t ENC28J60_PacketReceived(uint16_t maxlen, uint8_t* packet)
 {
-	uint16_t rxstat;
 	uint16_t len;
-	// check if a packet has been received and buffered
-	//if( !(enc28j60Read(EIR) & EIR_PKTIF) ){
-        // The above does not work. See Rev. B4 Silicon Errata point 6.
-	if( ENC28J60_Read(EPKTCNT) ==0 ){
-		return(0);
-        }
 
-	// Set the read pointer to the start of the received packet
-	ENC28J60_Write(ERDPTL, (nextPacketPtr));
-	ENC28J60_Write(ERDPTH, (nextPacketPtr)>>8);
-	// read the next packet pointer
-	nextPacketPtr  = ENC28J60_ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	nextPacketPtr |= ENC28J60_ReadOp(ENC28J60_READ_BUF_MEM, 0)<<8;
-	// read the packet length (see datasheet page 43)
-	len  = ENC28J60_ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	len |= ENC28J60_ReadOp(ENC28J60_READ_BUF_MEM, 0)<<8;
-        len-=4; //remove the CRC count
-	// read the receive status (see datasheet page 43)
-	rxstat  = ENC28J60_ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	rxstat |= ENC28J60_ReadOp(ENC28J60_READ_BUF_MEM, 0)<<8;
+	len = ENC28J60_PacketPeek(maxlen-1, packet);
 	// limit retrieve length
         if (len>maxlen-1){
+                NET_STATS_INC(rxTruncated);
                 len=maxlen-1;
         }
-        // check CRC and symbol errors (see datasheet page 44, table 7-3):
-        // The ERXFCON.CRCEN is set by default. Normally we should not
-        // need to check this.
-        if ((rxstat & 0x80)==0){
-                // invalid
-                len=0;
-        }else{
-                // copy the packet from the receive buffer
-                ENC28J60_ReadBuffer(len, packet);
-        }
-	// Move the RX read pointer to the start of the next received packet
-	// This frees the memory we just read out
-	ENC28J60_Write(ERXRDPTL, (nextPacketPtr));
-	ENC28J60_Write(ERXRDPTH, (nextPacketPtr)>>8);
-	// decrement the packet counter indicate we are done with this packet
-	ENC28J60_WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+	if (len){
+		packet[len]='\0';
+	}
+	ENC28J60_PacketDiscard();
 	return(len);
 }
 
@@ -14,11 +14,25 @@
 #define ENC28J60_H
 #include <inttypes.h>
 #include <spi_master.h>
+#include "EtherShield/Buffer/pbuf.h"
 
 // Wrap the method names to be module independent
 #define Module_Init           ENC28J60_Init
 #define Module_ClkOut         ENC28J60_Clkout
 #define Module_PacketReceived ENC28J60_PacketReceived
+#define Module_PacketPeek     ENC28J60_PacketPeek
+#define Module_PacketRead     ENC28J60_PacketRead
+#define Module_PacketDiscard  ENC28J60_PacketDiscard
+#define Module_EnableInterrupt ENC28J60_EnableInterrupt
+#define Module_SetReceiveCallback ENC28J60_SetReceiveCallback
+#define Module_PacketsQueued  ENC28J60_PacketsQueued
+#define Module_ServiceTransmit ENC28J60_ServiceTransmit
+#define Module_PacketSendPbuf ENC28J60_PacketSendPbuf
+#define Module_PacketSendV    ENC28J60_PacketSendV
+#define Module_SetTransmitBufferSize ENC28J60_SetTransmitBufferSize
+#define Module_SetChecksumOffload ENC28J60_SetChecksumOffload
+#define Module_SetHashFilter  ENC28J60_SetHashFilter
+#define Module_SetBroadcastFilter ENC28J60_SetBroadcastFilter
 
 /************************************************************************/
 /* ENC28J60 CONTROL REGISTER MAP                                        */
@@ -350,7 +364,8 @@ The Ethernet buffer contains transmit and receive memory used by the Ethernet co
 The sizes and locations of transmit and receive memory are fully programmable by the host controller using the SPI interface.
 */
 
-// Change this if you need more RX buffer
+// Default size of the TX buffer, the RX buffer gets the rest (the name is historical).
+// ENC28J60_SetTransmitBufferSize selects another split before ENC28J60_Init.
 #define RX_BUFFER_SIZE    0x0600
 // Const not changeable
 #define ENC28J80_TOTAL_BUFFER_SIZE       0x1FFF
@@ -362,11 +377,237 @@ The sizes and locations of transmit and receive memory are fully programmable by
 // Max frame length
 #define MAX_FRAMELEN      1518
 
+/************************************************************************/
+/* Buffer memory transfers                                              */
+/************************************************************************/
+/*
+READ_BUF_MEM and WRITE_BUF_MEM transfers of at least ENC28J60_PDCA_MIN_LEN bytes are moved by the
+PDCA (Peripheral DMA Controller) at SPI line rate. Reads use two channels: the TX channel clocks out
+the destination buffer itself (the chip ignores MOSI during READ_BUF_MEM) and the RX channel stores
+the answer. Writes only need the TX channel. The chip select is released from the PDCA interrupt,
+then the completion callback runs (in interrupt context). ENC28J60_Init registers the PDCA
+handlers with the INTC, so the INTC must be set up (irq_initialize_vectors) before ENC28J60_Init.
+While the interrupts are masked (cpu_irq_disable, or before cpu_irq_enable), ENC28J60_WaitBufferTransfer
+and the blocking calls built on it complete the transfer by polling the PDCA; an asynchronous transfer
+then only calls its callback from there.
+Shorter transfers, and host builds without a PDCA, use the polled SPI service.
+*/
+#ifndef ENC28J60_USE_PDCA
+# ifdef AVR32_PDCA_ADDRESS
+#  define ENC28J60_USE_PDCA        1
+# else
+#  define ENC28J60_USE_PDCA        0
+# endif
+#endif
+#define ENC28J60_PDCA_MIN_LEN      16
+#define ENC28J60_PDCA_RX_CHANNEL   0
+#define ENC28J60_PDCA_TX_CHANNEL   1
+#define ENC28J60_PDCA_IRQ_LEVEL    0
+#ifndef ENC28J60_PDCA_PID_RX
+# define ENC28J60_PDCA_PID_RX      AVR32_PDCA_PID_SPI0_RX
+#endif
+#ifndef ENC28J60_PDCA_PID_TX
+# define ENC28J60_PDCA_PID_TX      AVR32_PDCA_PID_SPI0_TX
+#endif
+
+// Called when a buffer memory transfer has completed
+typedef void (*enc28j60_transfer_callback_t)(void);
+
+/************************************************************************/
+/* Register cache and batched register writes                           */
+/************************************************************************/
+/*
+The driver keeps a shadow copy of the control registers which only change when the host writes them
+(buffer layout, filters, MAC setup, MAC address). Reads of these registers are served from the shadow and
+writes of an unchanged value are skipped. ERDPT and EWRPT are tracked across buffer memory accesses
+(ECON2.AUTOINC is never cleared by this driver). Bank switches only touch the BSEL bits which change.
+ENC28J60_WriteRegisters writes a list of registers grouped by bank, starting with the selected bank.
+Entries of the same bank keep their order, so the low byte of a pointer is always written first
+(see ENC28J60_POINTER). Writes which must happen in a given order across banks need separate lists.
+*/
+typedef struct
+{
+  uint8_t address;
+  uint8_t data;
+} enc28j60_register_write_t;
+
+// Both bytes of a 16 bit pointer register pair, low byte first
+#define ENC28J60_POINTER(addressL, value) \
+  {(addressL), (value) & 0xFF}, {(addressL) + 1, ((value) >> 8) & 0xFF}
+
+/************************************************************************/
+/* Transmit queue                                                       */
+/************************************************************************/
+/*
+The transmit buffer (ETXST of the buffer layout up to TXSTOP_INIT) holds up to ENC28J60_TX_SLOTS packets, each followed by
+the transmit status vector the chip writes behind it. ENC28J60_PacketSend copies the next packet into a
+free part of the buffer while the previous one is still on the wire. ETXST/ETXND are only moved after the
+chip has finished the previous packet (EIR.TXIF or EIR.TXERIF). ENC28J60_ServiceTransmit starts queued
+packets; PacketSend and PacketPeek call it, a program which sends without receiving has to call it too.
+It returns the number of packets still queued, so an event driven program knows when to call it again.
+A packet aborted by a late collision is sent again up to ENC28J60_TX_RETRIES times.
+ENC28J60_PacketSendPbuf takes a buffer of the pool (EtherShield/Buffer/pbuf.h) instead of copying from the
+caller: while the transmit buffer has no room it waits in a software queue of ENC28J60_TX_QUEUE buffers
+and the call returns. ENC28J60_ServiceTransmit moves queued buffers into the transmit buffer as packets
+leave and returns them to the pool; packets go out in the order they were queued either way. Only a full
+software queue makes the sender wait.
+*/
+#define ENC28J60_TX_SLOTS          2
+#define ENC28J60_TX_RETRIES        3
+#define ENC28J60_TSV_LEN           7
+#ifndef ENC28J60_TX_QUEUE
+# define ENC28J60_TX_QUEUE         4
+#endif
+
+/************************************************************************/
+/* Scatter-gather transmit                                              */
+/************************************************************************/
+/*
+ENC28J60_PacketSendV takes a packet as a list of fragments, e.g. the headers in RAM and the body in RAM or
+in the internal flash, and writes the per-packet control byte and the fragments one after the other in a
+single buffer memory write (one chip select). Nothing is staged in RAM. All but the last fragment are moved
+by the CPU, the last one, normally the body, by the PDCA if ENC28J60_USE_PDCA is set and it is long
+enough. A buffer of the pool is sent the same way: its payload, then its tail (see pbuf.h).
+*/
+typedef struct
+{
+  const uint8_t *data;
+  uint16_t len;
+} enc28j60_iovec_t;
+
+// A buffer in the software transmit queue
+typedef struct
+{
+  pbuf_t *p;
+  uint16_t sumStart;         // checksummed range, see ENC28J60_PacketSendWithChecksum,
+  uint16_t sumLen;           // 0 if the checksum is set
+  uint16_t checksumPos;
+  uint16_t initialSum;
+} enc28j60_tx_request_t;
+
+/************************************************************************/
+/* Receive filters                                                      */
+/************************************************************************/
+/*
+ENC28J60_Init accepts unicast frames for our MAC address (ERXFCON.UCEN) and, with the pattern match
+filter, ARP broadcasts; frames with a bad CRC are dropped. Frames a filter rejects never reach the
+receive buffer and cost no SPI transfer. The filters are ORed and can be changed at run time:
+ENC28J60_SetHashFilter programs the 64 bit hash table (EHT0..EHT7) from a list of destination MAC
+addresses, e.g. the multicast groups of mDNS or IGMP. Addresses share the 64 bits, so a few other
+destinations get through as well and still have to be checked in software.
+ENC28J60_SetPatternFilter programs the single pattern match window: up to 64 bytes from an offset in
+the frame, selected by a mask. ENC28J60_SetBroadcastFilter uses it for broadcasts of one ethertype;
+with more than one type all broadcasts are accepted (ERXFCON.BCEN).
+*/
+
+/************************************************************************/
+/* Checksum offload                                                     */
+/************************************************************************/
+/*
+ENC28J60_PacketSendWithChecksum copies a packet into the transmit buffer, has the DMA controller compute
+the IP checksum of a range of it (ECON1.CSUMEN), adds the pseudo header fields that are not part of the
+range and writes the result into the checksum field in the buffer before the packet is queued. The DMA
+reads the buffer at about two clocks per byte while the driver polls ECON1.DMAST, so the gain is the
+software loop over the payload on the MCU, at the price of a few register accesses per packet.
+With ENC28J60_CHECKSUM_OFFLOAD set to 0, or after ENC28J60_SetChecksumOffload(0), the function returns
+0 and sends nothing, and the caller computes the checksum in software.
+*/
+#ifndef ENC28J60_CHECKSUM_OFFLOAD
+# define ENC28J60_CHECKSUM_OFFLOAD 1
+#endif
+
+/************************************************************************/
+/* Interrupt driven receive                                             */
+/************************************************************************/
+/*
+After ENC28J60_EnableInterrupt a falling edge on the INT pin runs a GPIO interrupt routine. It reads the
+receive status vector of every new packet into a descriptor ring (one producer, the interrupt side, and
+one consumer, ENC28J60_PacketPeek); the packet itself stays in the receive buffer. PacketPeek then takes
+the oldest descriptor without polling EPKTCNT and returns zero without any bus traffic when none is queued.
+EIR.PKTIF stays set until every packet has been released, so EIE.INTIE is cleared while descriptors are
+queued and set again once the ring is empty; a packet which arrived meanwhile pulls INT low at once.
+An interrupt which comes in while a driver call is using the bus is deferred until that call returns.
+The ring holds ENC28J60_RX_DESCRIPTORS entries (a power of 2). The function set with
+ENC28J60_SetReceiveCallback is called on the interrupt side whenever packets are queued, e.g. to post
+an event; it must not call the driver.
+*/
+#define ENC28J60_RX_DESCRIPTORS    8
+#define ENC28J60_INT_IRQ_LEVEL     0
+
+typedef struct
+{
+  uint16_t start;   // address of the receive status vector
+  uint16_t next;    // next packet pointer
+  uint16_t length;  // packet length without CRC
+  uint16_t status;  // receive status bits 16..31
+} enc28j60_rx_descriptor_t;
+
+// Called by the interrupt side when received packets are queued
+typedef void (*enc28j60_receive_callback_t)(void);
+
+/************************************************************************/
+/* Buffer layout and statistics                                         */
+/************************************************************************/
+/*
+ENC28J60_SetTransmitBufferSize moves the split between the receive ring (from RXSTARTBUFFER) and the
+transmit buffer (up to TXSTOP_INIT); it takes effect with the next ENC28J60_Init. The size is rounded
+down to an even number and limited so that the receive ring holds a frame of the maximum length.
+ENC28J60_PacketSend drops packets which do not fit into a small transmit buffer.
+With ENC28J60_BUFFER_STATS the driver records how full the receive ring gets: EPKTCNT is sampled
+whenever it is read anyway, EIR.RXERIF (a packet was lost because the ring or EPKTCNT was full) is
+checked and cleared at the same time, and the used part of the ring is taken from the packets already
+known or, with a backlog of packets, from ERXWRPT. This costs one register read per received packet,
+three with a backlog.
+*/
+#ifndef ENC28J60_BUFFER_STATS
+# define ENC28J60_BUFFER_STATS     1
+#endif
+#define ENC28J60_MIN_RX_SIZE       0x0600
+#define ENC28J60_MIN_TX_SIZE       0x0100
+
+typedef struct
+{
+  uint16_t rxSize;           // bytes in the receive ring
+  uint16_t txSize;           // bytes in the transmit buffer
+  uint16_t rxHighWater;      // most bytes seen in use in the receive ring
+  uint8_t packetCountPeak;   // highest EPKTCNT seen
+  uint32_t rxOverflows;      // EIR.RXERIF events
+  uint32_t txDropped;        // packets which did not fit into the transmit buffer
+} enc28j60_buffer_stats_t;
+
 // Public Methods
 void ENC28J60_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_t spiFlags, uint32_t spiBaudrate, uint8_t* macaddr);
 void ENC28J60_Clkout(uint8_t clk);
 void ENC28J60_PhyRegisterWrite(uint8_t address, uint16_t data);
 uint16_t ENC28J60_PacketReceived(uint16_t maxlen, uint8_t* packet);
+uint16_t ENC28J60_PacketPeek(uint16_t headerLen, uint8_t* packet);
+uint16_t ENC28J60_PacketRead(uint16_t offset, uint16_t len, uint8_t* data);
+void ENC28J60_PacketDiscard(void);
+void ENC28J60_EnableInterrupt(uint32_t pin);
+void ENC28J60_SetReceiveCallback(enc28j60_receive_callback_t callback);
+uint8_t ENC28J60_PacketsQueued(void);
 void ENC28J60_PacketSend(uint16_t len, uint8_t* packet);
+uint8_t ENC28J60_ServiceTransmit(void);
+uint8_t ENC28J60_PacketSendWithChecksum(uint16_t len, uint8_t* packet, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum);
+void ENC28J60_PacketSendV(const enc28j60_iovec_t *iov, uint8_t count);
+uint8_t ENC28J60_PacketSendVWithChecksum(const enc28j60_iovec_t *iov, uint8_t count, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum);
+void ENC28J60_PacketSendPbuf(pbuf_t *p);
+uint8_t ENC28J60_PacketSendPbufWithChecksum(pbuf_t *p, uint16_t sumStart,
+		uint16_t sumLen, uint16_t checksumPos, uint16_t initialSum);
+void ENC28J60_SetChecksumOffload(uint8_t enable);
+void ENC28J60_SetHashFilter(const uint8_t (*addresses)[6], uint8_t count);
+void ENC28J60_SetPatternFilter(uint16_t offset, const uint8_t *mask, const uint8_t *pattern);
+void ENC28J60_SetBroadcastFilter(const uint16_t *types, uint8_t count);
+void ENC28J60_ReadBufferAsync(uint16_t len, uint8_t* data, enc28j60_transfer_callback_t callback);
+void ENC28J60_WriteBufferAsync(uint16_t len, const uint8_t* data, enc28j60_transfer_callback_t callback);
+uint8_t ENC28J60_IsBufferTransferBusy(void);
+void ENC28J60_WaitBufferTransfer(void);
+void ENC28J60_WriteRegisters(const enc28j60_register_write_t *writes, uint8_t count);
+void ENC28J60_InvalidateRegisterCache(void);
+void ENC28J60_SetTransmitBufferSize(uint16_t size);
+void ENC28J60_GetBufferStatistics(enc28j60_buffer_stats_t *stats);
+void ENC28J60_ResetBufferStatistics(void);
 
 #endif
@@ -0,0 +1,172 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Packet path profiling, see profile.h
+ *
+ * The open stages are kept on a small stack. When a stage ends its cycles
+ * are added to the time spent in stages inside the one below it, which
+ * subtracts them from its own sample.
+ *********************************************/
+
+#include <avr32/io.h>
+#include <string.h>
+#include "compiler.h"
+#include "EtherShield/TransportLayer/net.h"
+#include "EtherShield/TransportLayer/transport_layer.h"
+#include "EtherShield/Profile/profile.h"
+
+#ifdef ETHERSHIELD_PROFILE
+
+typedef struct
+{
+  uint8_t stage;
+  uint8_t reentered;         // Profile_Begin calls of the same stage inside it
+  uint32_t start;
+  uint32_t inner;            // cycles of the stages inside it
+} profile_frame_t;
+
+static profile_stage_t stages[PROFILE_STAGES];
+static profile_frame_t stack[PROFILE_STAGES];
+static uint8_t depth = 0;
+static uint8_t reply[4 * (4 + PROFILE_BUCKETS)];
+
+static uint32_t Cycles(void)
+{
+  return Get_system_register(AVR32_COUNT);
+}
+
+static void Record(profile_stage_t *s, uint32_t cycles)
+{
+  uint8_t bucket = 0;
+  uint32_t limit = cycles >> PROFILE_BUCKET_SHIFT;
+
+  if (s->count == 0 || cycles < s->min){
+    s->min = cycles;
+  }
+  if (cycles > s->max){
+    s->max = cycles;
+  }
+  s->count++;
+  s->total += cycles;
+  while (limit && bucket < PROFILE_BUCKETS - 1){
+    limit >>= 1;
+    bucket++;
+  }
+  s->histogram[bucket]++;
+}
+
+/************************************************************************/
+/* Starts a sample of stage.                                            */
+/************************************************************************/
+void Profile_Begin(uint8_t stage)
+{
+  profile_frame_t *f;
+
+  if (depth && stack[depth-1].stage == stage){
+    stack[depth-1].reentered++;
+    return;
+  }
+  if (depth == PROFILE_STAGES){
+    return;
+  }
+  f = &stack[depth++];
+  f->stage = stage;
+  f->reentered = 0;
+  f->inner = 0;
+  f->start = Cycles();
+}
+
+/************************************************************************/
+/* Ends the sample of stage started last.                               */
+/************************************************************************/
+void Profile_End(uint8_t stage)
+{
+  uint32_t cycles = Cycles();
+  profile_frame_t *f;
+
+  if (depth == 0 || stack[depth-1].stage != stage){
+    return;
+  }
+  f = &stack[depth-1];
+  if (f->reentered){
+    f->reentered--;
+    return;
+  }
+  cycles -= f->start;
+  depth--;
+  if (depth){
+    stack[depth-1].inner += cycles;
+  }
+  Record(&stages[stage], cycles - f->inner);
+}
+
+/************************************************************************/
+/* Returns the numbers of a stage.                                      */
+/************************************************************************/
+const profile_stage_t *Profile_Get(uint8_t stage)
+{
+  return &stages[stage];
+}
+
+/************************************************************************/
+/* Clears the numbers of all stages.                                    */
+/************************************************************************/
+void Profile_Reset(void)
+{
+  memset(stages, 0, sizeof(stages));
+}
+
+static uint8_t *Put(uint8_t *p, uint32_t value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+  return p + 4;
+}
+
+static uint8_t *PutSummary(uint8_t *p, const profile_stage_t *s)
+{
+  p = Put(p, s->count);
+  p = Put(p, s->min);
+  p = Put(p, s->count ? (uint32_t)(s->total / s->count) : 0);
+  return Put(p, s->max);
+}
+
+/************************************************************************/
+/* Answers a request to PROFILE_PORT, see profile.h. buf must hold an   */
+/* IP packet for us. Returns 1 if it was a request.                     */
+/************************************************************************/
+uint8_t Profile_Serve(uint8_t *buf, uint16_t len)
+{
+  uint8_t *p = reply;
+  uint16_t port;
+  uint8_t i;
+
+  if (len < UDP_DATA_P || buf[IP_PROTO_P] != IP_PROTO_UDP_V ||
+      (buf[UDP_DST_PORT_H_P]<<8 | buf[UDP_DST_PORT_L_P]) != PROFILE_PORT){
+    return 0;
+  }
+  if ((buf[UDP_LEN_H_P]<<8 | buf[UDP_LEN_L_P]) > UDP_HEADER_LEN && buf[UDP_DATA_P] < PROFILE_STAGES){
+    const profile_stage_t *s = &stages[buf[UDP_DATA_P]];
+    p = PutSummary(p, s);
+    for (i=0; i<PROFILE_BUCKETS; i++){
+      p = Put(p, s->histogram[i]);
+    }
+  }else{
+    for (i=0; i<PROFILE_STAGES; i++){
+      p = PutSummary(p, &stages[i]);
+    }
+    if ((buf[UDP_LEN_H_P]<<8 | buf[UDP_LEN_L_P]) > UDP_HEADER_LEN && buf[UDP_DATA_P] == PROFILE_RESET){
+      Profile_Reset();
+    }
+  }
+  // back from our port to the port of the sender
+  port = buf[UDP_SRC_PORT_H_P]<<8 | buf[UDP_SRC_PORT_L_P];
+  buf[UDP_SRC_PORT_H_P] = PROFILE_PORT >> 8;
+  buf[UDP_SRC_PORT_L_P] = PROFILE_PORT & 0xff;
+  UDP_SendPacket(buf, (char *)reply, p - reply, port);
+  return 1;
+}
+
+#endif /* ETHERSHIELD_PROFILE */
@@ -0,0 +1,72 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Packet path profiling
+ *
+ * Timestamps the stages every packet goes through with the cycle counter
+ * of the CPU (the COUNT system register) and keeps the number, minimum,
+ * average, maximum and a histogram of the cycles per stage. Compiled in
+ * with ETHERSHIELD_PROFILE, otherwise the hooks are empty.
+ *
+ * Stages nest: a stage which runs inside another one, like the transmit
+ * of a reply while it is built, is counted for itself and taken out of
+ * the outer stage. A stage entered again inside itself is one sample.
+ *
+ * Profile_Serve answers UDP requests to PROFILE_PORT, all numbers are 32bit
+ * big endian:
+ *   empty request     count, min, avg, max of every stage
+ *   one byte n        count, min, avg, max and the PROFILE_BUCKETS
+ *                     histogram counts of stage n
+ *   PROFILE_RESET     the summary like the empty request, then all
+ *                     stages are cleared
+ * Bucket 0 counts samples below 2^PROFILE_BUCKET_SHIFT cycles, bucket i
+ * those below 2^(PROFILE_BUCKET_SHIFT+i), the last one all longer ones.
+ *
+ * The host build has a stand-in for the cycle counter, see
+ * host/include/compiler.h.
+ *********************************************/
+//@{
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdint.h>
+
+#define PROFILE_RX                0   // reading received packets from the chip
+#define PROFILE_CLASSIFY          1   // ARP and IP checks
+#define PROFILE_CHECKSUM          2   // TCP/UDP checksums, software or DMA
+#define PROFILE_BUILD             3   // building replies and segments
+#define PROFILE_TX                4   // writing packets to the chip and starting them
+#define PROFILE_STAGES            5
+
+#ifndef PROFILE_PORT
+# define PROFILE_PORT             7007
+#endif
+#define PROFILE_RESET             0xff
+
+#define PROFILE_BUCKETS           16
+#define PROFILE_BUCKET_SHIFT      4
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+  uint32_t histogram[PROFILE_BUCKETS];
+} profile_stage_t;
+
+#ifdef ETHERSHIELD_PROFILE
+extern void Profile_Begin(uint8_t stage);
+extern void Profile_End(uint8_t stage);
+extern const profile_stage_t *Profile_Get(uint8_t stage);
+extern void Profile_Reset(void);
+extern uint8_t Profile_Serve(uint8_t *buf, uint16_t len);
+#else
+# define Profile_Begin(stage)     ((void)0)
+# define Profile_End(stage)       ((void)0)
+# define Profile_Get(stage)       ((const profile_stage_t *)0)
+# define Profile_Reset()          ((void)0)
+# define Profile_Serve(buf, len)  0
+#endif
+
+#endif /* PROFILE_H */
+//@}
@@ -0,0 +1,156 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Static resources, see static_resource.h
+ *
+ * Storing a response erases its slot, programs the name, the length and
+ * the data, sums the data back from the flash and programs the sums, and
+ * programs the magic last. The erased slot reads as 0xff, a write without
+ * erase then only clears bits, so every page of the slot is erased once.
+ *********************************************/
+
+#include <avr32/io.h>
+#include <string.h>
+#include "compiler.h"
+#include "flashc.h"
+#include "EtherShield/TransportLayer/net.h"
+#include "EtherShield/TransportLayer/transport_layer.h"
+#include "EtherShield/TransportLayer/tcp_connection.h"
+#include "EtherShield/Resource/static_resource.h"
+
+#define CHUNK           STATIC_RESOURCE_CHUNK
+
+// a slot takes whole flash pages
+typedef struct
+{
+  static_resource_t resource;
+} __attribute__((__aligned__(AVR32_FLASHC_PAGE_SIZE))) slot_t;
+
+#if defined(__AVR32__)
+__attribute__((__section__(".flash_nvram")))
+#endif
+static slot_t store[STATIC_RESOURCE_SLOTS];
+// the resource queued on each connection, for Checksum
+static const static_resource_t *serving[TCP_MAX_CONNECTIONS];
+
+static uint16_t Fold(uint32_t sum)
+{
+  while (sum>>16){
+    sum = (sum & 0xFFFF)+(sum >> 16);
+  }
+  return (uint16_t)sum;
+}
+
+static uint8_t Valid(const static_resource_t *r)
+{
+  return r->magic == STATIC_RESOURCE_MAGIC;
+}
+
+/************************************************************************/
+/* Stores the response of len bytes at data under path, replacing the   */
+/* one stored under path before, and returns it in the flash. Returns 0 */
+/* if it is too long or all slots are taken. A response must not be     */
+/* stored again while a connection sends it.                            */
+/************************************************************************/
+const static_resource_t *StaticResource_Store(const char *path, const uint8_t *data, uint16_t len)
+{
+  static_resource_t *r = (static_resource_t *)StaticResource_Find(path);
+  char name[STATIC_RESOURCE_PATH_LEN];
+  uint16_t sums[STATIC_RESOURCE_DATA_SIZE / CHUNK + 1];
+  uint32_t magic = STATIC_RESOURCE_MAGIC;
+  uint16_t i;
+  uint8_t n;
+
+  if (len > STATIC_RESOURCE_DATA_SIZE || strlen(path) >= STATIC_RESOURCE_PATH_LEN){
+    return 0;
+  }
+  if (r && r->len == len && memcmp(r->data, data, len) == 0){
+    // unchanged, the flash is not written
+    return r;
+  }
+  for (n=0; !r && n<STATIC_RESOURCE_SLOTS; n++){
+    if (!Valid(&store[n].resource)){
+      r = &store[n].resource;
+    }
+  }
+  if (!r){
+    return 0;
+  }
+  memset(name, 0, sizeof(name));
+  strcpy(name, path);
+  flashc_memset8(r, 0xff, sizeof(slot_t), true);
+  flashc_memcpy(r->path, name, sizeof(name), false);
+  flashc_memcpy(&r->len, &len, sizeof(len), false);
+  flashc_memcpy(r->data, data, len, false);
+  // running sums of what is in the flash now
+  sums[0] = 0;
+  for (i=0; i<len/CHUNK; i++){
+    sums[i+1] = Fold((uint32_t)sums[i] + IP_ChecksumAdd(&r->data[i*CHUNK], CHUNK));
+  }
+  flashc_memcpy(r->sums, sums, (len/CHUNK + 1) * sizeof(sums[0]), false);
+  flashc_memcpy(&r->magic, &magic, sizeof(magic), false);
+  return r;
+}
+
+/************************************************************************/
+/* Returns the response stored under path, or 0.                        */
+/************************************************************************/
+const static_resource_t *StaticResource_Find(const char *path)
+{
+  uint8_t n;
+
+  for (n=0; n<STATIC_RESOURCE_SLOTS; n++){
+    if (Valid(&store[n].resource) &&
+        strncmp(store[n].resource.path, path, STATIC_RESOURCE_PATH_LEN) == 0){
+      return &store[n].resource;
+    }
+  }
+  return 0;
+}
+
+/************************************************************************/
+/* Returns the IP_ChecksumAdd sum of len bytes of the response from     */
+/* offset on. Only the bytes before the first and behind the last whole */
+/* chunk are read, the chunks in between are the difference of their    */
+/* running sums.                                                        */
+/************************************************************************/
+uint16_t StaticResource_Sum(const static_resource_t *resource, uint32_t offset, uint16_t len)
+{
+  uint32_t end = offset + len;
+  uint16_t first = (offset + CHUNK - 1) / CHUNK;
+  uint16_t last = end / CHUNK;
+  uint16_t head = first * CHUNK - offset;
+  uint16_t sum;
+
+  if (first >= last){
+    // no whole chunk
+    return IP_ChecksumAdd(&resource->data[offset], len);
+  }
+  // one's complement difference, then the bytes behind the last chunk
+  sum = Fold((uint32_t)resource->sums[last] + (uint16_t)~resource->sums[first]);
+  sum = Fold((uint32_t)sum + IP_ChecksumAdd(&resource->data[last * CHUNK], end - last * CHUNK));
+  // behind an odd head these bytes are in the other half of the words
+  if (head & 1){
+    sum = (uint16_t)(sum << 8 | sum >> 8);
+  }
+  return Fold((uint32_t)sum + IP_ChecksumAdd(&resource->data[offset], head));
+}
+
+static uint16_t Checksum(uint8_t id, uint32_t offset, uint16_t len)
+{
+  return StaticResource_Sum(serving[id], offset, len);
+}
+
+/************************************************************************/
+/* Queues the response on TCP connection id, see TCPConnection_Send.    */
+/* Its segments are sent from the flash and checksummed from the sums.  */
+/* Returns the number of bytes queued, 0 if data is still queued.       */
+/************************************************************************/
+uint16_t StaticResource_Serve(uint8_t id, const static_resource_t *resource)
+{
+  if (id >= TCP_MAX_CONNECTIONS || TCPConnection_Queued(id)){
+    return 0;
+  }
+  serving[id] = resource;
+  return TCPConnection_SendSummed(id, resource->data, resource->len, Checksum);
+}
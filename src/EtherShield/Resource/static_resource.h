@@ -0,0 +1,67 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Static resources
+ *
+ * Complete HTTP responses, headers included, kept in the internal flash
+ * and sent from there. A connection queues the response with
+ * StaticResource_Serve and the driver writes every segment of it
+ * straight from the flash into the transmit buffer of the ENC28J60,
+ * behind the headers built in RAM; nothing of it is copied.
+ *
+ * StaticResource_Store writes a response through the flash controller
+ * (flashc) together with the IP_ChecksumAdd sums of its first 0, 1, 2 ...
+ * chunks of STATIC_RESOURCE_CHUNK bytes. The sum of a segment is the
+ * difference of two of these plus the bytes at its edges which are not a
+ * whole chunk, so its checksum does not read the segment again and the
+ * checksum offload of the ENC28J60 is not needed.
+ *
+ * The store is STATIC_RESOURCE_SLOTS slots in the .flash_nvram section,
+ * like the flashc examples of the ASF. Each slot starts on a flash page,
+ * rewriting one never touches the others. A slot only counts once its
+ * magic is written, after the rest, so a reset while writing leaves it
+ * empty. Storing the response a slot already holds does not write the
+ * flash at all, which makes it cheap to store the pages at every start.
+ *********************************************/
+//@{
+#ifndef STATIC_RESOURCE_H
+#define STATIC_RESOURCE_H
+#include <stdint.h>
+
+// slots of the store
+#ifndef STATIC_RESOURCE_SLOTS
+# define STATIC_RESOURCE_SLOTS    4
+#endif
+// largest response in a slot
+#ifndef STATIC_RESOURCE_DATA_SIZE
+# define STATIC_RESOURCE_DATA_SIZE 2048
+#endif
+// bytes per checksum sum, even; a segment sums up to twice this at its edges
+#ifndef STATIC_RESOURCE_CHUNK
+# define STATIC_RESOURCE_CHUNK    32
+#endif
+// longest name, terminator included
+#define STATIC_RESOURCE_PATH_LEN  32
+#define STATIC_RESOURCE_MAGIC     0x53524331
+
+#if STATIC_RESOURCE_CHUNK & 1
+# error "STATIC_RESOURCE_CHUNK must be even"
+#endif
+
+typedef struct
+{
+  uint32_t magic;            // STATIC_RESOURCE_MAGIC once the slot is complete
+  char path[STATIC_RESOURCE_PATH_LEN];
+  uint16_t len;
+  // sums[i] is the IP_ChecksumAdd sum of the first i chunks of data
+  uint16_t sums[STATIC_RESOURCE_DATA_SIZE / STATIC_RESOURCE_CHUNK + 1];
+  uint8_t data[STATIC_RESOURCE_DATA_SIZE];
+} static_resource_t;
+
+extern const static_resource_t *StaticResource_Store(const char *path, const uint8_t *data, uint16_t len);
+extern const static_resource_t *StaticResource_Find(const char *path);
+extern uint16_t StaticResource_Sum(const static_resource_t *resource, uint32_t offset, uint16_t len);
+extern uint16_t StaticResource_Serve(uint8_t id, const static_resource_t *resource);
+
+#endif /* STATIC_RESOURCE_H */
+//@}
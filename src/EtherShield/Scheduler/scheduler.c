@@ -0,0 +1,211 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Cooperative scheduler, see scheduler.h
+ *
+ * The tick interrupt only counts ticks; the wheel is advanced by the loop,
+ * one slot per tick, so a late loop catches up on the missed ticks in
+ * order and the timer lists are never touched by an interrupt.
+ *********************************************/
+
+#include <avr32/io.h>
+#include <string.h>
+#include "compiler.h"
+#include "preprocessor.h"
+#include "interrupt.h"
+#include "EtherShield/Scheduler/scheduler.h"
+
+#if (SCHEDULER_WHEEL_SLOTS & (SCHEDULER_WHEEL_SLOTS - 1)) != 0
+# error "SCHEDULER_WHEEL_SLOTS must be a power of two"
+#endif
+
+#ifndef SLEEP
+// as in the pm driver of the ASF, which is not part of the project
+# define SLEEP(mode)   {__asm__ __volatile__ ("sleep "STRINGZ(mode));}
+#endif
+#ifndef AVR32_PM_SMODE_GMCLEAR_MASK
+# define AVR32_PM_SMODE_GMCLEAR_MASK  0x80
+#endif
+
+static scheduler_timer_t *wheel[SCHEDULER_WHEEL_SLOTS];
+static scheduler_event_handler_t handlers[SCHEDULER_EVENTS];
+static volatile uint32_t ticks = 0;      // written by the tick interrupt only
+static volatile uint32_t pending = 0;    // one bit per posted event
+static uint32_t now = 0;                 // last tick the wheel has run
+static uint32_t tickCycles;
+
+ISR(Scheduler_TickInterrupt, AVR32_CORE_IRQ_GROUP, SCHEDULER_TICK_IRQ_LEVEL)
+{
+  uint32_t compare = Get_system_register(AVR32_COMPARE) + tickCycles;
+  uint32_t count = Get_system_register(AVR32_COUNT);
+
+  ticks++;
+  // ticks missed while the interrupts were masked are counted, a COMPARE
+  // value behind COUNT would only match after COUNT wrapped
+  while ((int32_t)(compare - count) <= 0){
+    compare += tickCycles;
+    ticks++;
+  }
+  // writing COMPARE also clears the interrupt
+  Set_system_register(AVR32_COMPARE, compare);
+}
+
+static void Insert(scheduler_timer_t *timer)
+{
+  scheduler_timer_t **slot = &wheel[timer->expires & (SCHEDULER_WHEEL_SLOTS - 1)];
+
+  timer->next = *slot;
+  *slot = timer;
+  timer->active = 1;
+}
+
+/************************************************************************/
+/* Runs the timers which expire at tick.                                */
+/************************************************************************/
+static void RunTick(uint32_t tick)
+{
+  scheduler_timer_t **p = &wheel[tick & (SCHEDULER_WHEEL_SLOTS - 1)];
+  scheduler_timer_t *timer;
+
+  while ((timer = *p) != 0){
+    if (timer->expires != tick){
+      // one of the next rounds
+      p = &timer->next;
+      continue;
+    }
+    *p = timer->next;
+    timer->active = 0;
+    if (timer->period){
+      timer->expires += timer->period;
+      Insert(timer);
+    }
+    timer->handler(timer);
+    // the handler may have started or stopped timers of this slot
+    p = &wheel[tick & (SCHEDULER_WHEEL_SLOTS - 1)];
+  }
+}
+
+/************************************************************************/
+/* Clears the timers and handlers and starts the tick interrupt. cpuHz  */
+/* is the clock of the cycle counter.                                   */
+/************************************************************************/
+void Scheduler_Init(uint32_t cpuHz)
+{
+  memset(wheel, 0, sizeof(wheel));
+  memset(handlers, 0, sizeof(handlers));
+  pending = 0;
+  ticks = 0;
+  now = 0;
+  tickCycles = cpuHz / 1000 * SCHEDULER_TICK_MS;
+  irq_register_handler(Scheduler_TickInterrupt, AVR32_CORE_COMPARE_IRQ, SCHEDULER_TICK_IRQ_LEVEL);
+  Set_system_register(AVR32_COMPARE, Get_system_register(AVR32_COUNT) + tickCycles);
+}
+
+/************************************************************************/
+/* Sets the function which runs when event is posted.                   */
+/************************************************************************/
+void Scheduler_SetEventHandler(uint8_t event, scheduler_event_handler_t handler)
+{
+  handlers[event] = handler;
+}
+
+/************************************************************************/
+/* Posts event, also from an interrupt routine. Its handler runs once   */
+/* in the loop.                                                         */
+/************************************************************************/
+void Scheduler_Post(uint8_t event)
+{
+  irqflags_t flags = cpu_irq_save();
+
+  pending |= 1UL << event;
+  cpu_irq_restore(flags);
+}
+
+/************************************************************************/
+/* Runs handler in ms (at least one tick from now, rounded up to the    */
+/* next tick) and then every periodMs if that is not 0. A running timer */
+/* is started again.                                                    */
+/************************************************************************/
+void Scheduler_StartTimer(scheduler_timer_t *timer, uint32_t ms, uint32_t periodMs,
+                          scheduler_timer_handler_t handler)
+{
+  uint32_t delay = (ms + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS;
+
+  Scheduler_StopTimer(timer);
+  timer->expires = now + (delay ? delay : 1);
+  timer->period = (periodMs + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS;
+  timer->handler = handler;
+  Insert(timer);
+}
+
+/************************************************************************/
+/* Stops timer, if it runs.                                             */
+/************************************************************************/
+void Scheduler_StopTimer(scheduler_timer_t *timer)
+{
+  scheduler_timer_t **p;
+
+  if (!timer->active){
+    return;
+  }
+  for (p = &wheel[timer->expires & (SCHEDULER_WHEEL_SLOTS - 1)]; *p; p = &(*p)->next){
+    if (*p == timer){
+      *p = timer->next;
+      break;
+    }
+  }
+  timer->active = 0;
+}
+
+/************************************************************************/
+/* Returns the ms since Scheduler_Init, in steps of SCHEDULER_TICK_MS.  */
+/************************************************************************/
+uint32_t Scheduler_Now(void)
+{
+  return now * SCHEDULER_TICK_MS;
+}
+
+/************************************************************************/
+/* Runs the timers of the ticks which have passed, then the handlers of */
+/* the posted events. Returns nonzero if anything ran.                  */
+/************************************************************************/
+uint8_t Scheduler_RunOnce(void)
+{
+  uint8_t ran = 0;
+  uint32_t events;
+  irqflags_t flags;
+  uint8_t i;
+
+  while (now != ticks){
+    RunTick(++now);
+    ran = 1;
+  }
+  flags = cpu_irq_save();
+  events = pending;
+  pending = 0;
+  cpu_irq_restore(flags);
+  for (i=0; events; i++, events >>= 1){
+    if ((events & 1) && handlers[i]){
+      handlers[i]();
+      ran = 1;
+    }
+  }
+  return ran;
+}
+
+/************************************************************************/
+/* Runs the loop, never returns.                                        */
+/************************************************************************/
+void Scheduler_Run(void)
+{
+  for (;;){
+    Scheduler_RunOnce();
+    cpu_irq_disable();
+    if (pending == 0 && now == ticks){
+      // the sleep instruction enables the interrupts again
+      SLEEP(AVR32_PM_SMODE_GMCLEAR_MASK | AVR32_PM_SMODE_IDLE);
+    }else{
+      cpu_irq_enable();
+    }
+  }
+}
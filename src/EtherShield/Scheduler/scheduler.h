@@ -0,0 +1,69 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Cooperative scheduler
+ *
+ * A run-to-completion event loop. Interrupt routines post events with
+ * Scheduler_Post and the loop calls the handler registered for a posted
+ * event once, however often it was posted meanwhile. Timers run from a
+ * timer wheel which advances every SCHEDULER_TICK_MS ms with the COMPARE
+ * interrupt of the cycle counter. A timer is put into the wheel slot of
+ * the tick it expires at, so starting one and the work per tick do not
+ * grow with the number of timers, only the slot of the current tick is
+ * looked at.
+ *
+ * Handlers run one after the other and must not wait for anything.
+ * Scheduler_Run loops forever and puts the CPU into the idle sleep mode
+ * when nothing is due, the next interrupt (a tick at the latest) wakes it.
+ * Scheduler_RunOnce runs what is due and returns, for a program with a
+ * loop of its own.
+ *
+ * The host build raises the COMPARE interrupt from the virtual clock of
+ * the ENC28J60 model, see host/include/compiler.h.
+ *********************************************/
+//@{
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <stdint.h>
+
+// ms per tick of the timer wheel
+#ifndef SCHEDULER_TICK_MS
+# define SCHEDULER_TICK_MS        10
+#endif
+// slots of the timer wheel, a power of two; timers further out than
+// SCHEDULER_WHEEL_SLOTS ticks go round more than once
+#ifndef SCHEDULER_WHEEL_SLOTS
+# define SCHEDULER_WHEEL_SLOTS    32
+#endif
+// events 0 .. SCHEDULER_EVENTS-1
+#ifndef SCHEDULER_EVENTS
+# define SCHEDULER_EVENTS         8
+#endif
+#define SCHEDULER_TICK_IRQ_LEVEL  0
+
+typedef struct scheduler_timer scheduler_timer_t;
+
+typedef void (*scheduler_event_handler_t)(void);
+typedef void (*scheduler_timer_handler_t)(scheduler_timer_t *timer);
+
+struct scheduler_timer
+{
+  scheduler_timer_t *next;   // in the same wheel slot
+  uint32_t expires;          // tick it runs at
+  uint32_t period;           // ticks between runs, 0 if it runs once
+  scheduler_timer_handler_t handler;
+  uint8_t active;
+};
+
+extern void Scheduler_Init(uint32_t cpuHz);
+extern void Scheduler_SetEventHandler(uint8_t event, scheduler_event_handler_t handler);
+extern void Scheduler_Post(uint8_t event);
+extern void Scheduler_StartTimer(scheduler_timer_t *timer, uint32_t ms, uint32_t periodMs,
+                                 scheduler_timer_handler_t handler);
+extern void Scheduler_StopTimer(scheduler_timer_t *timer);
+extern uint32_t Scheduler_Now(void);
+extern uint8_t Scheduler_RunOnce(void);
+extern void Scheduler_Run(void) __attribute__((__noreturn__));
+
+#endif /* SCHEDULER_H */
+//@}
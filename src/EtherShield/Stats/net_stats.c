@@ -0,0 +1,34 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Network statistics, see net_stats.h
+ *********************************************/
+
+#include <string.h>
+#include "EtherShield/Stats/net_stats.h"
+
+#if NET_STATS
+net_stats_t netStats;
+#endif
+
+/************************************************************************/
+/* Copies the counters to snapshot, all zero with NET_STATS 0.          */
+/************************************************************************/
+void NetStats_Get(net_stats_t *snapshot)
+{
+#if NET_STATS
+  *snapshot = netStats;
+#else
+  memset(snapshot, 0, sizeof(*snapshot));
+#endif
+}
+
+/************************************************************************/
+/* Clears the counters.                                                 */
+/************************************************************************/
+void NetStats_Reset(void)
+{
+#if NET_STATS
+  memset(&netStats, 0, sizeof(netStats));
+#endif
+}
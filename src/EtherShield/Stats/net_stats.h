@@ -0,0 +1,69 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * Network statistics
+ *
+ * MIB style counters of the driver and the transport layer, in the
+ * spirit of the interfaces, IP, ICMP, UDP and TCP groups of RFC 1213.
+ * Every counter is a plain increment where the event happens, all of
+ * them run in the main loop (none in an interrupt routine), so
+ * NetStats_Get copies a consistent snapshot. With NET_STATS 0 the updates
+ * compile to nothing.
+ *
+ * The fill level of the ENC28J60 buffers is kept by the driver itself,
+ * see ENC28J60_GetBufferStatistics.
+ *********************************************/
+//@{
+#ifndef NET_STATS_H
+#define NET_STATS_H
+#include <stdint.h>
+
+#ifndef NET_STATS
+# define NET_STATS                1
+#endif
+
+typedef struct
+{
+  // interface
+  uint32_t rxFrames;         // frames handed to the stack
+  uint32_t rxOctets;
+  uint32_t rxCrcErrors;      // frames with a CRC or symbol error, dropped
+  uint32_t rxTruncated;      // frames longer than the buffer of ENC28J60_PacketReceived
+  uint32_t txFrames;         // frames put on the wire
+  uint32_t txOctets;
+  uint32_t txErrors;         // EIR.TXERIF, a late collision is sent again
+  // ARP
+  uint32_t arpReceived;      // ARP packets for our address
+  uint32_t arpRepliesSent;
+  uint32_t arpRequestsSent;
+  // IP
+  uint32_t ipReceived;       // IPv4 packets for our address
+  uint32_t ipNotForUs;       // IPv4 packets for another address
+  uint32_t ipUnsupported;    // not version 4 or with header options, dropped
+  // ICMP and UDP
+  uint32_t icmpEchoReplies;
+  uint32_t udpSent;
+  // TCP, see tcp_connection.c
+  uint32_t tcpSegmentsIn;
+  uint32_t tcpInErrors;      // segments with bad header or IP length
+  uint32_t tcpSegmentsOut;
+  uint32_t tcpPassiveOpens;  // SYNs which got a control block
+  uint32_t tcpResetsSent;
+  uint32_t tcpTimeouts;      // retransmission timer expiries
+  uint32_t tcpFastRetransmits;
+} net_stats_t;
+
+#if NET_STATS
+extern net_stats_t netStats;
+# define NET_STATS_INC(counter)       (netStats.counter++)
+# define NET_STATS_ADD(counter, n)    (netStats.counter += (n))
+#else
+# define NET_STATS_INC(counter)       ((void)0)
+# define NET_STATS_ADD(counter, n)    ((void)0)
+#endif
+
+extern void NetStats_Get(net_stats_t *snapshot);
+extern void NetStats_Reset(void);
+
+#endif /* NET_STATS_H */
+//@}
@@ -0,0 +1,201 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * ARP cache, see arp_cache.h
+ *
+ * An address hashes to the slot it is looked up first; collisions are
+ * resolved by probing the following slots. The table is small, so a
+ * miss simply probes all of them.
+ *********************************************/
+
+#include <avr32/io.h>
+#include <string.h>
+#include "EtherShield/TransportLayer/net.h"
+#include "EtherShield/ENC28J60/enc28j60.h"
+#include "EtherShield/TransportLayer/transport_layer.h"
+#include "EtherShield/TransportLayer/arp_cache.h"
+
+#if (ARP_CACHE_SIZE & (ARP_CACHE_SIZE - 1)) != 0
+# error "ARP_CACHE_SIZE must be a power of two"
+#endif
+
+static arp_entry_t entries[ARP_CACHE_SIZE];
+static uint8_t request[42];
+static uint32_t now = 0;
+
+static uint8_t Hash(const uint8_t *ip)
+{
+  return (ip[0] ^ ip[1] ^ ip[2] ^ ip[3]) & (ARP_CACHE_SIZE - 1);
+}
+
+/************************************************************************/
+/* Returns the slot of the entry for ip or ARP_CACHE_SIZE.              */
+/************************************************************************/
+static uint8_t Find(const uint8_t *ip)
+{
+  uint8_t i, slot = Hash(ip);
+
+  for (i=0; i<ARP_CACHE_SIZE; i++, slot = (slot + 1) & (ARP_CACHE_SIZE - 1)){
+    if (entries[slot].state != ARP_STATE_FREE && memcmp(entries[slot].ip, ip, 4) == 0){
+      return slot;
+    }
+  }
+  return ARP_CACHE_SIZE;
+}
+
+/************************************************************************/
+/* Returns a slot for a new entry: a free one nearest to the hash of    */
+/* ip, otherwise the oldest resolved entry, or the oldest pending one   */
+/* if all are pending.                                                  */
+/************************************************************************/
+static uint8_t Allocate(const uint8_t *ip)
+{
+  uint8_t i, slot = Hash(ip);
+  uint8_t victim = slot;
+
+  for (i=0; i<ARP_CACHE_SIZE; i++, slot = (slot + 1) & (ARP_CACHE_SIZE - 1)){
+    arp_entry_t *e = &entries[slot];
+    arp_entry_t *v = &entries[victim];
+    if (e->state == ARP_STATE_FREE){
+      victim = slot;
+      break;
+    }
+    if ((e->state == ARP_STATE_RESOLVED && v->state == ARP_STATE_PENDING) ||
+        (e->state == v->state && now - e->time > now - v->time)){
+      victim = slot;
+    }
+  }
+  Pbuf_Free(entries[victim].pending);
+  memset(&entries[victim], 0, sizeof(arp_entry_t));
+  memcpy(entries[victim].ip, ip, 4);
+  return victim;
+}
+
+static void Request(arp_entry_t *e)
+{
+  TCP_SendARPRequest(request, e->ip);
+  e->requests++;
+  e->time = now;
+}
+
+/************************************************************************/
+/* Clears the table.                                                    */
+/************************************************************************/
+void ARPCache_Init(void)
+{
+  uint8_t i;
+
+  for (i=0; i<ARP_CACHE_SIZE; i++){
+    Pbuf_Free(entries[i].pending);
+  }
+  memset(entries, 0, sizeof(entries));
+}
+
+/************************************************************************/
+/* Repeats the requests for unresolved addresses and expires old        */
+/* entries. now is a free running clock in ms.                          */
+/************************************************************************/
+void ARPCache_Poll(uint32_t time)
+{
+  uint8_t i;
+
+  now = time;
+  for (i=0; i<ARP_CACHE_SIZE; i++){
+    arp_entry_t *e = &entries[i];
+    if (e->state == ARP_STATE_RESOLVED && now - e->time >= ARP_CACHE_TTL){
+      e->state = ARP_STATE_FREE;
+    }else if (e->state == ARP_STATE_PENDING && now - e->time >= ARP_REQUEST_INTERVAL){
+      if (e->requests >= ARP_MAX_REQUESTS){
+        // no answer, the held packet is dropped
+        e->state = ARP_STATE_FREE;
+        Pbuf_Free(e->pending);
+        e->pending = 0;
+      }else{
+        Request(e);
+      }
+    }
+  }
+}
+
+/************************************************************************/
+/* Records that ip is at mac. A new entry is only made if create is     */
+/* set, otherwise just an existing one is updated (RFC 826). A packet   */
+/* held for the address is sent now.                                    */
+/************************************************************************/
+void ARPCache_Learn(const uint8_t *ip, const uint8_t *mac, uint8_t create)
+{
+  uint8_t slot;
+  arp_entry_t *e;
+
+  if ((ip[0] | ip[1] | ip[2] | ip[3]) == 0){
+    // ARP probe of a host without an address
+    return;
+  }
+  slot = Find(ip);
+  if (slot == ARP_CACHE_SIZE){
+    if (!create){
+      return;
+    }
+    slot = Allocate(ip);
+  }
+  e = &entries[slot];
+  memcpy(e->mac, mac, 6);
+  e->state = ARP_STATE_RESOLVED;
+  e->time = now;
+  if (e->pending){
+    memcpy(&Pbuf_Payload(e->pending)[ETH_DST_MAC], mac, 6);
+    ENC28J60_PacketSendPbuf(e->pending);
+    e->pending = 0;
+  }
+}
+
+/************************************************************************/
+/* Returns the MAC address of ip or 0 if it is not resolved.            */
+/************************************************************************/
+const uint8_t *ARPCache_Lookup(const uint8_t *ip)
+{
+  uint8_t slot = Find(ip);
+
+  if (slot == ARP_CACHE_SIZE || entries[slot].state != ARP_STATE_RESOLVED ||
+      now - entries[slot].time >= ARP_CACHE_TTL){
+    return 0;
+  }
+  return entries[slot].mac;
+}
+
+/************************************************************************/
+/* Sends the IP packet in buf, len bytes from the ethernet header on,   */
+/* to the MAC address of its destination IP. The source MAC address,    */
+/* type and checksums must be set. Returns 1 if it was sent. Otherwise  */
+/* the packet is held until the address is resolved and 0 returned; if  */
+/* no request for the address is outstanding yet, one is sent.          */
+/************************************************************************/
+uint8_t ARPCache_Send(uint8_t *buf, uint16_t len)
+{
+  uint8_t slot = Find(&buf[IP_DST_P]);
+  arp_entry_t *e;
+
+  if (slot != ARP_CACHE_SIZE && entries[slot].state == ARP_STATE_RESOLVED &&
+      now - entries[slot].time < ARP_CACHE_TTL){
+    memcpy(&buf[ETH_DST_MAC], entries[slot].mac, 6);
+    ENC28J60_PacketSend(len, buf);
+    return 1;
+  }
+  if (slot == ARP_CACHE_SIZE){
+    slot = Allocate(&buf[IP_DST_P]);
+  }
+  e = &entries[slot];
+  Pbuf_Free(e->pending);
+  e->pending = (len <= PBUF_SIZE) ? Pbuf_Alloc(0) : 0;
+  if (e->pending){
+    memcpy(Pbuf_Payload(e->pending), buf, len);
+    e->pending->len = len;
+  }
+  if (e->state != ARP_STATE_PENDING){
+    // new or expired entry
+    e->state = ARP_STATE_PENDING;
+    e->requests = 0;
+    Request(e);
+  }
+  return 0;
+}
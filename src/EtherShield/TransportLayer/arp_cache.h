@@ -0,0 +1,64 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * ARP cache
+ *
+ * A small hashed table of IP to MAC address mappings. Entries are learned
+ * from every ARP packet and from every IP packet for us (TCPIP_IsARP and
+ * TCPIP_IsIP call ARPCache_Learn) and expire ARP_CACHE_TTL ms after they
+ * were last confirmed.
+ *
+ * A packet for an address which is not resolved yet is held in a buffer
+ * of the pool (EtherShield/Buffer/pbuf.h) while the ARP request is
+ * outstanding and sent as soon as the reply arrives. Packets for the same
+ * address share one request: a newer packet replaces the held one, no
+ * second request is sent. Without a free buffer the packet is dropped.
+ *
+ * ARPCache_Poll drives the request retries and the aging and must be
+ * called periodically with a millisecond clock.
+ *********************************************/
+//@{
+#ifndef ARP_CACHE_H
+#define ARP_CACHE_H
+#include <stdint.h>
+#include "EtherShield/Buffer/pbuf.h"
+
+// entries of the table, a power of two
+#ifndef ARP_CACHE_SIZE
+# define ARP_CACHE_SIZE           8
+#endif
+// how long an entry is used after it was last confirmed, in ms
+#ifndef ARP_CACHE_TTL
+# define ARP_CACHE_TTL            300000UL
+#endif
+// time between requests for an unresolved address, in ms
+#ifndef ARP_REQUEST_INTERVAL
+# define ARP_REQUEST_INTERVAL     1000
+#endif
+// requests before an address is given up and its packet dropped
+#ifndef ARP_MAX_REQUESTS
+# define ARP_MAX_REQUESTS         3
+#endif
+
+#define ARP_STATE_FREE            0
+#define ARP_STATE_PENDING         1   // request sent, no reply yet
+#define ARP_STATE_RESOLVED        2
+
+typedef struct
+{
+  uint8_t state;
+  uint8_t requests;          // requests sent while pending
+  uint8_t ip[4];
+  uint8_t mac[6];
+  uint32_t time;             // when it was confirmed or the last request sent
+  pbuf_t *pending;           // the held packet, 0 if none
+} arp_entry_t;
+
+extern void ARPCache_Init(void);
+extern void ARPCache_Poll(uint32_t now);
+extern void ARPCache_Learn(const uint8_t *ip, const uint8_t *mac, uint8_t create);
+extern const uint8_t *ARPCache_Lookup(const uint8_t *ip);
+extern uint8_t ARPCache_Send(uint8_t *buf, uint16_t len);
+
+#endif /* ARP_CACHE_H */
+//@}
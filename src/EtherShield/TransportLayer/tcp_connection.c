@@ -0,0 +1,888 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * TCP connections, see tcp_connection.h
+ *
+ * Only passive opens on the listening port are supported. Segments which
+ * arrive out of order are dropped and answered with an acknowledge of
+ * the expected sequence number, the peer sends them again.
+ *
+ * Nothing is copied for retransmission: the control block points to the
+ * data queued by the application, sndBuf holds the byte at sndUna, or
+ * the generator of a stream produces the bytes again. A
+ * timeout goes back to sndUna with a congestion window of one segment,
+ * three duplicate acknowledges send the segment at sndUna once more and
+ * halve the window (no fast recovery).
+ *
+ * Every segment is built in a buffer of its own from the pool: the data
+ * goes in first, behind TCP_DATA_P bytes of headroom, and the headers in
+ * front of it. Data queued by the application is not copied at all, it
+ * is the tail of the buffer and the driver writes it into the chip right
+ * behind the headers. The driver queues the buffer and returns it to the
+ * pool once it is in the transmit buffer of the chip. Without a free
+ * buffer a segment is lost like a dropped frame and sent by the timer.
+ * If nothing is in flight then, the timer runs TCP_BUFFER_RETRY ms and
+ * is no timeout: neither the backoff nor the windows change.
+ *********************************************/
+
+#include <avr32/io.h>
+#include <string.h>
+#include "EtherShield/TransportLayer/net.h"
+#include "EtherShield/TransportLayer/transport_layer.h"
+#include "EtherShield/TransportLayer/tcp_connection.h"
+#include "EtherShield/Profile/profile.h"
+#include "EtherShield/Stats/net_stats.h"
+
+// sequence number comparison modulo 2^32
+#define SEQ_LT(a, b)    ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b)   ((int32_t)((a) - (b)) <= 0)
+
+// returned by SendSegment if the segment was not sent
+#define NOT_SENT        0xffff
+
+#define TCP_OPTION_END  0
+#define TCP_OPTION_NOP  1
+#define TCP_OPTION_MSS  2
+
+static tcp_connection_t connections[TCP_MAX_CONNECTIONS];
+static uint16_t receiveMss = TCP_DEFAULT_MSS;
+static uint16_t listenPort = 80;
+static tcp_connection_handler_t connectionHandler = 0;
+static uint16_t activity = 0;
+static uint32_t initialSequence = 0x0a000000;
+static uint32_t now = 0;
+
+static uint16_t Get16(const uint8_t *p)
+{
+  return (p[0]<<8) | p[1];
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+static void Put16(uint8_t *p, uint16_t value)
+{
+  p[0]=value>>8;
+  p[1]=value& 0xff;
+}
+
+static void Put32(uint8_t *p, uint32_t value)
+{
+  Put16(p, value>>16);
+  Put16(p+2, value& 0xffff);
+}
+
+static void Notify(uint8_t id, uint8_t event, uint8_t *data, uint16_t len)
+{
+  if (connectionHandler){
+    connectionHandler(id, event, data, len);
+  }
+}
+// the FIN is queued behind the data in these states
+#define FIN_QUEUED(c)   ((c)->state == TCP_STATE_FIN_WAIT_1 || (c)->state == TCP_STATE_CLOSING || \
+                         (c)->state == TCP_STATE_LAST_ACK)
+
+/************************************************************************/
+/* Puts len bytes of the queued data, offset bytes after sndUna, into   */
+/* the segment in p: data of the application as the tail of p, without  */
+/* a copy, the bytes of a stream into the payload. Returns fewer bytes  */
+/* only at the end of a stream, which ends the queued data there.       */
+/************************************************************************/
+static uint16_t Fill(tcp_connection_t *c, uint32_t offset, pbuf_t *p, uint16_t len)
+{
+  uint16_t filled;
+
+  if (!c->generator){
+    p->tail = c->sndBuf + offset;
+    p->tailLen = len;
+    if (c->checksum){
+      p->tailSum = c->checksum(c - connections, c->sndOffset + offset, len);
+      p->tailSummed = 1;
+    }
+    return len;
+  }
+  filled = c->generator(c - connections, c->sndOffset + offset, Pbuf_Payload(p), len);
+  p->len = filled;
+  if (filled < len){
+    c->sndLen = offset + filled;
+  }
+  return filled;
+}
+
+/************************************************************************/
+/* Builds a segment of the connection in a buffer of the pool and sends */
+/* it with sequence number seq. len bytes of the queued data, offset    */
+/* bytes after sndUna, go into the segment. Returns the number of bytes */
+/* sent, a segment which should carry data is not sent without. Returns */
+/* NOT_SENT if it is not sent or the pool is empty.                     */
+/************************************************************************/
+static uint16_t SendSegment(tcp_connection_t *c, uint8_t flags, uint32_t seq, uint32_t offset, uint16_t len)
+{
+  uint8_t options = (flags & TCP_FLAG_SYN_V) ? 4 : 0;
+  uint16_t window = TCP_RECEIVE_WINDOW;
+  uint8_t *packet;
+  pbuf_t *p;
+
+  Profile_Begin(PROFILE_BUILD);
+  p = Pbuf_Alloc(TCP_DATA_P+options);
+  if (!p){
+    Profile_End(PROFILE_BUILD);
+    return NOT_SENT;
+  }
+  if (len){
+    len = Fill(c, offset, p, len);
+    if (!len){
+      Pbuf_Free(p);
+      Profile_End(PROFILE_BUILD);
+      return NOT_SENT;
+    }
+  }
+  packet = Pbuf_Header(p, TCP_DATA_P+options);
+  TCP_SetMACAddress(packet, c->remoteMac);
+  IP_SetHeader(packet, IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+options+len, c->remoteIp);
+
+  Put16(&packet[TCP_SRC_PORT_H_P], c->localPort);
+  Put16(&packet[TCP_DST_PORT_H_P], c->remotePort);
+  Put32(&packet[TCP_SEQ_H_P], seq);
+  Put32(&packet[TCP_SEQACK_H_P], (flags & TCP_FLAG_ACK_V) ? c->rcvNxt : 0);
+  packet[TCP_HEADER_LEN_P]=((TCP_HEADER_LEN_PLAIN+options)/4)<<4;
+  packet[TCP_FLAG_P]=flags;
+  Put16(&packet[TCP_WINDOWSIZE_H_P], window);
+  Put16(&packet[TCP_CHECKSUM_H_P], 0);
+  Put16(&packet[TCP_URGENT_PTR_H_P], 0);
+  if (options){
+    packet[TCP_OPTIONS_P]=TCP_OPTION_MSS;
+    packet[TCP_OPTIONS_P+1]=4;
+    Put16(&packet[TCP_OPTIONS_P+2], receiveMss);
+  }
+  IP_SendPbufWithChecksum(p, 8+TCP_HEADER_LEN_PLAIN+options+len, 2);
+  Profile_End(PROFILE_BUILD);
+  NET_STATS_INC(tcpSegmentsOut);
+
+  if (flags & TCP_FLAG_ACK_V){
+    c->ackPending = 0;
+  }
+  return len;
+}
+
+/************************************************************************/
+/* Sends the segment at sndNxt and advances it. SYN and FIN take a      */
+/* sequence number each. The first new segment sent since the last      */
+/* round trip sample is timed, retransmissions never are (Karn), nor is */
+/* a segment which did not go out. A SYN or FIN without a buffer counts */
+/* as sent, the timer sends it again. Returns the number of bytes sent. */
+/************************************************************************/
+static uint16_t SendNext(tcp_connection_t *c, uint8_t flags, uint16_t len)
+{
+  uint32_t offset = c->sndNxt - c->sndUna;
+
+  len = SendSegment(c, flags, c->sndNxt, offset, len);
+  if (len == NOT_SENT){
+    if (!(flags & (TCP_FLAG_SYN_V|TCP_FLAG_FIN_V))){
+      return 0;
+    }
+    len = 0;
+  }else if (!c->timing && !SEQ_LT(c->sndNxt, c->sndMax)){
+    c->timing = 1;
+    c->rttSeq = c->sndNxt;
+    c->rttStart = now;
+  }
+  c->sndNxt += len;
+  if (flags & (TCP_FLAG_SYN_V|TCP_FLAG_FIN_V)){
+    c->sndNxt++;
+  }
+  if (SEQ_LT(c->sndMax, c->sndNxt)){
+    c->sndMax = c->sndNxt;
+  }
+  return len;
+}
+
+/************************************************************************/
+/* Sends the queued data from sndNxt on as far as the window of the     */
+/* peer and the congestion window allow, then the FIN if one is queued. */
+/************************************************************************/
+static void Output(tcp_connection_t *c)
+{
+  uint32_t offset, window, segment;
+
+  if (c->state == TCP_STATE_SYN_RCVD){
+    return;
+  }
+  window = (c->sndWnd < c->cwnd) ? c->sndWnd : c->cwnd;
+  for (;;){
+    offset = c->sndNxt - c->sndUna;
+    if (offset < c->sndLen){
+      if (offset >= window){
+        return;
+      }
+      segment = c->sndLen - offset;
+      if (segment > window - offset){
+        segment = window - offset;
+      }
+      if (segment > c->mss){
+        segment = c->mss;
+      }
+      if (!SendNext(c, TCP_FLAG_ACK_V|TCP_FLAG_PUSH_V, segment) && offset < c->sndLen){
+        // no buffer, the timer sends it
+        return;
+      }
+    }else{
+      if (offset == c->sndLen && FIN_QUEUED(c)){
+        SendNext(c, TCP_FLAG_FIN_V|TCP_FLAG_ACK_V, 0);
+      }
+      return;
+    }
+  }
+}
+
+/************************************************************************/
+/* Runs the retransmission timer while data or a FIN is outstanding,    */
+/* or the persist timer while the peer announces a zero window.         */
+/* restart starts a running timer again, after new data was acked.      */
+/************************************************************************/
+static void SetTimer(tcp_connection_t *c, uint8_t restart)
+{
+  if (c->state == TCP_STATE_FIN_WAIT_2){
+    return;
+  }
+  if (c->sndMax == c->sndUna && !c->sndLen){
+    c->timerArmed = 0;
+    return;
+  }
+  if (restart || !c->timerArmed){
+    c->timerArmed = 1;
+    c->timer = now + c->rto;
+  }
+}
+
+/************************************************************************/
+/* Updates the round trip time estimate with a sample of rtt ms and     */
+/* calculates the retransmission timeout (RFC 6298, 2).                 */
+/************************************************************************/
+static void RoundTripSample(tcp_connection_t *c, uint32_t rtt)
+{
+  int32_t delta;
+  uint32_t rto;
+
+  if (rtt > TCP_MAX_RTO){
+    rtt = TCP_MAX_RTO;
+  }
+  if (!c->srtt){
+    c->srtt = rtt<<3;
+    c->rttvar = rtt<<1;
+  }else{
+    // SRTT = 7/8 SRTT + 1/8 R, RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+    delta = rtt - (c->srtt>>3);
+    c->srtt += delta;
+    if (delta < 0){
+      delta = -delta;
+    }
+    c->rttvar += delta - (c->rttvar>>2);
+  }
+  // RTO = SRTT + 4 RTTVAR, rttvar already holds 4 RTTVAR
+  rto = (c->srtt>>3) + c->rttvar;
+  if (rto < TCP_MIN_RTO){
+    rto = TCP_MIN_RTO;
+  }
+  if (rto > TCP_MAX_RTO){
+    rto = TCP_MAX_RTO;
+  }
+  c->rto = rto;
+}
+
+/************************************************************************/
+/* Halves the congestion window after a loss (RFC 5681, eqn 4).         */
+/************************************************************************/
+static void Congestion(tcp_connection_t *c)
+{
+  uint32_t flight = (c->sndMax - c->sndUna) / 2;
+
+  c->ssthresh = (flight > 2U*c->mss) ? flight : 2U*c->mss;
+  c->dupAcks = 0;
+  // a sample would include the time until the retransmission (Karn)
+  c->timing = 0;
+}
+
+/************************************************************************/
+/* Fast retransmit: sends the oldest unacknowledged segment again.      */
+/************************************************************************/
+static void Retransmit(tcp_connection_t *c)
+{
+  uint32_t segment = c->sndMax - c->sndUna;
+
+  if (segment > c->sndLen){
+    segment = c->sndLen;
+  }
+  if (segment > c->mss){
+    segment = c->mss;
+  }
+  NET_STATS_INC(tcpFastRetransmits);
+  if (segment){
+    SendSegment(c, TCP_FLAG_ACK_V|TCP_FLAG_PUSH_V, c->sndUna, 0, segment);
+  }else if (FIN_QUEUED(c)){
+    SendSegment(c, TCP_FLAG_FIN_V|TCP_FLAG_ACK_V, c->sndUna, 0, 0);
+  }
+}
+
+/************************************************************************/
+/* Answers a segment which belongs to no connection (RFC 793, p. 65).   */
+/************************************************************************/
+static void SendReset(uint8_t *buf, uint32_t seq, uint32_t ack, uint16_t segLen, uint8_t flags)
+{
+  tcp_connection_t c;
+
+  memcpy(c.remoteMac, &buf[ETH_SRC_MAC], 6);
+  memcpy(c.remoteIp, &buf[IP_SRC_P], 4);
+  c.remotePort = Get16(&buf[TCP_SRC_PORT_H_P]);
+  c.localPort = Get16(&buf[TCP_DST_PORT_H_P]);
+  NET_STATS_INC(tcpResetsSent);
+  if (flags & TCP_FLAG_ACK_V){
+    SendSegment(&c, TCP_FLAG_RST_V, ack, 0, 0);
+  }else{
+    c.rcvNxt = seq + segLen;
+    SendSegment(&c, TCP_FLAG_RST_V|TCP_FLAG_ACK_V, 0, 0, 0);
+  }
+}
+
+static void Release(uint8_t id, uint8_t event)
+{
+  connections[id].state = TCP_STATE_FREE;
+  connections[id].timerArmed = 0;
+  Notify(id, event, 0, 0);
+}
+
+/************************************************************************/
+/* Returns a free control block for a new connection. If the table is   */
+/* full, the least recently active connection which is opening, or      */
+/* closing with all its data acknowledged, is reset. A response still   */
+/* being sent is never cut off. Returns TCP_MAX_CONNECTIONS if none is  */
+/* left.                                                                */
+/************************************************************************/
+static uint8_t Allocate(void)
+{
+  uint8_t i, victim = TCP_MAX_CONNECTIONS;
+
+  for (i=0; i<TCP_MAX_CONNECTIONS; i++){
+    if (connections[i].state == TCP_STATE_FREE){
+      return i;
+    }
+    if ((connections[i].state == TCP_STATE_SYN_RCVD ||
+         (connections[i].state != TCP_STATE_ESTABLISHED && !connections[i].sndLen)) &&
+        (victim == TCP_MAX_CONNECTIONS ||
+         (uint16_t)(activity - connections[i].lastActive) > (uint16_t)(activity - connections[victim].lastActive))){
+      victim = i;
+    }
+  }
+  if (victim != TCP_MAX_CONNECTIONS){
+    TCPConnection_Abort(victim);
+  }
+  return victim;
+}
+
+static uint8_t Find(uint8_t *buf)
+{
+  uint8_t i;
+  uint16_t remotePort = Get16(&buf[TCP_SRC_PORT_H_P]);
+  uint16_t localPort = Get16(&buf[TCP_DST_PORT_H_P]);
+
+  for (i=0; i<TCP_MAX_CONNECTIONS; i++){
+    tcp_connection_t *c = &connections[i];
+    if (c->state != TCP_STATE_FREE && c->remotePort == remotePort && c->localPort == localPort &&
+        memcmp(c->remoteIp, &buf[IP_SRC_P], 4) == 0){
+      return i;
+    }
+  }
+  return TCP_MAX_CONNECTIONS;
+}
+
+/************************************************************************/
+/* Returns the MSS option of a SYN segment or TCP_DEFAULT_MSS.          */
+/************************************************************************/
+static uint16_t ReadMss(uint8_t *buf, uint16_t headerLen)
+{
+  uint16_t i = TCP_OPTIONS_P;
+  uint16_t end = TCP_SRC_PORT_H_P + headerLen;
+
+  while (i < end && buf[i] != TCP_OPTION_END){
+    if (buf[i] == TCP_OPTION_NOP){
+      i++;
+      continue;
+    }
+    if (i+1 >= end || buf[i+1] < 2){
+      break;
+    }
+    if (buf[i] == TCP_OPTION_MSS && buf[i+1] == 4 && i+4 <= end){
+      return Get16(&buf[i+2]);
+    }
+    i += buf[i+1];
+  }
+  return TCP_DEFAULT_MSS;
+}
+
+/************************************************************************/
+/* Passive open: answers a SYN to the listening port with SYN-ACK.      */
+/************************************************************************/
+static void Listen(uint8_t *buf, uint32_t seq, uint16_t headerLen)
+{
+  uint8_t id;
+  tcp_connection_t c;
+  uint16_t mss;
+
+  // the handler of an evicted connection may reuse the packet, take what we need first
+  memset(&c, 0, sizeof(c));
+  memcpy(c.remoteMac, &buf[ETH_SRC_MAC], 6);
+  memcpy(c.remoteIp, &buf[IP_SRC_P], 4);
+  c.remotePort = Get16(&buf[TCP_SRC_PORT_H_P]);
+  c.localPort = listenPort;
+  c.rcvNxt = seq + 1;
+  c.sndWnd = Get16(&buf[TCP_WINDOWSIZE_H_P]);
+  mss = ReadMss(buf, headerLen);
+  c.mss = (mss < receiveMss) ? mss : receiveMss;
+
+  id = Allocate();
+  if (id == TCP_MAX_CONNECTIONS){
+    // dropped, the peer sends its SYN again
+    return;
+  }
+  NET_STATS_INC(tcpPassiveOpens);
+  initialSequence += 0x00010000 + activity;
+  c.sndUna = c.sndNxt = c.sndMax = initialSequence;
+  // initial window, RFC 5681 eqn 1
+  c.cwnd = (c.mss > 2190) ? 2*c.mss : ((c.mss > 1095) ? 3*c.mss : 4*c.mss);
+  c.ssthresh = 0xffff;
+  c.rto = TCP_INITIAL_RTO;
+  c.lastActive = activity;
+  c.state = TCP_STATE_SYN_RCVD;
+  connections[id] = c;
+  SendNext(&connections[id], TCP_FLAG_SYN_V|TCP_FLAG_ACK_V, 0);
+  SetTimer(&connections[id], 1);
+}
+
+/************************************************************************/
+/* Processes the acknowledge field of a segment (RFC 793, p. 72) which  */
+/* carries segLen bytes of data and FIN.                                */
+/************************************************************************/
+static void Acknowledge(uint8_t id, uint32_t ack, uint16_t window, uint16_t segLen)
+{
+  tcp_connection_t *c = &connections[id];
+  uint32_t acked, cwnd;
+  uint8_t finAcked = 0;
+
+  if (SEQ_LT(c->sndMax, ack) || SEQ_LT(ack, c->sndUna)){
+    return;
+  }
+  acked = ack - c->sndUna;
+  if (!acked){
+    // a pure acknowledge repeating the last one with the same window
+    // reports a segment received out of order (RFC 5681, 2)
+    if (!segLen && window && window == c->sndWnd && c->sndMax != c->sndUna &&
+        c->state != TCP_STATE_SYN_RCVD && ++c->dupAcks == 3){
+      Congestion(c);
+      c->cwnd = c->ssthresh;
+      Retransmit(c);
+    }
+    if (!window){
+      // the peer is alive and answers the window probes
+      c->retries = 0;
+    }
+    c->sndWnd = window;
+    Output(c);
+    SetTimer(c, 0);
+    return;
+  }
+
+  if (c->timing && SEQ_LT(c->rttSeq, ack)){
+    c->timing = 0;
+    RoundTripSample(c, now - c->rttStart);
+  }
+  c->retries = 0;
+  c->dupAcks = 0;
+  c->sndUna = ack;
+  if (SEQ_LT(c->sndNxt, ack)){
+    c->sndNxt = ack;
+  }
+  c->sndWnd = window;
+
+  if (c->state == TCP_STATE_SYN_RCVD){
+    // the SYN takes a sequence number but is no data
+    c->state = TCP_STATE_ESTABLISHED;
+    SetTimer(c, 1);
+    Notify(id, TCP_EVENT_CONNECTED, 0, 0);
+    return;
+  }
+  if (acked > c->sndLen){
+    // the FIN takes a sequence number but is no data
+    acked = c->sndLen;
+    finAcked = 1;
+  }
+  c->sndOffset += acked;
+  if (!c->generator){
+    c->sndBuf += acked;
+  }
+  c->sndLen -= acked;
+
+  // slow start below ssthresh, then one segment per round trip
+  cwnd = c->cwnd;
+  if (cwnd < c->ssthresh){
+    cwnd += (acked < c->mss) ? acked : c->mss;
+  }else{
+    cwnd += ((uint32_t)c->mss*c->mss/cwnd) ? ((uint32_t)c->mss*c->mss/cwnd) : 1;
+  }
+  c->cwnd = (cwnd > 0xffff) ? 0xffff : cwnd;
+
+  if (finAcked){
+    switch (c->state){
+      case TCP_STATE_FIN_WAIT_1:
+        c->state = TCP_STATE_FIN_WAIT_2;
+        c->timerArmed = 1;
+        c->timer = now + TCP_FIN_WAIT_TIMEOUT;
+        break;
+      case TCP_STATE_CLOSING:
+      case TCP_STATE_LAST_ACK:
+        Release(id, TCP_EVENT_CLOSED);
+        return;
+      default:
+        break;
+    }
+  }
+  if (acked){
+    Notify(id, TCP_EVENT_ACKED, 0, acked);
+  }
+  if (c->state != TCP_STATE_FREE){
+    Output(c);
+    SetTimer(c, 1);
+  }
+}
+
+/************************************************************************/
+/* The retransmission timer expired: sends again from the oldest        */
+/* unacknowledged byte on with the timeout doubled (RFC 6298, 5). With  */
+/* a zero window this probes the window with one byte. If nothing went  */
+/* out for lack of a buffer, nothing was lost: the data is sent now and */
+/* the backoff, the retries and the windows stay as they are.           */
+/************************************************************************/
+static void Timeout(uint8_t id)
+{
+  tcp_connection_t *c = &connections[id];
+
+  c->timerArmed = 0;
+  if (c->state == TCP_STATE_FIN_WAIT_2){
+    Release(id, TCP_EVENT_CLOSED);
+    return;
+  }
+  if (c->state != TCP_STATE_SYN_RCVD && c->sndMax == c->sndUna && c->sndLen && c->sndWnd){
+    Output(c);
+    if (c->sndMax == c->sndUna){
+      // still no buffer
+      c->timerArmed = 1;
+      c->timer = now + TCP_BUFFER_RETRY;
+    }else{
+      SetTimer(c, 1);
+    }
+    return;
+  }
+  NET_STATS_INC(tcpTimeouts);
+  if (++c->retries > TCP_MAX_RETRIES){
+    TCPConnection_Abort(id);
+    return;
+  }
+  c->rto = (c->rto > TCP_MAX_RTO/2) ? TCP_MAX_RTO : 2*c->rto;
+  c->sndNxt = c->sndUna;
+  if (c->state == TCP_STATE_SYN_RCVD){
+    c->timing = 0;
+    SendNext(c, TCP_FLAG_SYN_V|TCP_FLAG_ACK_V, 0);
+  }else if (c->sndMax != c->sndUna){
+    Congestion(c);
+    c->cwnd = c->mss;
+    Output(c);
+  }else if (c->sndLen){
+    SendNext(c, TCP_FLAG_ACK_V|TCP_FLAG_PUSH_V, 1);
+  }
+  SetTimer(c, 1);
+}
+
+/************************************************************************/
+/* Processes a TCP packet for us. buf holds the complete packet with    */
+/* len bytes. Returns 1 if the packet was for the listening port or a   */
+/* connection of the table, the reply (if any) has been sent then.      */
+/************************************************************************/
+uint8_t TCPConnection_Process(uint8_t *buf, uint16_t len)
+{
+  uint8_t id;
+  uint8_t flags;
+  uint16_t headerLen, dataLen, window, ipLen;
+  uint32_t seq, ack;
+  tcp_connection_t *c;
+
+  if (buf[IP_PROTO_P] != IP_PROTO_TCP_V || len < TCP_DATA_P){
+    return 0;
+  }
+  ipLen = Get16(&buf[IP_TOTLEN_H_P]);
+  headerLen = (buf[TCP_HEADER_LEN_P]>>4)*4;
+  if (ipLen < IP_HEADER_LEN + headerLen || ETH_HEADER_LEN + ipLen > len || headerLen < TCP_HEADER_LEN_PLAIN){
+    NET_STATS_INC(tcpInErrors);
+    return 0;
+  }
+  NET_STATS_INC(tcpSegmentsIn);
+  dataLen = ipLen - IP_HEADER_LEN - headerLen;
+  flags = buf[TCP_FLAG_P];
+  seq = Get32(&buf[TCP_SEQ_H_P]);
+  ack = Get32(&buf[TCP_SEQACK_H_P]);
+  window = Get16(&buf[TCP_WINDOWSIZE_H_P]);
+  activity++;
+
+  id = Find(buf);
+  if (id == TCP_MAX_CONNECTIONS){
+    if (Get16(&buf[TCP_DST_PORT_H_P]) != listenPort){
+      return 0;
+    }
+    if (flags & TCP_FLAG_RST_V){
+      return 1;
+    }
+    if ((flags & (TCP_FLAG_SYN_V|TCP_FLAG_ACK_V)) == TCP_FLAG_SYN_V){
+      Listen(buf, seq, headerLen);
+    }else{
+      SendReset(buf, seq, ack, dataLen + ((flags & TCP_FLAG_SYN_V) ? 1 : 0) + ((flags & TCP_FLAG_FIN_V) ? 1 : 0), flags);
+    }
+    return 1;
+  }
+  c = &connections[id];
+  c->lastActive = activity;
+
+  if (flags & TCP_FLAG_RST_V){
+    // only a reset inside the window is accepted (RFC 793, p. 37)
+    if (SEQ_LEQ(c->rcvNxt, seq) && SEQ_LT(seq, c->rcvNxt + TCP_RECEIVE_WINDOW)){
+      Release(id, TCP_EVENT_ABORTED);
+    }
+    return 1;
+  }
+  if (flags & TCP_FLAG_SYN_V){
+    if (c->state == TCP_STATE_SYN_RCVD && seq + 1 == c->rcvNxt){
+      // our SYN-ACK got lost, send it again
+      SendSegment(c, TCP_FLAG_SYN_V|TCP_FLAG_ACK_V, c->sndUna, 0, 0);
+    }else{
+      SendSegment(c, TCP_FLAG_ACK_V, c->sndNxt, 0, 0);
+    }
+    return 1;
+  }
+  if (seq != c->rcvNxt){
+    // duplicate or out of order: acknowledge what we expect
+    SendSegment(c, TCP_FLAG_ACK_V, c->sndNxt, 0, 0);
+    return 1;
+  }
+  if (!(flags & TCP_FLAG_ACK_V)){
+    return 1;
+  }
+  Acknowledge(id, ack, window, dataLen + ((flags & TCP_FLAG_FIN_V) ? 1 : 0));
+  if (c->state == TCP_STATE_FREE || c->state == TCP_STATE_SYN_RCVD){
+    return 1;
+  }
+
+  if (dataLen && (c->state == TCP_STATE_ESTABLISHED || c->state == TCP_STATE_FIN_WAIT_1 ||
+      c->state == TCP_STATE_FIN_WAIT_2)){
+    c->rcvNxt += dataLen;
+    c->ackPending = 1;
+    Notify(id, TCP_EVENT_DATA, &buf[TCP_SRC_PORT_H_P+headerLen], dataLen);
+  }
+  if ((flags & TCP_FLAG_FIN_V) && c->state != TCP_STATE_FREE){
+    c->rcvNxt++;
+    c->ackPending = 1;
+    switch (c->state){
+      case TCP_STATE_ESTABLISHED:
+        c->state = TCP_STATE_CLOSE_WAIT;
+        Notify(id, TCP_EVENT_PEER_CLOSED, 0, 0);
+        break;
+      case TCP_STATE_FIN_WAIT_1:
+        c->state = TCP_STATE_CLOSING;
+        break;
+      case TCP_STATE_FIN_WAIT_2:
+        // no TIME-WAIT, see tcp_connection.h
+        SendSegment(c, TCP_FLAG_ACK_V, c->sndNxt, 0, 0);
+        Release(id, TCP_EVENT_CLOSED);
+        return 1;
+      default:
+        break;
+    }
+  }
+  if (c->state != TCP_STATE_FREE && c->ackPending){
+    SendSegment(c, TCP_FLAG_ACK_V, c->sndNxt, 0, 0);
+  }
+  return 1;
+}
+
+/************************************************************************/
+/* Runs the timers of the connections. now is a free running clock in   */
+/* ms; call this at least every TCP_MIN_RTO/4 ms.                       */
+/************************************************************************/
+void TCPConnection_Poll(uint32_t time)
+{
+  uint8_t i;
+
+  now = time;
+  for (i=0; i<TCP_MAX_CONNECTIONS; i++){
+    if (connections[i].state != TCP_STATE_FREE && connections[i].timerArmed &&
+        (int32_t)(now - connections[i].timer) >= 0){
+      Timeout(i);
+    }
+  }
+}
+
+/************************************************************************/
+/* Initializes the connection table and listens on port. bufferSize is  */
+/* the longest packet the application receives; it and the size of the  */
+/* buffers of the pool limit the segment size announced to the peers.   */
+/************************************************************************/
+void TCPConnection_Init(uint16_t bufferSize, uint16_t port, tcp_connection_handler_t handler)
+{
+  memset(connections, 0, sizeof(connections));
+  if (bufferSize > PBUF_SIZE){
+    bufferSize = PBUF_SIZE;
+  }
+  receiveMss = bufferSize - TCP_DATA_P;
+  listenPort = port;
+  connectionHandler = handler;
+}
+
+/************************************************************************/
+/* Returns how many bytes are queued and not acknowledged yet.          */
+/************************************************************************/
+uint32_t TCPConnection_Queued(uint8_t id)
+{
+  if (id >= TCP_MAX_CONNECTIONS){
+    return 0;
+  }
+  return connections[id].sndLen;
+}
+
+static uint16_t Queue(uint8_t id, const uint8_t *data, uint16_t len, tcp_checksum_t checksum)
+{
+  tcp_connection_t *c;
+
+  if (id >= TCP_MAX_CONNECTIONS){
+    return 0;
+  }
+  c = &connections[id];
+  if (c->state != TCP_STATE_ESTABLISHED && c->state != TCP_STATE_CLOSE_WAIT){
+    return 0;
+  }
+  if (!c->sndLen){
+    c->generator = 0;
+    c->checksum = checksum;
+    c->sndBuf = data;
+    c->sndOffset = 0;
+  }else if (c->generator || c->checksum != checksum || data != c->sndBuf + c->sndLen){
+    return 0;
+  }
+  if (len > 0xffff - c->sndLen){
+    len = 0xffff - c->sndLen;
+  }
+  c->sndLen += len;
+  Output(c);
+  SetTimer(c, 0);
+  return len;
+}
+
+/************************************************************************/
+/* Queues len bytes for sending and sends as much as the windows allow. */
+/* The data is not copied, it must stay valid until it is acknowledged. */
+/* Data queued by later calls has to follow the queued data in memory,  */
+/* otherwise nothing is queued until TCPConnection_Queued returns 0.    */
+/* Returns the number of bytes queued.                                  */
+/************************************************************************/
+uint16_t TCPConnection_Send(uint8_t id, const uint8_t *data, uint16_t len)
+{
+  return Queue(id, data, len, 0);
+}
+
+/************************************************************************/
+/* Queues len bytes like TCPConnection_Send, whose checksum sums come   */
+/* from checksum, see tcp_checksum_t. Its offsets count from data, the  */
+/* first byte queued while nothing was. Data queued by a later call has */
+/* to use the same checksum function.                                   */
+/************************************************************************/
+uint16_t TCPConnection_SendSummed(uint8_t id, const uint8_t *data, uint16_t len, tcp_checksum_t checksum)
+{
+  return Queue(id, data, len, checksum);
+}
+
+/************************************************************************/
+/* Queues a stream of len bytes, or TCP_STREAM_OPEN if its end is not   */
+/* known yet, which generator produces while it is sent. The generator  */
+/* is called for every segment, and again for retransmissions: it must  */
+/* produce the same bytes for an offset as long as they are queued, see */
+/* tcp_generator_t. Returns 0 if data is still queued.                  */
+/************************************************************************/
+uint8_t TCPConnection_SendStream(uint8_t id, tcp_generator_t generator, uint32_t len)
+{
+  tcp_connection_t *c;
+
+  if (id >= TCP_MAX_CONNECTIONS){
+    return 0;
+  }
+  c = &connections[id];
+  if ((c->state != TCP_STATE_ESTABLISHED && c->state != TCP_STATE_CLOSE_WAIT) || c->sndLen){
+    return 0;
+  }
+  c->generator = generator;
+  c->checksum = 0;
+  c->sndOffset = 0;
+  c->sndLen = len;
+  Output(c);
+  SetTimer(c, 0);
+  return 1;
+}
+
+/************************************************************************/
+/* Queues FIN behind the queued data. The connection is released after  */
+/* the peer acknowledged it and, if it did not already, sent its FIN.   */
+/************************************************************************/
+void TCPConnection_Close(uint8_t id)
+{
+  tcp_connection_t *c;
+
+  if (id >= TCP_MAX_CONNECTIONS){
+    return;
+  }
+  c = &connections[id];
+  switch (c->state){
+    case TCP_STATE_SYN_RCVD:
+      TCPConnection_Abort(id);
+      return;
+    case TCP_STATE_ESTABLISHED:
+      c->state = TCP_STATE_FIN_WAIT_1;
+      break;
+    case TCP_STATE_CLOSE_WAIT:
+      c->state = TCP_STATE_LAST_ACK;
+      break;
+    default:
+      return;
+  }
+  Output(c);
+  SetTimer(c, 0);
+}
+
+/************************************************************************/
+/* Resets the connection and releases it.                               */
+/************************************************************************/
+void TCPConnection_Abort(uint8_t id)
+{
+  if (id >= TCP_MAX_CONNECTIONS || connections[id].state == TCP_STATE_FREE){
+    return;
+  }
+  NET_STATS_INC(tcpResetsSent);
+  SendSegment(&connections[id], TCP_FLAG_RST_V|TCP_FLAG_ACK_V, connections[id].sndNxt, 0, 0);
+  Release(id, TCP_EVENT_ABORTED);
+}
+
+/************************************************************************/
+/* Returns the control block of a connection, 0 if id is no connection. */
+/************************************************************************/
+const tcp_connection_t *TCPConnection_Get(uint8_t id)
+{
+  if (id >= TCP_MAX_CONNECTIONS){
+    return 0;
+  }
+  return &connections[id];
+}
@@ -0,0 +1,157 @@
+/*********************************************
+ * Copyright: GPL V2
+ *
+ * TCP connections
+ *
+ * A fixed table of TCP control blocks with per connection sequence
+ * tracking. It replaces the single data packet model of the TCPIP_*
+ * functions in transport_layer.c: any number of segments can be sent on
+ * up to TCP_MAX_CONNECTIONS concurrent connections.
+ *
+ * The application hands every TCP packet for us to
+ * TCPConnection_Process and gets the events of a connection through one
+ * handler. TCPConnection_Send queues data without copying it: the data
+ * must stay valid until TCP_EVENT_ACKED reported it acknowledged (or the
+ * connection is closed), since lost segments are sent again from it. The engine keeps as many
+ * segments in flight as the window of the peer and the congestion window
+ * allow. The driver writes the data straight from there into the chip.
+ *
+ * Constant data whose checksum sums are known in advance, like the
+ * resources of EtherShield/Resource/static_resource.h, is queued with
+ * TCPConnection_SendSummed: the segments are checksummed from the sums
+ * and the data is only read once, by the driver.
+ *
+ * Content which does not fit into RAM is queued with TCPConnection_SendStream
+ * instead: the engine pulls every segment from a generator at its offset
+ * in the stream, straight into the packet buffer.
+ *
+ * TCPConnection_Poll drives the timers and must be called periodically
+ * with a millisecond clock. The retransmission timeout follows RFC 6298
+ * (Jacobson's estimator, Karn's rule, exponential backoff), the
+ * congestion window RFC 5681 (slow start, congestion avoidance, fast
+ * retransmit after three duplicate acknowledges).
+ *
+ * Every segment is built in a buffer of its own from the pool of
+ * EtherShield/Buffer/pbuf.h, so the packet which carried the data passed
+ * with TCP_EVENT_DATA stays as it is while the handler sends.
+ *********************************************/
+//@{
+#ifndef TCP_CONNECTION_H
+#define TCP_CONNECTION_H
+#include <stdint.h>
+
+#ifndef TCP_MAX_CONNECTIONS
+# define TCP_MAX_CONNECTIONS      8
+#endif
+// receive window announced to the peers, the ENC28J60 receive ring
+// buffers segments until they are processed
+#ifndef TCP_RECEIVE_WINDOW
+# define TCP_RECEIVE_WINDOW       1024
+#endif
+// segment size of a peer which does not send the MSS option (RFC 1122)
+#define TCP_DEFAULT_MSS           536
+
+// retransmission timeout in ms
+#ifndef TCP_INITIAL_RTO
+# define TCP_INITIAL_RTO          1000
+#endif
+#ifndef TCP_MIN_RTO
+# define TCP_MIN_RTO              200
+#endif
+#define TCP_MAX_RTO               60000
+// timer in ms while the data waits for a free buffer of the pool
+#ifndef TCP_BUFFER_RETRY
+# define TCP_BUFFER_RETRY         50
+#endif
+// timeouts in a row before a connection is reset
+#ifndef TCP_MAX_RETRIES
+# define TCP_MAX_RETRIES          8
+#endif
+// how long FIN-WAIT-2 waits for the FIN of the peer, in ms
+#ifndef TCP_FIN_WAIT_TIMEOUT
+# define TCP_FIN_WAIT_TIMEOUT     10000
+#endif
+
+// connection states, RFC 793. TIME-WAIT is not kept, the control block
+// is released once the last FIN is acknowledged.
+#define TCP_STATE_FREE            0
+#define TCP_STATE_SYN_RCVD        1
+#define TCP_STATE_ESTABLISHED     2
+#define TCP_STATE_CLOSE_WAIT      3
+#define TCP_STATE_LAST_ACK        4
+#define TCP_STATE_FIN_WAIT_1      5
+#define TCP_STATE_FIN_WAIT_2      6
+#define TCP_STATE_CLOSING         7
+
+// events for the connection handler
+#define TCP_EVENT_CONNECTED       1   // handshake completed
+#define TCP_EVENT_DATA            2   // data received, data and len are set
+#define TCP_EVENT_ACKED           3   // len bytes of the sent data acknowledged
+#define TCP_EVENT_PEER_CLOSED     4   // the peer sent FIN, call TCPConnection_Close when done
+#define TCP_EVENT_CLOSED          5   // connection closed, the id is free again
+#define TCP_EVENT_ABORTED         6   // connection reset or timed out
+
+typedef void (*tcp_connection_handler_t)(uint8_t id, uint8_t event, uint8_t *data, uint16_t len);
+
+// Writes len bytes of the stream of connection id, starting offset bytes
+// into it, to data and returns the number of bytes written. Fewer than len
+// are only returned at the end of the stream. A lost segment is generated
+// again, so an offset has to give the same bytes until they are acked.
+typedef uint16_t (*tcp_generator_t)(uint8_t id, uint32_t offset, uint8_t *data, uint16_t len);
+
+// Returns the IP_ChecksumAdd sum of len bytes of the data queued on
+// connection id with TCPConnection_SendSummed, starting offset bytes into
+// it, without summing them byte by byte.
+typedef uint16_t (*tcp_checksum_t)(uint8_t id, uint32_t offset, uint16_t len);
+
+// stream length for TCPConnection_SendStream if it ends when the generator
+// returns short
+#define TCP_STREAM_OPEN           0xffffffff
+
+typedef struct
+{
+  uint8_t state;
+  uint8_t ackPending;        // received data or FIN not acknowledged yet
+  uint8_t timing;            // rttSeq is being timed
+  uint8_t timerArmed;
+  uint8_t retries;           // timeouts in a row
+  uint8_t dupAcks;
+  uint8_t remoteMac[6];
+  uint8_t remoteIp[4];
+  uint16_t remotePort;
+  uint16_t localPort;
+  uint32_t sndUna;           // oldest unacknowledged sequence number
+  uint32_t sndNxt;           // next sequence number to send
+  uint32_t sndMax;           // highest sequence number sent
+  uint32_t rcvNxt;           // next sequence number expected
+  uint16_t sndWnd;           // window of the peer
+  uint16_t mss;              // largest segment we send
+  uint16_t cwnd;             // congestion window
+  uint16_t ssthresh;         // slow start threshold
+  const uint8_t *sndBuf;     // queued data, starting at sndUna
+  tcp_generator_t generator; // or the stream which produces it
+  tcp_checksum_t checksum;   // sums the queued data, 0 if it is summed when sent
+  uint32_t sndOffset;        // offset of sndUna in the stream or the queued data
+  uint32_t sndLen;           // bytes queued from sndUna on
+  uint32_t rttSeq;           // sequence number being timed
+  uint32_t rttStart;         // and when it was sent
+  uint32_t srtt;             // smoothed round trip time in ms, times 8, 0 before the first sample
+  uint32_t rttvar;           // round trip time variation in ms, times 4
+  uint16_t rto;              // retransmission timeout in ms
+  uint32_t timer;            // expiry of the retransmission or FIN-WAIT-2 timer
+  uint16_t lastActive;       // activity counter, oldest is evicted first
+} tcp_connection_t;
+
+extern void TCPConnection_Init(uint16_t bufferSize, uint16_t port, tcp_connection_handler_t handler);
+extern uint8_t TCPConnection_Process(uint8_t *buf, uint16_t len);
+extern void TCPConnection_Poll(uint32_t now);
+extern uint16_t TCPConnection_Send(uint8_t id, const uint8_t *data, uint16_t len);
+extern uint16_t TCPConnection_SendSummed(uint8_t id, const uint8_t *data, uint16_t len, tcp_checksum_t checksum);
+extern uint8_t TCPConnection_SendStream(uint8_t id, tcp_generator_t generator, uint32_t len);
+extern uint32_t TCPConnection_Queued(uint8_t id);
+extern void TCPConnection_Close(uint8_t id);
+extern void TCPConnection_Abort(uint8_t id);
+extern const tcp_connection_t *TCPConnection_Get(uint8_t id);
+
+#endif /* TCP_CONNECTION_H */
+//@}
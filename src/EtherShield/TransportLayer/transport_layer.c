@@ -19,17 +19,55 @@
  *********************************************/
 
 #include <avr32/io.h>
+#include <string.h>
 #include "EtherShield/TransportLayer/net.h"
 #include "EtherShield/ENC28J60/enc28j60.h"
 #include "EtherShield/TransportLayer/transport_layer.h"
+#include "EtherShield/TransportLayer/arp_cache.h"
+#include "EtherShield/Profile/profile.h"
+#include "EtherShield/Stats/net_stats.h"
 
 static uint8_t wwwport=80;
+
+// Prebuilt headers of our packets. The replies copy them in one block
+// instead of writing the fields one by one, the IP checksum only adds
+// the fields which differ per packet to the precomputed sum. They are
+// made by TCPIP_Init, or by the compiler if the addresses are constant
+// (see transport_layer.h).
+// ethHeader: source MAC and type IP, from ETH_SRC_MAC on
+// ipHeader: version, flags, TTL 64, protocol TCP and our source
+//   address; length, identification, checksum and destination are zero
+// ipHeaderSum: IP_ChecksumAdd of ipHeader
+// ipaddrSum: IP_ChecksumAdd of our address
+#define ADDRESS_WORDS(a, b, c, d) (((a)<<8 | (b)) + ((c)<<8 | (d)))
+#define ADDRESS_SUM(...) ((ADDRESS_WORDS(__VA_ARGS__) & 0xFFFF) + (ADDRESS_WORDS(__VA_ARGS__) >> 16))
+#define IP_HEADER_SUM(...) (0x4500 + 0x4000 + (64<<8 | IP_PROTO_TCP_V) + ADDRESS_SUM(__VA_ARGS__))
+
+#if defined(TCPIP_MAC_ADDRESS) && defined(TCPIP_IP_ADDRESS)
+static uint8_t macaddr[6] = { TCPIP_MAC_ADDRESS };
+static uint8_t ipaddr[4] = { TCPIP_IP_ADDRESS };
+static const uint8_t ethHeader[ETH_HEADER_LEN-ETH_SRC_MAC] = {
+  TCPIP_MAC_ADDRESS, ETHTYPE_IP_H_V, ETHTYPE_IP_L_V
+};
+static const uint8_t ipHeader[IP_HEADER_LEN] = {
+  IP_V4_V | IP_HEADER_LENGTH_V, 0, 0, 0, 0, 0, 0x40, 0, 64, IP_PROTO_TCP_V, 0, 0,
+  TCPIP_IP_ADDRESS, 0, 0, 0, 0
+};
+static const uint16_t ipHeaderSum = (IP_HEADER_SUM(TCPIP_IP_ADDRESS) & 0xFFFF) + (IP_HEADER_SUM(TCPIP_IP_ADDRESS) >> 16);
+static const uint16_t ipaddrSum = ADDRESS_SUM(TCPIP_IP_ADDRESS);
+#else
 static uint8_t macaddr[6];
 static uint8_t ipaddr[4];
+static uint8_t ethHeader[ETH_HEADER_LEN-ETH_SRC_MAC];
+static uint8_t ipHeader[IP_HEADER_LEN];
+static uint16_t ipHeaderSum;
+static uint16_t ipaddrSum;
+#endif
 static int16_t info_hdr_len=0;
 static int16_t info_data_len=0;
 static uint8_t seqnum=0xa; // my initial tcp sequence number
 static uint16_t ip_identifier = 1;
+static uint8_t *ackBuffer = 0; // buffer of the last TCPIP_SendAcknowledge, its checksums are valid
 
 // The Ip checksum is calculated over the ip header only starting
 // with the header length field and a total length of 20 bytes
@@ -55,49 +93,297 @@ static uint16_t ip_identifier = 1;
 // The RFC has also a C code example: http://www.faqs.org/rfcs/rfc1071.html
 
 /************************************************************************/
-/* Calculates the Checksum of a packet                                  */
+/* Sums len bytes as 16bit words in network order (RFC 1071) and        */
+/* returns the sum folded to 16bit, not complemented.                   */
+/* The words are read 32bit at a time from aligned addresses and added  */
+/* in the byte order of the CPU; the sum is swapped once at the end.    */
+/* Buffers shorter than CHECKSUM_SHORT bytes, single fields and         */
+/* addresses, are summed a byte pair at a time: the alignment steps of  */
+/* the word loop cost more than they save on them.                      */
 /************************************************************************/
-uint16_t CalculateChecksum(uint8_t *buf, uint16_t len,uint8_t type);
-uint16_t CalculateChecksum(uint8_t *buf, uint16_t len,uint8_t type)
+#if defined(__AVR32__) || defined(__BIG_ENDIAN__) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+# define CHECKSUM_BIG_ENDIAN 1
+#else
+# define CHECKSUM_BIG_ENDIAN 0
+#endif
+typedef uint16_t __attribute__((__may_alias__)) checksum_half_t;
+typedef uint32_t __attribute__((__may_alias__)) checksum_word_t;
+// shorter buffers take the byte pair loop
+#define CHECKSUM_SHORT 16
+
+static uint16_t ChecksumFold(uint64_t sum)
+{
+  while (sum>>16){
+    sum = (sum & 0xFFFF)+(sum >> 16);
+  }
+  return (uint16_t)sum;
+}
+
+uint16_t IP_ChecksumAdd(const uint8_t *buf, uint16_t len);
+uint16_t IP_ChecksumAdd(const uint8_t *buf, uint16_t len)
+{
+  // a 64bit accumulator compiles to add/adc and needs no folding in the loop
+  uint64_t sum = 0;
+  const checksum_word_t *word;
+  uint8_t odd = (uintptr_t)buf & 1;
+  uint16_t result;
+
+  if (len < CHECKSUM_SHORT){
+    uint32_t shortSum = 0;
+
+    while (len > 1){
+      shortSum += (uint16_t)(buf[0] << 8 | buf[1]);
+      buf += 2;
+      len -= 2;
+    }
+    if (len){
+      shortSum += (uint16_t)(*buf << 8);
+    }
+    return ChecksumFold(shortSum);
+  }
+  // from an odd address every byte lands in the other half of the word,
+  // sum it that way and swap the result
+  if (odd){
+    sum += CHECKSUM_BIG_ENDIAN ? *buf : (uint16_t)(*buf << 8);
+    buf++;
+    len--;
+  }
+  if (((uintptr_t)buf & 2) && len >= 2){
+    sum += *(const checksum_half_t *)buf;
+    buf += 2;
+    len -= 2;
+  }
+  // 16 bytes per iteration
+  word = (const checksum_word_t *)buf;
+  while (len >= 16){
+    sum += word[0];
+    sum += word[1];
+    sum += word[2];
+    sum += word[3];
+    word += 4;
+    len -= 16;
+  }
+  while (len >= 4){
+    sum += *word++;
+    len -= 4;
+  }
+  buf = (const uint8_t *)word;
+  if (len & 2){
+    sum += *(const checksum_half_t *)buf;
+    buf += 2;
+  }
+  // if there is a byte left then add it (padded with zero)
+  if (len & 1){
+    sum += CHECKSUM_BIG_ENDIAN ? (uint16_t)(*buf << 8) : *buf;
+  }
+
+  result = ChecksumFold(sum);
+  if (odd){
+    result = (uint16_t)((result << 8) | (result >> 8));
+  }
+  if (!CHECKSUM_BIG_ENDIAN){
+    result = (uint16_t)((result << 8) | (result >> 8));
+  }
+  return result;
+}
+
+/************************************************************************/
+/* Calculates the Checksum of a packet whose last dataLen bytes are at  */
+/* data instead of behind the len bytes at buf. If dataSum is not 0, it */
+/* is the IP_ChecksumAdd sum of the data, which is not read then.       */
+/************************************************************************/
+static uint16_t CalculateChecksumSplit(const uint8_t *buf, uint16_t len, const uint8_t *data,
+                                       uint16_t dataLen, const uint16_t *dataSum, uint8_t type)
 {
 	// type 0=ip
 	//      1=udp
 	//      2=tcp
 	uint32_t sum = 0;
+	uint16_t ck;
+  Profile_Begin(PROFILE_CHECKSUM);
   switch(type)
   {
     case 1:
 		  sum+=IP_PROTO_UDP_V; // protocol udp
 		  // the length here is the length of udp (data+header len)
 		  // =length given to this function - (IP.scr+IP.dst length)
-		  sum+=len-8; // = real tcp len
+		  sum+=len+dataLen-8; // = real tcp len
       break;
     case 2:
 		  sum+=IP_PROTO_TCP_V;
 		  // the length here is the length of tcp (data+header len)
 		  // =length given to this function - (IP.scr+IP.dst length)
-		  sum+=len-8; // = real tcp len
+		  sum+=len+dataLen-8; // = real tcp len
     break;
     default:
     break;
   }
 	// build the sum of 16bit words
-	while(len >1){
-		sum += 0xFFFF & (*buf<<8|*(buf+1));
-		buf+=2;
-		len-=2;
-	}
-	// if there is a byte left then add it (padded with zero)
-	if (len){
-		sum += (0xFF & *buf)<<8;
-	}
-	// now calculate the sum over the bytes in the sum
-	// until the result is only 16bit long
-	while (sum>>16){
-		sum = (sum & 0xFFFF)+(sum >> 16);
+	sum += IP_ChecksumAdd(buf, len);
+	// most packets are a single buffer, they make no second call
+	if (dataLen){
+		ck = dataSum ? *dataSum : IP_ChecksumAdd(data, dataLen);
+		// behind an odd length the data bytes are in the other half of the words
+		sum += (len & 1) ? (uint16_t)(ck << 8 | ck >> 8) : ck;
 	}
 	// build 1's complement:
-	return( (uint16_t) sum ^ 0xFFFF);
+	ck = ChecksumFold(sum) ^ 0xFFFF;
+	Profile_End(PROFILE_CHECKSUM);
+	return(ck);
+}
+
+/************************************************************************/
+/* Calculates the Checksum of a packet                                  */
+/************************************************************************/
+uint16_t CalculateChecksum(uint8_t *buf, uint16_t len,uint8_t type);
+uint16_t CalculateChecksum(uint8_t *buf, uint16_t len,uint8_t type)
+{
+  return CalculateChecksumSplit(buf, len, 0, 0, 0, type);
+}
+
+/************************************************************************/
+/* Updates a checksum in place after data it covers changed (RFC 1624,  */
+/* eqn. 3). oldSum and newSum are the IP_ChecksumAdd sums of the data   */
+/* before and after the change; for a single field its 16bit values.    */
+/************************************************************************/
+void IP_ChecksumUpdate(uint8_t *checksum, uint16_t oldSum, uint16_t newSum);
+void IP_ChecksumUpdate(uint8_t *checksum, uint16_t oldSum, uint16_t newSum)
+{
+  uint32_t sum = (uint16_t)~(checksum[0]<<8 | checksum[1]);
+
+  sum += (uint16_t)~oldSum;
+  sum += newSum;
+  sum = ChecksumFold(sum) ^ 0xFFFF;
+  checksum[0]=sum>>8;
+  checksum[1]=sum& 0xff;
+}
+
+/************************************************************************/
+/* Writes a 16bit field and updates the checksum at checksumPos which   */
+/* covers it. The field must start at an even offset from the start of  */
+/* the checksummed data.                                                */
+/************************************************************************/
+void IP_SetWord(uint8_t *buf, uint16_t pos, uint16_t value, uint16_t checksumPos);
+void IP_SetWord(uint8_t *buf, uint16_t pos, uint16_t value, uint16_t checksumPos)
+{
+  uint16_t old = buf[pos]<<8 | buf[pos+1];
+
+  buf[pos]=value>>8;
+  buf[pos+1]=value& 0xff;
+  IP_ChecksumUpdate(&buf[checksumPos], old, value);
+}
+
+/************************************************************************/
+/* Sends an UDP or TCP packet of headerLen bytes at buf and dataLen     */
+/* bytes at data with the checksum from the IP source address computed */
+/* by the ENC28J60. Returns 0 without sending if the offload is         */
+/* disabled. The checksum must be zero.                                 */
+/************************************************************************/
+static uint8_t IP_OffloadChecksum(uint8_t *buf, uint16_t headerLen, const uint8_t *data,
+                                  uint16_t dataLen, uint8_t type)
+{
+  uint16_t len = headerLen - IP_SRC_P + dataLen;
+  uint16_t checksumPos = (type == 1) ? UDP_CHECKSUM_H_P : TCP_CHECKSUM_H_P;
+  // protocol and length of the pseudo header, see CalculateChecksum
+  uint16_t pseudo = ((type == 1) ? IP_PROTO_UDP_V : IP_PROTO_TCP_V) + len - 8;
+  enc28j60_iovec_t iov[2];
+
+  if (!dataLen){
+    return ENC28J60_PacketSendWithChecksum(headerLen, buf, IP_SRC_P, len, checksumPos, pseudo);
+  }
+  iov[0].data = buf;
+  iov[0].len = headerLen;
+  iov[1].data = data;
+  iov[1].len = dataLen;
+  return ENC28J60_PacketSendVWithChecksum(iov, 2, IP_SRC_P, len, checksumPos, pseudo);
+}
+
+/************************************************************************/
+/* Sends an UDP or TCP packet. The checksum over len bytes from the IP  */
+/* source address is computed by the ENC28J60 if the offload is enabled */
+/* and otherwise by CalculateChecksum. The checksum must be zero.       */
+/************************************************************************/
+void IP_SendWithChecksum(uint8_t *buf, uint16_t len, uint8_t type);
+void IP_SendWithChecksum(uint8_t *buf, uint16_t len, uint8_t type)
+{
+  IP_SendWithChecksumV(buf, IP_SRC_P + len, 0, 0, type);
+}
+
+/************************************************************************/
+/* Sends an UDP or TCP packet like IP_SendWithChecksum whose headers    */
+/* are the headerLen bytes at buf and whose data are the dataLen bytes  */
+/* at data, in RAM or flash. The data is not copied behind the headers, */
+/* both are written into the ENC28J60 one after the other.              */
+/************************************************************************/
+void IP_SendWithChecksumV(uint8_t *buf, uint16_t headerLen, const uint8_t *data, uint16_t dataLen, uint8_t type);
+void IP_SendWithChecksumV(uint8_t *buf, uint16_t headerLen, const uint8_t *data, uint16_t dataLen, uint8_t type)
+{
+  uint16_t ck;
+  uint16_t checksumPos = (type == 1) ? UDP_CHECKSUM_H_P : TCP_CHECKSUM_H_P;
+  enc28j60_iovec_t iov[2];
+
+  if(IP_OffloadChecksum(buf, headerLen, data, dataLen, type))
+    return;
+  ck=CalculateChecksumSplit(&buf[IP_SRC_P], headerLen - IP_SRC_P, data, dataLen, 0, type);
+  buf[checksumPos]=ck>>8;
+  buf[checksumPos+1]=ck& 0xff;
+  iov[0].data = buf;
+  iov[0].len = headerLen;
+  iov[1].data = data;
+  iov[1].len = dataLen;
+  ENC28J60_PacketSendV(iov, dataLen ? 2 : 1);
+}
+
+/************************************************************************/
+/* Sends an UDP or TCP packet like IP_SendWithChecksum from the payload */
+/* of p, which starts with the ethernet header, and its tail. The       */
+/* buffer is queued instead of copied and the reference of the caller   */
+/* taken over. A tail with a known sum is checksummed from it, without  */
+/* the offload, which would read the whole packet again.                */
+/************************************************************************/
+void IP_SendPbufWithChecksum(pbuf_t *p, uint16_t len, uint8_t type);
+void IP_SendPbufWithChecksum(pbuf_t *p, uint16_t len, uint8_t type)
+{
+  uint8_t *buf = Pbuf_Payload(p);
+  uint16_t ck;
+  uint16_t checksumPos = (type == 1) ? UDP_CHECKSUM_H_P : TCP_CHECKSUM_H_P;
+  // protocol and length of the pseudo header, see CalculateChecksum
+  uint16_t pseudo = ((type == 1) ? IP_PROTO_UDP_V : IP_PROTO_TCP_V) + len - 8;
+
+  p->len = IP_SRC_P + len - p->tailLen;
+  if(!p->tailSummed && ENC28J60_PacketSendPbufWithChecksum(p, IP_SRC_P, len, checksumPos, pseudo))
+    return;
+  ck=CalculateChecksumSplit(&buf[IP_SRC_P], len - p->tailLen, p->tail, p->tailLen,
+                            p->tailSummed ? &p->tailSum : 0, type);
+  buf[checksumPos]=ck>>8;
+  buf[checksumPos+1]=ck& 0xff;
+  ENC28J60_PacketSendPbuf(p);
+}
+
+/************************************************************************/
+/* Sends an UDP or TCP packet like IP_SendWithChecksum to the MAC       */
+/* address the ARP cache has for its destination IP. If there is none   */
+/* yet, the packet waits in the cache for the ARP reply.                */
+/************************************************************************/
+void IP_SendResolved(uint8_t *buf, uint16_t len, uint8_t type);
+void IP_SendResolved(uint8_t *buf, uint16_t len, uint8_t type)
+{
+  uint16_t ck;
+  uint16_t checksumPos = (type == 1) ? UDP_CHECKSUM_H_P : TCP_CHECKSUM_H_P;
+  const uint8_t *mac = ARPCache_Lookup(&buf[IP_DST_P]);
+
+  if(mac){
+    TCP_SetMACAddress(buf, (uint8_t *)mac);
+    IP_SendWithChecksum(buf, len, type);
+    return;
+  }
+  // the destination is filled in once it is resolved
+  TCP_SetMACAddress(buf, macaddr);
+  ck=CalculateChecksum(&buf[IP_SRC_P], len, type);
+  buf[checksumPos]=ck>>8;
+  buf[checksumPos+1]=ck& 0xff;
+  ARPCache_Send(buf, IP_SRC_P + len);
 }
 
 /************************************************************************/
@@ -107,22 +393,34 @@ uint16_t CalculateChecksum(uint8_t *buf, uint16_t len,uint8_t type)
 /************************************************************************/
 void TCPIP_Init(uint8_t *mymac,uint8_t *myip,uint8_t wwwp)
 {
-	uint8_t i=0;
 	wwwport=wwwp;
-	while(i<4){
-		ipaddr[i]=myip[i];
-		i++;
-	}
-	i=0;
-	while(i<6){
-		macaddr[i]=mymac[i];
-		i++;
-	}
+#if !defined(TCPIP_MAC_ADDRESS) || !defined(TCPIP_IP_ADDRESS)
+	memcpy(ipaddr, myip, 4);
+	memcpy(macaddr, mymac, 6);
+	// the header templates
+	memcpy(ethHeader, macaddr, 6);
+	ethHeader[ETH_TYPE_H_P-ETH_SRC_MAC]=ETHTYPE_IP_H_V;
+	ethHeader[ETH_TYPE_L_P-ETH_SRC_MAC]=ETHTYPE_IP_L_V;
+	memset(ipHeader, 0, IP_HEADER_LEN);
+	ipHeader[IP_P-IP_P]=IP_V4_V | IP_HEADER_LENGTH_V;
+	ipHeader[IP_FLAGS_P-IP_P]=0x40; // don't fragment
+	ipHeader[IP_TTL_P-IP_P]=64;
+	ipHeader[IP_PROTO_P-IP_P]=IP_PROTO_TCP_V;
+	memcpy(&ipHeader[IP_SRC_P-IP_P], ipaddr, 4);
+	ipHeaderSum=IP_ChecksumAdd(ipHeader, IP_HEADER_LEN);
+	ipaddrSum=IP_ChecksumAdd(ipaddr, 4);
+#else
+	// the addresses are built in
+	(void)mymac;
+	(void)myip;
+#endif
+	ARPCache_Init();
 }
 
 /************************************************************************/
 /* Returns 1 if packet is an ARP packet and the packet was addressed to */
-/* us otherwise 0.                                                      */
+/* us otherwise 0. The sender is learned by the ARP cache: if the       */
+/* packet is for us, or the sender is known already (gratuitous ARP).   */
 /************************************************************************/
 uint8_t TCPIP_IsARP(uint8_t *buf,uint16_t len)
 {
@@ -136,16 +434,19 @@ uint8_t TCPIP_IsARP(uint8_t *buf,uint16_t len)
 	}
 	while(i<4){
 		if(buf[ETH_ARP_DST_IP_P+i] != ipaddr[i]){
+			ARPCache_Learn(&buf[ETH_ARP_SRC_IP_P], &buf[ETH_ARP_SRC_MAC_P], 0);
 			return(0);
 		}
 		i++;
 	}
+	NET_STATS_INC(arpReceived);
+	ARPCache_Learn(&buf[ETH_ARP_SRC_IP_P], &buf[ETH_ARP_SRC_MAC_P], 1);
 	return(1);
 }
 
 /************************************************************************/
 /* Returns 1 if packet is an IP packet and the packet was addressed to  */
-/* us otherwise 0.                                                      */
+/* us otherwise 0. The ARP cache learns the sender of a packet for us.  */
 /************************************************************************/
 uint8_t TCPIP_IsIP(uint8_t *buf,uint16_t len)
 {
@@ -160,14 +461,18 @@ uint8_t TCPIP_IsIP(uint8_t *buf,uint16_t len)
 	}
 	if (buf[IP_HEADER_LEN_VER_P]!=0x45){
 		// must be IP V4 and 20 byte header
+		NET_STATS_INC(ipUnsupported);
 		return(0);
 	}
 	while(i<4){
 		if(buf[IP_DST_P+i]!=ipaddr[i]){
+			NET_STATS_INC(ipNotForUs);
 			return(0);
 		}
 		i++;
 	}
+	NET_STATS_INC(ipReceived);
+	ARPCache_Learn(&buf[IP_SRC_P], &buf[ETH_SRC_MAC], 1);
 	return(1);
 }
 
@@ -178,14 +483,9 @@ uint8_t TCPIP_IsIP(uint8_t *buf,uint16_t len)
 void TCP_SwapMACAddresses(uint8_t *buf);
 void TCP_SwapMACAddresses(uint8_t *buf)
 {
-	uint8_t i=0;
-	//
 	//copy the destination mac from the source and fill my mac into src
-	while(i<6){
-		buf[ETH_DST_MAC +i]=buf[ETH_SRC_MAC +i];
-		buf[ETH_SRC_MAC +i]=macaddr[i];
-		i++;
-	}
+	memcpy(&buf[ETH_DST_MAC], &buf[ETH_SRC_MAC], 6);
+	memcpy(&buf[ETH_SRC_MAC], ethHeader, 6);
 }
 
 /************************************************************************/
@@ -195,17 +495,9 @@ void TCP_SwapMACAddresses(uint8_t *buf)
 void TCP_SetMACAddress(uint8_t *buf, uint8_t* dst_mac);
 void TCP_SetMACAddress(uint8_t *buf, uint8_t* dst_mac)
 {
-  uint8_t i=0;
-  //
-  //copy the destination mac from the source and fill my mac into src
-  while(i<6){
-    buf[ETH_DST_MAC +i]=dst_mac[i];
-    buf[ETH_SRC_MAC +i]=macaddr[i];
-    i++;
-  }
-        
-  buf[ ETH_TYPE_H_P ] = ETHTYPE_IP_H_V;
-  buf[ ETH_TYPE_L_P ] = ETHTYPE_IP_L_V;
+  memcpy(&buf[ETH_DST_MAC], dst_mac, 6);
+  // my mac and the type
+  memcpy(&buf[ETH_SRC_MAC], ethHeader, sizeof(ethHeader));
 }
 
 /************************************************************************/
@@ -229,61 +521,59 @@ void TCPIP_SetChecksum(uint8_t *buf)
 
 /************************************************************************/
 /* Makes and IP reply header from a received Packet with a given        */
-/* destination IP                                                       */
+/* destination IP. The header is copied from the template, the checksum */
+/* is the one of the template plus length, id and destination.          */
 /************************************************************************/
 void IP_SetHeader(uint8_t *buf, uint16_t len,uint8_t *dst_ip);
 void IP_SetHeader(uint8_t *buf, uint16_t len,uint8_t *dst_ip)
 {
-  uint8_t i=0;
-		
-	// set ipv4 and header length
-	buf[ IP_P ] = IP_V4_V | IP_HEADER_LENGTH_V;
-
-	// set TOS to default 0x00
-	buf[ IP_TOS_P ] = 0x00;
-
-	// set total length
-	buf[ IP_TOTLEN_H_P ] = (len >>8)& 0xff;
-	buf[ IP_TOTLEN_L_P ] = len & 0xff;
-	
-	// set packet identification
-	buf[ IP_ID_H_P ] = (ip_identifier >>8) & 0xff;
-	buf[ IP_ID_L_P ] = ip_identifier & 0xff;
-	ip_identifier++;
-	
-	// set fragment flags	
-	buf[ IP_FLAGS_H_P ] = 0x00;
-	buf[ IP_FLAGS_L_P ] = 0x00;
-	
-	// set Time To Live
-	buf[ IP_TTL_P ] = 128;
-	
-	// set ip packettype to tcp/udp/icmp...
-	buf[ IP_PROTO_P ] = IP_PROTO_TCP_V;
-	
-	// set source and destination ip address
-  while(i<4){
-    buf[IP_DST_P+i]=dst_ip[i];
-    buf[IP_SRC_P+i]=ipaddr[i];
-    i++;
-  }
-  TCPIP_SetChecksum(buf);
+  uint32_t sum;
+
+  memcpy(&buf[IP_P], ipHeader, IP_HEADER_LEN);
+
+  // set total length
+  buf[ IP_TOTLEN_H_P ] = (len >>8)& 0xff;
+  buf[ IP_TOTLEN_L_P ] = len & 0xff;
+
+  // set packet identification
+  buf[ IP_ID_H_P ] = (ip_identifier >>8) & 0xff;
+  buf[ IP_ID_L_P ] = ip_identifier & 0xff;
+
+  memcpy(&buf[IP_DST_P], dst_ip, 4);
+
+  sum = ipHeaderSum + len + ip_identifier + IP_ChecksumAdd(dst_ip, 4);
+  sum = ChecksumFold(sum) ^ 0xFFFF;
+  buf[IP_CHECKSUM_P]=sum>>8;
+  buf[IP_CHECKSUM_P+1]=sum& 0xff;
+
+  ip_identifier++;
+  ackBuffer = 0;
 }
 
 /************************************************************************/
 /* Sets our IP address to the source IP in the IP header and uses the   */
-/* previously received IP address as the destination IP address         */
+/* previously received IP address as the destination IP address.        */
+/* The checksum of the received header is updated, not recomputed: the  */
+/* address pair only changes by our address replacing the old          */
+/* destination, plus the flags and the TTL as in TCPIP_SetChecksum.     */
 /************************************************************************/
 void IP_SwapIP(uint8_t *buf);
 void IP_SwapIP(uint8_t *buf)
 {
-  uint8_t i=0;
-  while(i<4){
-    buf[IP_DST_P+i]=buf[IP_SRC_P+i];
-    buf[IP_SRC_P+i]=ipaddr[i];
-    i++;
-  }
-  TCPIP_SetChecksum(buf);
+  uint16_t ttl = (64<<8) | buf[IP_PROTO_P];
+  uint32_t oldSum, newSum;
+
+  oldSum = IP_ChecksumAdd(&buf[IP_DST_P], 4);
+  oldSum += (buf[IP_FLAGS_P]<<8 | buf[IP_FLAGS_P+1]) + (buf[IP_TTL_P]<<8 | buf[IP_PROTO_P]);
+  // don't fragment, fragment offset 0, ttl 64
+  newSum = ipaddrSum + 0x4000 + ttl;
+  IP_ChecksumUpdate(&buf[IP_CHECKSUM_P], ChecksumFold(oldSum), ChecksumFold(newSum));
+  memcpy(&buf[IP_DST_P], &buf[IP_SRC_P], 4);
+  memcpy(&buf[IP_SRC_P], &ipHeader[IP_SRC_P-IP_P], 4);
+  buf[IP_FLAGS_P]=0x40;
+  buf[IP_FLAGS_P+1]=0;
+  buf[IP_TTL_P]=64;
+  ackBuffer = 0;
 }
 
 /************************************************************************/
@@ -362,27 +652,22 @@ void TCP_SetHeader(uint8_t *buf,uint16_t rel_ack_num,uint8_t mss,uint8_t cp_seq)
 
 /************************************************************************/
 /* This method send an ARP answere based on a previous received ARP     */
-/* request.                                                             */
+/* request. Replies to our requests are not answered, TCPIP_IsARP       */
+/* already put them into the ARP cache.                                 */
 /************************************************************************/
 void TCP_SendARP(uint8_t *buf)
 {
-  uint8_t i=0;
-  //
+  if(buf[ETH_ARP_OPCODE_H_P]!=ARP_OPCODE_REQUEST_H_V || buf[ETH_ARP_OPCODE_L_P]!=ARP_OPCODE_REQUEST_L_V){
+    return;
+  }
   TCP_SwapMACAddresses(buf);
   buf[ETH_ARP_OPCODE_H_P]=ETH_ARP_OPCODE_REPLY_H_V;
   buf[ETH_ARP_OPCODE_L_P]=ETH_ARP_OPCODE_REPLY_L_V;
-  // fill the mac addresses:
-  while(i<6){
-    buf[ETH_ARP_DST_MAC_P+i]=buf[ETH_ARP_SRC_MAC_P+i];
-    buf[ETH_ARP_SRC_MAC_P+i]=macaddr[i];
-    i++;
-  }
-  i=0;
-  while(i<4){
-    buf[ETH_ARP_DST_IP_P+i]=buf[ETH_ARP_SRC_IP_P+i];
-    buf[ETH_ARP_SRC_IP_P+i]=ipaddr[i];
-    i++;
-  }
+  // the sender becomes the target, we are the sender
+  memcpy(&buf[ETH_ARP_DST_MAC_P], &buf[ETH_ARP_SRC_MAC_P], 10);
+  memcpy(&buf[ETH_ARP_SRC_MAC_P], macaddr, 6);
+  memcpy(&buf[ETH_ARP_SRC_IP_P], ipaddr, 4);
+  NET_STATS_INC(arpRepliesSent);
   // eth+arp is 42 bytes:
   ENC28J60_PacketSend(42,buf);
 }
@@ -394,13 +679,10 @@ void TCPIP_SendPacket(uint8_t *buf,uint16_t len)
 {
   TCP_SwapMACAddresses(buf);
   IP_SwapIP(buf);
-  buf[ICMP_TYPE_P]=ICMP_TYPE_ECHOREPLY_V;
   // we changed only the icmp.type field from request(=8) to reply(=0).
   // we can therefore easily correct the checksum:
-  if (buf[ICMP_CHECKSUM_P] > (0xff-0x08)){
-    buf[ICMP_CHECKSUM_P+1]++;
-  }
-  buf[ICMP_CHECKSUM_P]+=0x08;
+  IP_SetWord(buf, ICMP_TYPE_P, (ICMP_TYPE_ECHOREPLY_V<<8) | buf[ICMP_TYPE_P+1], ICMP_CHECKSUM_P);
+  NET_STATS_INC(icmpEchoReplies);
   ENC28J60_PacketSend(len,buf);
 }
 
@@ -412,14 +694,12 @@ void TCPIP_SendPacket(uint8_t *buf,uint16_t len)
 void UDP_SendPacket(uint8_t *buf,char *data,uint8_t datalen,uint16_t port)
 {
   uint8_t i=0;
-  uint16_t ck;
   TCP_SwapMACAddresses(buf);
   if (datalen>220){
     datalen=220;
   }
   // total length field in the IP header must be set:
-  buf[IP_TOTLEN_H_P]=0;
-  buf[IP_TOTLEN_L_P]=IP_HEADER_LEN+UDP_HEADER_LEN+datalen;
+  IP_SetWord(buf, IP_TOTLEN_H_P, IP_HEADER_LEN+UDP_HEADER_LEN+datalen, IP_CHECKSUM_P);
   IP_SwapIP(buf);
   buf[UDP_DST_PORT_H_P]=port>>8;
   buf[UDP_DST_PORT_L_P]=port & 0xff;
@@ -435,10 +715,8 @@ void UDP_SendPacket(uint8_t *buf,char *data,uint8_t datalen,uint16_t port)
     buf[UDP_DATA_P+i]=data[i];
     i++;
   }
-  ck=CalculateChecksum(&buf[IP_SRC_P], 16 + datalen,1);
-  buf[UDP_CHECKSUM_H_P]=ck>>8;
-  buf[UDP_CHECKSUM_L_P]=ck& 0xff;
-  ENC28J60_PacketSend(UDP_HEADER_LEN+IP_HEADER_LEN+ETH_HEADER_LEN+datalen,buf);
+  NET_STATS_INC(udpSent);
+  IP_SendWithChecksum(buf, 16 + datalen,1);
 }
 
 /************************************************************************/
@@ -447,21 +725,15 @@ void UDP_SendPacket(uint8_t *buf,char *data,uint8_t datalen,uint16_t port)
 /************************************************************************/
 void TCP_SendSynchronisationAcknowledge(uint8_t *buf)
 {
-  uint16_t ck;
   TCP_SwapMACAddresses(buf);
   // total length field in the IP header must be set:
   // 20 bytes IP + 24 bytes (20tcp+4tcp options)
-  buf[IP_TOTLEN_H_P]=0;
-  buf[IP_TOTLEN_L_P]=IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+4;
+  IP_SetWord(buf, IP_TOTLEN_H_P, IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+4, IP_CHECKSUM_P);
   IP_SwapIP(buf);
   buf[TCP_FLAG_P]=TCP_FLAGS_SYNACK_V;
   TCP_SetHeader(buf,1,1,0);
   // calculate the checksum, len=8 (start from ip.src) + TCP_HEADER_LEN_PLAIN + 4 (one option: mss)
-  ck=CalculateChecksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN+4,2);
-  buf[TCP_CHECKSUM_H_P]=ck>>8;
-  buf[TCP_CHECKSUM_L_P]=ck& 0xff;
-  // add 4 for option mss:
-  ENC28J60_PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+4+ETH_HEADER_LEN,buf);
+  IP_SendWithChecksum(buf, 8+TCP_HEADER_LEN_PLAIN+4,2);
 }
 
 /************************************************************************/
@@ -528,29 +800,34 @@ void TCPIP_SendAcknowledge(uint8_t *buf)
   // total length field in the IP header must be set:
   // 20 bytes IP + 20 bytes tcp (when no options)
   j=IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN;
-  buf[IP_TOTLEN_H_P]=j>>8;
-  buf[IP_TOTLEN_L_P]=j& 0xff;
+  IP_SetWord(buf, IP_TOTLEN_H_P, j, IP_CHECKSUM_P);
   IP_SwapIP(buf);
   // calculate the checksum, len=8 (start from ip.src) + TCP_HEADER_LEN_PLAIN + data len
-  j=CalculateChecksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN,2);
-  buf[TCP_CHECKSUM_H_P]=j>>8;
-  buf[TCP_CHECKSUM_L_P]=j& 0xff;
-  ENC28J60_PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+ETH_HEADER_LEN,buf);
+  IP_SendWithChecksum(buf, 8+TCP_HEADER_LEN_PLAIN,2);
+  // TCPIP_SendAcknowledgeWithData can update both checksums from here
+  ackBuffer = buf;
 }
 
 /************************************************************************/
-/* Set the TCP data and send an Acknowledge package based from a        */
-/* previous received acknowledge request.                               */
-/* Before using this method you should have called                      */
-/* TCPIP_ReadLengthInformation before to update the length variables.   */
-/* calling this function.                                               */
-/* After calling TCP_SendAcknowledge you can call this method           */
-/* immediately because this method will NOT modify the TCP and IP       */
-/* headers except the length and checksum.                              */
+/* Sends the acknowledge in buf again with dataLen bytes of data, which */
+/* are at data or, if that is 0, behind the headers in buf.             */
 /************************************************************************/
-void TCPIP_SendAcknowledgeWithData(uint8_t *buf,uint16_t dataLen)
+static void SendAcknowledgeData(uint8_t *buf, const uint8_t *data, uint16_t dataLen)
 {
   uint16_t j;
+  uint8_t ck[2];
+  uint32_t oldSum, newSum;
+  uint8_t acked = (buf == ackBuffer);
+  // the data behind the headers in buf is sent as part of them
+  uint16_t headerLen = ETH_HEADER_LEN+IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+(data ? 0 : dataLen);
+  uint16_t fragmentLen = data ? dataLen : 0;
+  enc28j60_iovec_t iov[2];
+
+  ackBuffer = 0;
+  ck[0]=buf[TCP_CHECKSUM_H_P];
+  ck[1]=buf[TCP_CHECKSUM_L_P];
+  // header length and flags word and tcp length of the acknowledge
+  oldSum = (buf[TCP_HEADER_LEN_P]<<8 | buf[TCP_FLAG_P]) + TCP_HEADER_LEN_PLAIN;
   // fill the header:
   // This code requires that we send one data packet only because we not keeping state information. 
   // Therefore we need to set the fin here:
@@ -559,17 +836,61 @@ void TCPIP_SendAcknowledgeWithData(uint8_t *buf,uint16_t dataLen)
   // total length field in the IP header must be set:
   // 20 bytes IP + 20 bytes tcp (when no options) + len of data
   j=IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dataLen;
-  buf[IP_TOTLEN_H_P]=j>>8;
-  buf[IP_TOTLEN_L_P]=j& 0xff;
-  TCPIP_SetChecksum(buf);
+  if (acked){
+    IP_SetWord(buf, IP_TOTLEN_H_P, j, IP_CHECKSUM_P);
+  }else{
+    buf[IP_TOTLEN_H_P]=j>>8;
+    buf[IP_TOTLEN_L_P]=j& 0xff;
+    TCPIP_SetChecksum(buf);
+  }
   // zero the checksum
   buf[TCP_CHECKSUM_H_P]=0;
   buf[TCP_CHECKSUM_L_P]=0;
-  // calculate the checksum, len=8 (start from ip.src) + TCP_HEADER_LEN_PLAIN + data len
-  j=CalculateChecksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN+dataLen,2);
-  buf[TCP_CHECKSUM_H_P]=j>>8;
-  buf[TCP_CHECKSUM_L_P]=j& 0xff;
-  ENC28J60_PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dataLen+ETH_HEADER_LEN,buf);
+  if (!acked){
+    IP_SendWithChecksumV(buf, headerLen, data, fragmentLen, 2);
+    return;
+  }
+  if (IP_OffloadChecksum(buf, headerLen, data, fragmentLen, 2)){
+    return;
+  }
+  // the header is the one of the acknowledge, only sum the data
+  newSum = (buf[TCP_HEADER_LEN_P]<<8 | buf[TCP_FLAG_P]) + TCP_HEADER_LEN_PLAIN+dataLen;
+  Profile_Begin(PROFILE_CHECKSUM);
+  newSum += IP_ChecksumAdd(data ? data : &buf[TCP_DATA_P], dataLen);
+  IP_ChecksumUpdate(ck, ChecksumFold(oldSum), ChecksumFold(newSum));
+  Profile_End(PROFILE_CHECKSUM);
+  buf[TCP_CHECKSUM_H_P]=ck[0];
+  buf[TCP_CHECKSUM_L_P]=ck[1];
+  iov[0].data = buf;
+  iov[0].len = headerLen;
+  iov[1].data = data;
+  iov[1].len = fragmentLen;
+  ENC28J60_PacketSendV(iov, fragmentLen ? 2 : 1);
+}
+
+/************************************************************************/
+/* Set the TCP data and send an Acknowledge package based from a        */
+/* previous received acknowledge request.                               */
+/* Before using this method you should have called                      */
+/* TCPIP_ReadLengthInformation before to update the length variables.   */
+/* calling this function.                                               */
+/* After calling TCP_SendAcknowledge you can call this method           */
+/* immediately because this method will NOT modify the TCP and IP       */
+/* headers except the length and checksum.                              */
+/************************************************************************/
+void TCPIP_SendAcknowledgeWithData(uint8_t *buf,uint16_t dataLen)
+{
+  SendAcknowledgeData(buf, 0, dataLen);
+}
+
+/************************************************************************/
+/* Like TCPIP_SendAcknowledgeWithData, but the len bytes of the body    */
+/* are sent from where they are, e.g. a constant page in flash, instead */
+/* of being copied behind the headers in buf first.                     */
+/************************************************************************/
+void TCPIP_SendAcknowledgeWithBody(uint8_t *buf, const uint8_t *body, uint16_t len)
+{
+  SendAcknowledgeData(buf, len ? body : 0, len);
 }
 
 /************************************************************************/
@@ -621,6 +942,7 @@ void TCP_SendARPRequest(uint8_t *buf, uint8_t *server_ip)
     buf[ ARP_DST_IP_P + i ] = server_ip[i];
     buf[ ARP_SRC_IP_P + i ] = ipaddr[i];
   }
+  NET_STATS_INC(arpRequestsSent);
 
   // eth+arp is 42 bytes:
   ENC28J60_PacketSend(42,buf);
@@ -628,16 +950,18 @@ void TCP_SendARPRequest(uint8_t *buf, uint8_t *server_ip)
 }
 
 /************************************************************************/
-/* Send a TCP/IP packet to the client.                                  */
+/* Send a TCP/IP packet to the client. With dest_mac 0 the MAC address  */
+/* is taken from the ARP cache and resolved first if needed.            */
 /************************************************************************/
 void TCPIP_SendPackage(uint8_t *buf,uint16_t dest_port, uint16_t src_port, uint8_t flags, uint8_t max_segment_size,
 uint8_t clear_seqack, uint16_t next_ack_num, uint16_t dlength, uint8_t *dest_mac, uint8_t *dest_ip)
 {
   uint8_t i=0;
   uint8_t tseq;
-  uint16_t ck;
 
-  TCP_SetMACAddress(buf, dest_mac);
+  if(dest_mac){
+    TCP_SetMACAddress(buf, dest_mac);
+  }
 
   buf[TCP_DST_PORT_H_P]= (uint8_t) ( (dest_port>>8) & 0xff);
   buf[TCP_DST_PORT_L_P]= (uint8_t) (dest_port & 0xff);
@@ -716,11 +1040,11 @@ uint8_t clear_seqack, uint16_t next_ack_num, uint16_t dlength, uint8_t *dest_mac
   buf[ TCP_URGENT_PTR_L_P ] = 0;
 
   // check sum
-  ck=CalculateChecksum(&buf[IP_SRC_P], 8+TCP_HEADER_LEN_PLAIN+dlength,2);
-  buf[TCP_CHECKSUM_H_P]=ck>>8;
-  buf[TCP_CHECKSUM_L_P]=ck& 0xff;
-  // add 4 for option mss:
-  ENC28J60_PacketSend(IP_HEADER_LEN+TCP_HEADER_LEN_PLAIN+dlength+ETH_HEADER_LEN,buf);
+  if(dest_mac){
+    IP_SendWithChecksum(buf, 8+TCP_HEADER_LEN_PLAIN+dlength,2);
+  }else{
+    IP_SendResolved(buf, 8+TCP_HEADER_LEN_PLAIN+dlength,2);
+  }
 }
 
 /************************************************************************/
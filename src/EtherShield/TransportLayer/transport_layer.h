@@ -14,6 +14,12 @@
 #ifndef IP_ARP_UDP_TCP_H
 #define IP_ARP_UDP_TCP_H
 #include <stdint.h>
+#include "EtherShield/Buffer/pbuf.h"
+
+// Our addresses can be built in at compile time, as comma separated bytes:
+//   -DTCPIP_MAC_ADDRESS=0x54,0x55,0x58,0x10,0x00,0x24 -DTCPIP_IP_ADDRESS=198,162,1,15
+// The header templates are then constant and TCPIP_Init ignores the
+// addresses passed to it.
 
 // you must call this function once before you use any of the other functions:
 extern void TCPIP_Init(uint8_t *mymac,uint8_t *myip,uint8_t wwwp);
@@ -31,11 +37,21 @@ extern uint16_t TCP_GetDataPointer(void);
 extern uint16_t TCP_SetData(uint8_t *buf,uint16_t pos, const char *s);
 extern void TCPIP_SendAcknowledge(uint8_t *buf);
 extern void TCPIP_SendAcknowledgeWithData(uint8_t *buf,uint16_t dlen);
+extern void TCPIP_SendAcknowledgeWithBody(uint8_t *buf, const uint8_t *body, uint16_t len);
 extern void TCP_SendARPRequest(uint8_t *buf, uint8_t *server_ip);
 extern void TCPIP_SendPackage(uint8_t *buf,uint16_t dest_port, uint16_t src_port, uint8_t flags, uint8_t max_segment_size, 
 	uint8_t clear_seqck, uint16_t next_ack_num, uint16_t dlength, uint8_t *dest_mac, uint8_t *dest_ip);
 extern uint16_t TCPIP_GetDataLength ( uint8_t *buf );
 
+// packet building blocks, also used by tcp_connection.c
+extern void TCP_SetMACAddress(uint8_t *buf, uint8_t* dst_mac);
+extern void IP_SetHeader(uint8_t *buf, uint16_t len,uint8_t *dst_ip);
+extern void IP_SendWithChecksum(uint8_t *buf, uint16_t len, uint8_t type);
+extern void IP_SendWithChecksumV(uint8_t *buf, uint16_t headerLen, const uint8_t *data, uint16_t dataLen, uint8_t type);
+extern void IP_SendResolved(uint8_t *buf, uint16_t len, uint8_t type);
+extern void IP_SendPbufWithChecksum(pbuf_t *p, uint16_t len, uint8_t type);
+extern uint16_t IP_ChecksumAdd(const uint8_t *buf, uint16_t len);
+
 
 #endif /* IP_ARP_UDP_TCP_H */
 //@}
@@ -46,8 +46,61 @@ void EtherShield_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_
 {
 	Module_Init(spi, spiDeviceId, spiFlags, spiBaudrate, macAddress);
   TCPIP_Init(macAddress, ipAddress, port);
+	// the driver and the ARP cache have given their buffers back
+	Pbuf_Init();
 }
 
+/************************************************************************
+Select how many bytes of the module buffer are used for transmitting,
+the rest receives. Must be called before EtherShield_Init.
+************************************************************************/
+void EtherShield_SetTransmitBufferSize(uint16_t size)
+{
+	Module_SetTransmitBufferSize(size);
+}
+
+/************************************************************************
+Let the module compute the TCP and UDP checksums of sent packets (on by
+default) or compute them in software.
+************************************************************************/
+void EtherShield_SetChecksumOffload(uint8_t enable)
+{
+	Module_SetChecksumOffload(enable);
+}
+
+/************************************************************************
+Accept IPv4 multicast groups (e.g. 224.0.0.251 for mDNS) with the hash
+table filter of the module, at most ETHERSHIELD_MAX_GROUPS. count 0 drops
+multicast frames again.
+************************************************************************/
+void EtherShield_SetMulticastGroups(const uint8_t (*groups)[4], uint8_t count)
+{
+	uint8_t macs[ETHERSHIELD_MAX_GROUPS][6];
+	uint8_t i;
+
+	if(count > ETHERSHIELD_MAX_GROUPS){
+		count = ETHERSHIELD_MAX_GROUPS;
+	}
+	for(i = 0; i < count; i++){
+		// 01:00:5e and the low 23 bits of the group (RFC 1112)
+		macs[i][0] = 0x01;
+		macs[i][1] = 0x00;
+		macs[i][2] = 0x5e;
+		macs[i][3] = groups[i][1] & 0x7f;
+		macs[i][4] = groups[i][2];
+		macs[i][5] = groups[i][3];
+	}
+	Module_SetHashFilter((const uint8_t (*)[6])macs, count);
+}
+
+/************************************************************************
+Accept broadcast frames of the given ethertypes (ARP only by default).
+************************************************************************/
+void EtherShield_SetBroadcastTypes(const uint16_t *types, uint8_t count)
+{
+	Module_SetBroadcastFilter(types, count);
+}
+
 /************************************************************************
 Set the clock rate.
 Please refer to the ethernet module datasheet
@@ -57,6 +110,42 @@ void EtherShield_SetClock(uint8_t clock)
 	Module_ClkOut(clock);
 }
 
+/************************************************************************
+Let the interrupt of the module pin connected to the GPIO pin queue the
+received packets. EtherShield_PeekPacket then only returns queued packets.
+************************************************************************/
+void EtherShield_EnableInterrupt(uint32_t pin)
+{
+	Module_EnableInterrupt(pin);
+}
+
+/************************************************************************
+Set a function the interrupt calls when it has queued received packets,
+e.g. to post an event to the scheduler. It must not call EtherShield.
+************************************************************************/
+void EtherShield_SetReceiveHandler(void (*handler)(void))
+{
+	Module_SetReceiveCallback(handler);
+}
+
+/************************************************************************
+Return the number of received packets queued by the interrupt
+************************************************************************/
+uint8_t EtherShield_PacketsQueued(void)
+{
+	return Module_PacketsQueued();
+}
+
+/************************************************************************
+Start the packets waiting for the previous one to leave. Returns the
+number of packets still waiting; a program which does not call
+EtherShield_PeekPacket in a loop calls it again while it is nonzero.
+************************************************************************/
+uint8_t EtherShield_ServiceTransmit(void)
+{
+	return Module_ServiceTransmit();
+}
+
 /************************************************************************
 Return nonzero when a valid packet was received
 ************************************************************************/
@@ -65,13 +154,47 @@ uint16_t EtherShield_IsPacketReceived(uint16_t len, uint8_t* packet)
 	return Module_PacketReceived(len, packet);
 }
 
+/************************************************************************
+Opens the next received packet and reads its first len bytes (the
+headers). Returns the length of the whole packet or zero when no valid
+packet was received. The rest of the packet stays in the module until
+it is read with EtherShield_ReadPacket or dropped with
+EtherShield_DiscardPacket.
+************************************************************************/
+uint16_t EtherShield_PeekPacket(uint16_t len, uint8_t* packet)
+{
+	return Module_PacketPeek(len, packet);
+}
+
+/************************************************************************
+Reads len bytes of the opened packet starting at offset into data.
+Returns the number of bytes read.
+************************************************************************/
+uint16_t EtherShield_ReadPacket(uint16_t offset, uint16_t len, uint8_t* data)
+{
+	return Module_PacketRead(offset, len, data);
+}
+
+/************************************************************************
+Releases the opened packet without reading the rest of it.
+************************************************************************/
+void EtherShield_DiscardPacket(void)
+{
+	Module_PacketDiscard();
+}
+
 /************************************************************************
 Return nonzero if the packet is an Address Resolution Protocol (ARP)
 request.
 ************************************************************************/
 uint8_t EtherShield_IsARP(uint8_t *buf,uint16_t len)
 {
-	return TCPIP_IsARP(buf,len);
+	uint8_t arp;
+
+	Profile_Begin(PROFILE_CLASSIFY);
+	arp = TCPIP_IsARP(buf,len);
+	Profile_End(PROFILE_CLASSIFY);
+	return arp;
 }
 
 /************************************************************************
@@ -79,7 +202,9 @@ Response to a previous Address Resolution Protocol (ARP) request.
 ************************************************************************/
 void EtherShield_SendARP(uint8_t *buf)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCP_SendARP(buf);
+	Profile_End(PROFILE_BUILD);
 }
 
 /************************************************************************
@@ -87,7 +212,12 @@ Return nonzero if the packet is for the ethernet module.
 ************************************************************************/
 uint8_t EtherShield_IsIP(uint8_t *buf,uint16_t len)
 {
-	return TCPIP_IsIP(buf, len);
+	uint8_t ip;
+
+	Profile_Begin(PROFILE_CLASSIFY);
+	ip = TCPIP_IsIP(buf, len);
+	Profile_End(PROFILE_CLASSIFY);
+	return ip;
 }
 
 /************************************************************************
@@ -95,7 +225,9 @@ Sends an Echo packet from a request
 ************************************************************************/
 void EtherShield_SendPacket(uint8_t *buf,uint16_t len)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCPIP_SendPacket(buf,len);
+	Profile_End(PROFILE_BUILD);
 }
 
 /************************************************************************
@@ -103,7 +235,9 @@ Send an Acknowledge packet based from a synchronization request.
 ************************************************************************/
 void EtherShield_SendSynchronisationAcknowledge(uint8_t *buf)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCP_SendSynchronisationAcknowledge(buf);
+	Profile_End(PROFILE_BUILD);
 }	
 
 /************************************************************************
@@ -128,7 +262,9 @@ This will modify the eth, ip and tcp header.
 ************************************************************************/
 void EtherShield_SendAcknowledge(uint8_t *buf)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCPIP_SendAcknowledge(buf);
+	Profile_End(PROFILE_BUILD);
 }
 
 /************************************************************************
@@ -140,7 +276,21 @@ except the length and checksum.
 ************************************************************************/
 void EtherShield_SendAcknowledgeData(uint8_t *buf,uint16_t dlen)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCPIP_SendAcknowledgeWithData(buf,dlen);
+	Profile_End(PROFILE_BUILD);
+}
+
+/************************************************************************
+Send an Acknowledge packet like EtherShield_SendAcknowledgeData, but with
+len bytes of body taken from where they are, e.g. a constant page in
+flash, instead of behind the headers in buf. Nothing is copied.
+************************************************************************/
+void EtherShield_SendAcknowledgeBody(uint8_t *buf,const uint8_t *body,uint16_t len)
+{
+	Profile_Begin(PROFILE_BUILD);
+	TCPIP_SendAcknowledgeWithBody(buf,body,len);
+	Profile_End(PROFILE_BUILD);
 }
 
 /************************************************************************
@@ -148,16 +298,21 @@ Send an Address Resolution Protocol (ARP) request to the server ip.
 ************************************************************************/
 void EtherShield_SendARPRequest(uint8_t *buf, uint8_t *server_ip)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCP_SendARPRequest(buf, server_ip);
+	Profile_End(PROFILE_BUILD);
 }
 
 /************************************************************************
-Send a TCP packet to a client.
+Send a TCP packet to a client. Pass dest_mac 0 to take the MAC address
+from the ARP cache; the packet is sent once the address is resolved.
 ************************************************************************/
 void EtherShield_SendNewPacket(uint8_t *buf,uint16_t dest_port, uint16_t src_port, uint8_t flags, uint8_t max_segment_size, 
                                      uint8_t clear_seqck, uint16_t next_ack_num, uint16_t dlength, uint8_t *dest_mac, uint8_t *dest_ip)
 {
+	Profile_Begin(PROFILE_BUILD);
 	TCPIP_SendPackage(buf, dest_port, src_port, flags, max_segment_size, clear_seqck, next_ack_num, dlength,dest_mac,dest_ip);
+	Profile_End(PROFILE_BUILD);
 }
 
 /************************************************************************
@@ -167,3 +322,91 @@ uint16_t EtherShield_GetDataLength( uint8_t *buf )
 {
 	return TCPIP_GetDataLength(buf);
 }
+
+/************************************************************************
+Set up the TCP connection table and listen on port. bufferSize is the
+longest packet the application receives, replies are built in buffers of
+the pool. The handler gets the events of all connections.
+************************************************************************/
+void EtherShield_ListenTCP(uint16_t bufferSize, uint16_t port, tcp_connection_handler_t handler)
+{
+	TCPConnection_Init(bufferSize, port, handler);
+}
+
+/************************************************************************
+Hand a complete TCP packet to the connection table. Returns 1 if it
+belonged to the listening port or to a connection.
+************************************************************************/
+uint8_t EtherShield_ProcessTCP(uint8_t *buf, uint16_t len)
+{
+	return TCPConnection_Process(buf, len);
+}
+
+/************************************************************************
+Run the retransmission timers, now is a clock in ms.
+************************************************************************/
+void EtherShield_PollTCP(uint32_t now)
+{
+	TCPConnection_Poll(now);
+}
+
+/************************************************************************
+Repeat outstanding ARP requests and age the ARP cache, now is a clock
+in ms.
+************************************************************************/
+void EtherShield_PollARP(uint32_t now)
+{
+	ARPCache_Poll(now);
+}
+
+/************************************************************************
+Queue data on a connection, returns the number of bytes queued. The data
+must stay valid until it is acknowledged.
+************************************************************************/
+uint16_t EtherShield_SendTCP(uint8_t id, const uint8_t *data, uint16_t len)
+{
+	return TCPConnection_Send(id, data, len);
+}
+
+/************************************************************************
+Queue a stream of len bytes (or TCP_STREAM_OPEN) on a connection, every
+segment is pulled from generator. Returns 0 if data is still queued.
+************************************************************************/
+uint8_t EtherShield_SendTCPStream(uint8_t id, tcp_generator_t generator, uint32_t len)
+{
+	return TCPConnection_SendStream(id, generator, len);
+}
+
+/************************************************************************
+Copy the network statistics counters (see Stats/net_stats.h).
+************************************************************************/
+void EtherShield_GetStatistics(net_stats_t *stats)
+{
+	NetStats_Get(stats);
+}
+
+/************************************************************************
+Clear the network statistics counters.
+************************************************************************/
+void EtherShield_ResetStatistics(void)
+{
+	NetStats_Reset();
+}
+
+/************************************************************************
+Answer a request for the profiling numbers (see Profile/profile.h) in an
+IP packet for us. Returns 1 if it was one, always 0 unless the library is
+built with ETHERSHIELD_PROFILE.
+************************************************************************/
+uint8_t EtherShield_ServeProfile(uint8_t *buf, uint16_t len)
+{
+	return Profile_Serve(buf, len);
+}
+
+/************************************************************************
+Close a connection.
+************************************************************************/
+void EtherShield_CloseTCP(uint8_t id)
+{
+	TCPConnection_Close(id);
+}
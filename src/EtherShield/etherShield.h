@@ -25,12 +25,32 @@
 #include <inttypes.h>
 #include "EtherShield/TransportLayer/transport_layer.h"
 #include "EtherShield/TransportLayer/net.h"
+#include "EtherShield/TransportLayer/tcp_connection.h"
+#include "EtherShield/TransportLayer/arp_cache.h"
+#include "EtherShield/Profile/profile.h"
+#include "EtherShield/Stats/net_stats.h"
+
+// groups EtherShield_SetMulticastGroups accepts
+#ifndef ETHERSHIELD_MAX_GROUPS
+# define ETHERSHIELD_MAX_GROUPS 8
+#endif
 
 
 uint16_t EtherShield_FillTCPData(uint8_t *buf,uint16_t pos, const char *s);
 void EtherShield_Init(volatile avr32_spi_t *spi, uint8_t spiDeviceId, spi_flags_t spiFlags, uint32_t spiBaudrate, uint8_t* macAddress, uint8_t *ipAddress, uint8_t port);
 void EtherShield_SetClock(uint8_t clk);
+void EtherShield_SetTransmitBufferSize(uint16_t size);
+void EtherShield_SetChecksumOffload(uint8_t enable);
+void EtherShield_SetMulticastGroups(const uint8_t (*groups)[4], uint8_t count);
+void EtherShield_SetBroadcastTypes(const uint16_t *types, uint8_t count);
+void EtherShield_EnableInterrupt(uint32_t pin);
+void EtherShield_SetReceiveHandler(void (*handler)(void));
+uint8_t EtherShield_PacketsQueued(void);
+uint8_t EtherShield_ServiceTransmit(void);
 uint16_t EtherShield_IsPacketReceived(uint16_t len, uint8_t* packet);
+uint16_t EtherShield_PeekPacket(uint16_t len, uint8_t* packet);
+uint16_t EtherShield_ReadPacket(uint16_t offset, uint16_t len, uint8_t* data);
+void EtherShield_DiscardPacket(void);
 uint8_t EtherShield_IsARP(uint8_t *buf,uint16_t len);
 void EtherShield_SendARP(uint8_t *buf);
 uint8_t EtherShield_IsIP(uint8_t *buf,uint16_t len);
@@ -40,9 +60,20 @@ void EtherShield_ReadLengthInformation(uint8_t *buf);
 uint16_t EtherShield_GetDataPointer(void);
 void EtherShield_SendAcknowledge(uint8_t *buf);
 void EtherShield_SendAcknowledgeData(uint8_t *buf,uint16_t dlen);
+void EtherShield_SendAcknowledgeBody(uint8_t *buf,const uint8_t *body,uint16_t len);
 void EtherShield_SendARPRequest(uint8_t *buf, uint8_t *server_ip);
 void EtherShield_SendNewPacket(uint8_t *buf,uint16_t dest_port, uint16_t src_port, uint8_t flags, uint8_t max_segment_size, uint8_t clear_seqck, uint16_t next_ack_num, uint16_t dlength, uint8_t *dest_mac, uint8_t *dest_ip);
 uint16_t EtherShield_GetDataLength( uint8_t *buf );
+void EtherShield_ListenTCP(uint16_t bufferSize, uint16_t port, tcp_connection_handler_t handler);
+uint8_t EtherShield_ProcessTCP(uint8_t *buf, uint16_t len);
+void EtherShield_PollTCP(uint32_t now);
+void EtherShield_PollARP(uint32_t now);
+uint16_t EtherShield_SendTCP(uint8_t id, const uint8_t *data, uint16_t len);
+uint8_t EtherShield_SendTCPStream(uint8_t id, tcp_generator_t generator, uint32_t len);
+void EtherShield_CloseTCP(uint8_t id);
+void EtherShield_GetStatistics(net_stats_t *stats);
+void EtherShield_ResetStatistics(void);
+uint8_t EtherShield_ServeProfile(uint8_t *buf, uint16_t len);
 		
 #endif // ETHERSHIELD_H
 
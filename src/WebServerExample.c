@@ -12,19 +12,204 @@
 #include "sysclk.h"
 #include "spi_master.h"
 #include "EtherShield/etherShield.h"
+#include "EtherShield/Scheduler/scheduler.h"
+#include "EtherShield/Resource/static_resource.h"
 
 #define SPI_ENC28J60             AT45DBX_SPI
 #define SPI_DEVICE_EXAMPLE_ID    AT45DBX_SPI_NPCS
 #define SPI_EXAMPLE_BAUDRATE     3000000
+#define INT_ENC28J60             AVR32_PIN_PA12
 
 static uint8_t mymac[6] = {0x54,0x55,0x58,0x10,0x00,0x24};
 static uint8_t myip[4] = {198,162,1,15};
 static char baseurl[]="http://198.162.1.15/";
+// temperature shown on the page, this board has no sensor to read it from
+static char temp_string[8]="--";
 static uint16_t mywwwport =80; // listen port for tcp/www (max range 1-254)
 
-#define BUFFER_SIZE 500
-static uint8_t buf[BUFFER_SIZE+1];
-uint16_t print_webpage(uint8_t *buf);
+// a received packet is read into a buffer of the pool, see EtherShield/Buffer/pbuf.h
+#define BUFFER_SIZE PBUF_SIZE
+// eth, ip and tcp header with the mss option, read before the rest of a packet
+#define HEADER_SIZE (TCP_OPTIONS_P+4)
+static uint16_t webpage_generator(uint8_t id, uint32_t offset, uint8_t *data, uint16_t len);
+
+static const char okResponse[] = "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n<h1>200 OK</h1>";
+// the web page in the internal flash, 0 if it could not be stored there
+static const static_resource_t *webpage;
+// set while a response is queued on a connection
+static uint8_t responding[TCP_MAX_CONNECTIONS];
+
+// events of the scheduler
+#define EVENT_PACKET     0   // the interrupt has queued received packets
+#define EVENT_TRANSMIT   1   // packets wait for the previous one to leave
+// ms between the runs of the retransmission and ARP timers
+#define TCP_POLL_MS      SCHEDULER_TICK_MS
+#define ARP_POLL_MS      100
+static scheduler_timer_t tcpTimer;
+static scheduler_timer_t arpTimer;
+
+static void http_handler(uint8_t id, uint8_t event, uint8_t *data, uint16_t len)
+{
+  switch(event){
+    case TCP_EVENT_DATA:
+      if(responding[id]){
+        break;
+      }
+      if(len < 4 || strncmp("GET ",(char *)data,4)!=0){
+        // head, post and other methods for possible status codes see:
+        // http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
+        EtherShield_SendTCP(id, (const uint8_t *)okResponse, sizeof(okResponse) - 1);
+      }
+      else if(webpage){
+        // sent from the flash, see store_webpage
+        StaticResource_Serve(id, webpage);
+      }
+      else {
+        // the page is generated segment by segment, it never is in RAM
+        EtherShield_SendTCPStream(id, webpage_generator, TCP_STREAM_OPEN);
+      }
+      // HTTP/1.0: the connection is closed after the response
+      responding[id] = 1;
+      EtherShield_CloseTCP(id);
+      break;
+    case TCP_EVENT_PEER_CLOSED:
+      if(!responding[id]){
+        EtherShield_CloseTCP(id);
+      }
+      break;
+    case TCP_EVENT_CLOSED:
+    case TCP_EVENT_ABORTED:
+      responding[id] = 0;
+      break;
+    default:
+      break;
+  }
+}
+
+// handles one received packet in buf
+static void handle_frame(uint8_t *buf)
+{
+  uint16_t plen;
+
+  plen = EtherShield_PeekPacket(HEADER_SIZE, buf);
+
+  /*plen will ne unequal to zero if there is a valid packet (without crc error) */
+  if(plen!=0){
+    if(plen>BUFFER_SIZE-1){
+      plen=BUFFER_SIZE-1;
+    }
+    
+    // arp is broadcast if unknown but a host may also verify the mac address by sending it to a unicast address.
+    if(EtherShield_IsARP(buf,plen)){
+      EtherShield_SendARP(buf);
+      return;
+    }
+
+    // check if ip packets are for us:
+    if(EtherShield_IsIP(buf,plen)==0){
+      return;
+    }
+
+    // only echo requests and tcp packets are read beyond the headers
+    if((buf[IP_PROTO_P]==IP_PROTO_ICMP_V && buf[ICMP_TYPE_P]==ICMP_TYPE_ECHOREQUEST_V) ||
+       buf[IP_PROTO_P]==IP_PROTO_TCP_V){
+      if(plen>HEADER_SIZE){
+        EtherShield_ReadPacket(HEADER_SIZE, plen-HEADER_SIZE, &buf[HEADER_SIZE]);
+      }
+      buf[plen]='\0';
+    }
+    EtherShield_DiscardPacket();
+    
+    // check if we need to echo a package
+    if(buf[IP_PROTO_P]==IP_PROTO_ICMP_V && buf[ICMP_TYPE_P]==ICMP_TYPE_ECHOREQUEST_V){
+      EtherShield_SendPacket(buf,plen);
+      return;
+    }
+
+    // profiling numbers, see EtherShield/Profile/profile.h
+    if(EtherShield_ServeProfile(buf,plen)){
+      return;
+    }
+    
+    // www connections, see http_handler
+    if (buf[IP_PROTO_P]==IP_PROTO_TCP_V){
+      EtherShield_ProcessTCP(buf,plen);
+    }
+  }
+}
+
+// handles one received packet, called through the scheduler. The packet
+// keeps its buffer while the replies are built in buffers of their own.
+static void handle_packet(void)
+{
+  pbuf_t *p = Pbuf_Alloc(0);
+
+  // without a free buffer the packet is dropped by packet_received
+  if(p){
+    handle_frame(Pbuf_Payload(p));
+    Pbuf_Free(p);
+  }
+}
+
+// runs in the INT interrupt of the enc28j60
+static void packet_interrupt(void)
+{
+  Scheduler_Post(EVENT_PACKET);
+}
+
+// starts the packets which wait for the wire, until none is left
+static void transmit(void)
+{
+  if(EtherShield_ServiceTransmit()){
+    Scheduler_Post(EVENT_TRANSMIT);
+  }
+}
+
+static void packet_received(void)
+{
+  gpio_set_gpio_pin(AVR32_PIN_PA13);
+  handle_packet();
+  // the unread rest of a packet which is not for us is dropped here, the
+  // interrupt is only armed again after that
+  EtherShield_DiscardPacket();
+  // one packet per run, the timers are not held up by a burst
+  if(EtherShield_PacketsQueued()){
+    Scheduler_Post(EVENT_PACKET);
+  }
+  transmit();
+  gpio_clr_gpio_pin(AVR32_PIN_PA13);
+}
+
+static void poll_tcp(scheduler_timer_t *timer)
+{
+  EtherShield_PollTCP(Scheduler_Now());
+  transmit();
+}
+
+static void poll_arp(scheduler_timer_t *timer)
+{
+  EtherShield_PollARP(Scheduler_Now());
+  transmit();
+}
+
+// Stores the web page in the internal flash, from where it is served
+// without any copying. The parts do not change while the program runs,
+// the flash is only written if the page differs from the stored one.
+static void store_webpage(void)
+{
+  pbuf_t *p = Pbuf_Alloc(0);
+  uint16_t len;
+
+  if(!p){
+    return;
+  }
+  len = webpage_generator(0, 0, Pbuf_Payload(p), PBUF_SIZE);
+  // a page which fills the buffer may be longer, it is generated instead
+  if(len < PBUF_SIZE){
+    webpage = StaticResource_Store("/", Pbuf_Payload(p), len);
+  }
+  Pbuf_Free(p);
+}
 
 void setup(void);
 void setup(void)
@@ -36,100 +221,88 @@ void setup(void)
 	 * the board initialization.
 	 */
 	board_init();
+
+  /*the vector table first: ENC28J60_Init registers the PDCA handlers of the
+    driver, irq_initialize_vectors would reset them to _unhandled_interrupt*/
+  irq_initialize_vectors();
    
   /*initialize enc28j60*/
   EtherShield_Init(SPI_ENC28J60, 0,  SPI_MODE_0,	SPI_EXAMPLE_BAUDRATE, mymac, myip, mywwwport);
   EtherShield_SetClock(2);
+  EtherShield_ListenTCP(BUFFER_SIZE-1, mywwwport, http_handler);
+  store_webpage();
+
+  /*received packets are queued by the INT interrupt of the enc28j60, which
+    posts EVENT_PACKET*/
+  Scheduler_Init(sysclk_get_cpu_hz());
+  Scheduler_SetEventHandler(EVENT_PACKET, packet_received);
+  Scheduler_SetEventHandler(EVENT_TRANSMIT, transmit);
+  Scheduler_StartTimer(&tcpTimer, TCP_POLL_MS, TCP_POLL_MS, poll_tcp);
+  Scheduler_StartTimer(&arpTimer, ARP_POLL_MS, ARP_POLL_MS, poll_arp);
+  EtherShield_SetReceiveHandler(packet_interrupt);
+  EtherShield_EnableInterrupt(INT_ENC28J60);
+  cpu_irq_enable();
+}
+
+// One pass of the scheduler: runs the timers and events which are due.
+// Also called by the tools of the host build.
+void loop(void);
+void loop(void)
+{
+  Scheduler_RunOnce();
 }
 
 int main(void)
 {
-  uint16_t plen, dat_p;
   gpio_configure_pin(AVR32_PIN_PA13, GPIO_DIR_OUTPUT | GPIO_INIT_LOW);
   gpio_clr_gpio_pin(AVR32_PIN_PA13);
   setup();
   
-  while(1)
-  {
-    gpio_set_gpio_pin(AVR32_PIN_PA13);
-    plen = EtherShield_IsPacketReceived(BUFFER_SIZE, buf);
-
-    /*plen will ne unequal to zero if there is a valid packet (without crc error) */
-    if(plen!=0){
-      
-      // arp is broadcast if unknown but a host may also verify the mac address by sending it to a unicast address.
-      if(EtherShield_IsARP(buf,plen)){
-        EtherShield_SendARP(buf);
-        continue;
-      }
+  // sleeps while there is nothing to do
+  Scheduler_Run();
+}
 
-      // check if ip packets are for us:
-      if(EtherShield_IsIP(buf,plen)==0){
-        continue;
-      }
-      
-      // check if we need to echo a package
-      if(buf[IP_PROTO_P]==IP_PROTO_ICMP_V && buf[ICMP_TYPE_P]==ICMP_TYPE_ECHOREQUEST_V){
-        EtherShield_SendPacket(buf,plen);
-        continue;
-      }
-      
-      // tcp port www start, compare only the lower byte
-      if (buf[IP_PROTO_P]==IP_PROTO_TCP_V&&buf[TCP_DST_PORT_H_P]==0&&buf[TCP_DST_PORT_L_P]==mywwwport){
-        if (buf[TCP_FLAGS_P] & TCP_FLAGS_SYN_V){
-          EtherShield_SendSynchronisationAcknowledge(buf); // make_tcp_synack_from_syn does already send the syn,ack
-          continue;
-        }
-        if (buf[TCP_FLAGS_P] & TCP_FLAGS_ACK_V){
-          EtherShield_ReadLengthInformation(buf); // Update the length variables in the EtherShield lib
-          dat_p=EtherShield_GetDataPointer();
-          if (dat_p==0){ // we can possibly have no data, just ack:
-            if (buf[TCP_FLAGS_P] & TCP_FLAGS_FIN_V){
-              EtherShield_SendAcknowledge(buf);
-            }
-            continue;
-          }
-          if (strncmp("GET ",(char *)&(buf[dat_p]),4)!=0){
-            // head, post and other methods for possible status codes see:
-            // http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
-            plen=EtherShield_FillTCPData(buf,0,"HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n<h1>200 OK</h1>");
-          }
-          else if (strncmp("/ ",(char *)&(buf[dat_p+4]),2)==0){
-            plen=print_webpage(buf);
-          }
-          else {
-            plen=print_webpage(buf);
-          }
-          EtherShield_SendAcknowledge(buf); // send ack for http get
-          EtherShield_SendAcknowledgeData(buf,plen); // send data
-        }
-      }
-    }
-    gpio_clr_gpio_pin(AVR32_PIN_PA13);
+// Parts of the web page in order, 0 after the last one.
+static const char *webpage_part(uint8_t part)
+{
+  switch(part){
+    case 0: return "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n";
+    case 1: return "<center><p><h1>Welcome to AVR32 Ethernet Shield V1.0  </h1></p> ";
+    case 2: return "<hr><br><form METHOD=get action=\"";
+    case 3: return baseurl;
+    case 4: return "\">";
+    case 5: return temp_string;
+    case 6: return "  &#176C</font></h1><br> ";
+    case 7: return "<input type=hidden name=cmd value=1>";
+    case 8: return "<input type=submit value=\"Send Request\"></form>";
+    default: return 0;
   }
 }
 
-uint16_t print_webpage(uint8_t *buf)
+// Copies len bytes of the web page from offset on to data, straight into
+// the segment the tcp connection sends. Returns fewer bytes at the end of
+// the page. The parts must not change while the page is sent, lost
+// segments are generated again.
+static uint16_t webpage_generator(uint8_t id, uint32_t offset, uint8_t *data, uint16_t len)
 {
-  int i=0;
-  uint16_t plen;
-  
-  plen=EtherShield_FillTCPData(buf,0,"HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n");
-  plen=EtherShield_FillTCPData(buf,plen,"<center><p><h1>Welcome to AVR32 Ethernet Shield V1.0  </h1></p> ");
-  
-  plen=EtherShield_FillTCPData(buf,plen,"<hr><br><form METHOD=get action=\"");
-  plen=EtherShield_FillTCPData(buf,plen,baseurl);
-  plen=EtherShield_FillTCPData(buf,plen,"\">");
-  
-    
-  while (temp_string[i]) {
-    buf[TCP_CHECKSUM_L_P+3+plen]=temp_string[i++];
-    plen++;
-  }
+  uint8_t part = 0;
+  uint16_t n = 0;
+  uint16_t partLen;
+  const char *s;
 
-  plen=EtherShield_FillTCPData(buf,plen,"  &#176C</font></h1><br> ");
-  plen=EtherShield_FillTCPData(buf,plen,"<input type=hidden name=cmd value=1>");
-  plen=EtherShield_FillTCPData(buf,plen,"<input type=submit value=\"Send Request\"></form>");
-  
-  return(plen);
+  while(n < len && (s = webpage_part(part++)) != 0){
+    partLen = strlen(s);
+    if(offset >= partLen){
+      offset -= partLen;
+      continue;
+    }
+    partLen -= offset;
+    if(partLen > len - n){
+      partLen = len - n;
+    }
+    memcpy(data + n, s + offset, partLen);
+    n += partLen;
+    offset = 0;
+  }
+  return n;
 }
\ No newline at end of file